@@ -0,0 +1,61 @@
+// Deeply nested generic types, which produce large and deep debug info.
+#![no_std]
+
+pub struct Wrap<T> {
+    inner: T,
+    tag: u32,
+}
+
+pub enum Either<L, R> {
+    Left(L),
+    Right(R),
+}
+
+macro_rules! nest {
+    ($ty:ty) => { $ty };
+    ($ty:ty, $head:ident $(, $rest:ident)*) => { nest!($head<$ty> $(, $rest)*) };
+}
+
+type Deep = nest!(u32, Wrap, Wrap, Wrap, Wrap, Wrap, Wrap, Wrap, Wrap, Wrap, Wrap, Wrap, Wrap);
+
+#[inline(never)]
+fn visit<T>(value: &Wrap<T>, depth: u32) -> u32 {
+    value.tag.wrapping_add(depth)
+}
+
+#[inline(never)]
+fn choose<L, R>(either: &Either<L, R>, left: u32, right: u32) -> u32 {
+    match either {
+        Either::Left(_) => left,
+        Either::Right(_) => right,
+    }
+}
+
+#[no_mangle]
+#[link_section = "maps"]
+static mut DEEP: Option<Deep> = None;
+
+macro_rules! programs {
+    ($($name:ident = $section:literal, $ty:ty;)*) => {
+        $(
+            #[no_mangle]
+            #[link_section = $section]
+            pub fn $name(ctx: *const $ty) -> u32 {
+                let value = unsafe { &*ctx };
+                let either: Either<$ty, Wrap<$ty>> = Either::Left(unsafe { core::ptr::read(ctx) });
+                visit(value, 1).wrapping_add(choose(&either, 1, 2))
+            }
+        )*
+    };
+}
+
+programs! {
+    generics_0 = "uprobe/generics_0", Wrap<u8>;
+    generics_1 = "uprobe/generics_1", Wrap<Wrap<u16>>;
+    generics_2 = "uprobe/generics_2", Wrap<Wrap<Wrap<u32>>>;
+    generics_3 = "uprobe/generics_3", Wrap<Wrap<Wrap<Wrap<u64>>>>;
+    generics_4 = "uprobe/generics_4", Wrap<Either<Wrap<u8>, Wrap<Either<u16, u32>>>>;
+    generics_5 = "uprobe/generics_5", Wrap<Either<Wrap<Wrap<u8>>, Either<Wrap<u16>, Wrap<u32>>>>;
+    generics_6 = "uprobe/generics_6", Wrap<nest!(u8, Wrap, Wrap, Wrap, Wrap, Wrap, Wrap)>;
+    generics_7 = "uprobe/generics_7", Wrap<Deep>;
+}
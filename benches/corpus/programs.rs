@@ -0,0 +1,53 @@
+// Many exported programs sharing helpers, like a large aya-ebpf crate.
+#![no_std]
+
+#[no_mangle]
+#[link_section = "maps"]
+static mut COUNTERS: [u64; 64] = [0; 64];
+
+#[inline(never)]
+fn checksum(data: &[u8]) -> u32 {
+    let mut sum = 0u32;
+    for (i, byte) in data.iter().enumerate() {
+        sum = sum.rotate_left(5) ^ u32::from(*byte) ^ i as u32;
+    }
+    sum
+}
+
+#[inline(never)]
+fn count(index: usize) {
+    unsafe {
+        let counter = core::ptr::addr_of_mut!(COUNTERS)
+            .cast::<u64>()
+            .add(index % 64);
+        core::ptr::write_volatile(counter, core::ptr::read_volatile(counter).wrapping_add(1));
+    }
+}
+
+macro_rules! programs {
+    ($($name:ident = $section:literal, $index:literal;)*) => {
+        $(
+            #[no_mangle]
+            #[link_section = $section]
+            pub fn $name(ctx: *const u8) -> u32 {
+                let data = unsafe { core::slice::from_raw_parts(ctx, 16 + $index) };
+                count($index);
+                checksum(data).wrapping_mul($index + 1)
+            }
+        )*
+    };
+}
+
+programs! {
+    prog_0 = "xdp/prog_0", 0; prog_1 = "xdp/prog_1", 1; prog_2 = "xdp/prog_2", 2;
+    prog_3 = "xdp/prog_3", 3; prog_4 = "xdp/prog_4", 4; prog_5 = "xdp/prog_5", 5;
+    prog_6 = "xdp/prog_6", 6; prog_7 = "xdp/prog_7", 7; prog_8 = "xdp/prog_8", 8;
+    prog_9 = "xdp/prog_9", 9; prog_10 = "xdp/prog_10", 10; prog_11 = "xdp/prog_11", 11;
+    prog_12 = "xdp/prog_12", 12; prog_13 = "xdp/prog_13", 13; prog_14 = "xdp/prog_14", 14;
+    prog_15 = "xdp/prog_15", 15; prog_16 = "xdp/prog_16", 16; prog_17 = "xdp/prog_17", 17;
+    prog_18 = "xdp/prog_18", 18; prog_19 = "xdp/prog_19", 19; prog_20 = "xdp/prog_20", 20;
+    prog_21 = "xdp/prog_21", 21; prog_22 = "xdp/prog_22", 22; prog_23 = "xdp/prog_23", 23;
+    prog_24 = "xdp/prog_24", 24; prog_25 = "xdp/prog_25", 25; prog_26 = "xdp/prog_26", 26;
+    prog_27 = "xdp/prog_27", 27; prog_28 = "xdp/prog_28", 28; prog_29 = "xdp/prog_29", 29;
+    prog_30 = "xdp/prog_30", 30; prog_31 = "xdp/prog_31", 31;
+}
@@ -0,0 +1,163 @@
+//! Benchmarks of the link pipeline.
+//!
+//! The corpora are inputs generated in `benches/corpus` from the sources there with
+//! `cargo xtask bench-corpus`, which `cargo xtask bench` runs when they're missing. The corpora
+//! whose inputs are missing are skipped. The bitcode is produced by the LLVM of the rustc
+//! generating it, which must be supported by the linker (LLVM 19 to 21) and not be newer than
+//! the LLVM the linker is built against, so regenerate the corpus after switching toolchains.
+//! The corpora are:
+//!
+//! - `programs`: many exported programs sharing helpers.
+//! - `di_generics`: deeply nested generic types, which produce large debug info.
+//! - `archive`: the programs linked against the `core` rlib of the BPF sysroot.
+//!
+//! Besides whole links, the time spent in the main phases of the pipeline is measured through the
+//! linker's time report. Use `cargo xtask bench` to compare the results against a baseline.
+
+#![expect(unused_crate_dependencies, reason = "used in lib/bin/tests")]
+
+use std::{
+    env,
+    path::{Path, PathBuf},
+    time::Duration,
+};
+
+use bpf_linker::{
+    Cpu, Linker, LinkerInput, LinkerOptions, OptLevel, OutputType, Pipeline, TimeReport,
+};
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion};
+
+/// The phases of the time report measured on their own.
+const PHASES: &[&str] = &[
+    "link_modules",
+    "sanitize_debug_info",
+    "run_passes",
+    "codegen",
+];
+
+struct Corpus {
+    name: &'static str,
+    inputs: Vec<PathBuf>,
+    export_symbols: Vec<String>,
+}
+
+/// Returns the path of `benches/corpus/<file_name>`, or None if it hasn't been generated.
+fn corpus_file(root_dir: &Path, file_name: &str) -> Option<PathBuf> {
+    let path = root_dir.join("benches/corpus").join(file_name);
+    if path.is_file() {
+        Some(path)
+    } else {
+        eprintln!(
+            "{} is missing, skipping the corpora using it. Generate them with `cargo xtask bench-corpus`",
+            path.display()
+        );
+        None
+    }
+}
+
+fn corpora() -> Vec<Corpus> {
+    let root_dir = env::var_os("CARGO_MANIFEST_DIR")
+        .expect("could not determine the root directory of the project");
+    let root_dir = Path::new(&root_dir);
+
+    let programs = corpus_file(root_dir, "programs.bc");
+    let di_generics = corpus_file(root_dir, "di_generics.bc");
+    let core = corpus_file(root_dir, "libcore.rlib");
+    let program_symbols = (0..32).map(|i| format!("prog_{i}")).collect::<Vec<_>>();
+
+    [
+        ("programs", vec![programs.clone()], program_symbols.clone()),
+        (
+            "di_generics",
+            vec![di_generics],
+            (0..8).map(|i| format!("generics_{i}")).collect(),
+        ),
+        ("archive", vec![programs, core], program_symbols),
+    ]
+    .into_iter()
+    .filter_map(|(name, inputs, export_symbols)| {
+        Some(Corpus {
+            name,
+            inputs: inputs.into_iter().collect::<Option<_>>()?,
+            export_symbols,
+        })
+    })
+    .collect()
+}
+
+fn link(linker: &Linker, corpus: &Corpus) {
+    let inputs = corpus
+        .inputs
+        .iter()
+        .map(|path| LinkerInput::new_from_file(path));
+    let export_symbols = corpus.export_symbols.iter().map(String::as_str);
+    let output = linker
+        .link_to_buffer(inputs, OutputType::Object, export_symbols)
+        .unwrap_or_else(|err| panic!("failed to link {}: {err}", corpus.name));
+    let _: &[u8] = std::hint::black_box(output.as_slice());
+}
+
+fn bench_link(c: &mut Criterion) {
+    let corpora = corpora();
+    if corpora.is_empty() {
+        return;
+    }
+
+    // LLVM can only be initialized once per process, so all the benchmarks share a linker.
+    let mut linker = Linker::try_new(LinkerOptions {
+        target: None,
+        cpu: Cpu::Generic,
+        cpu_features: Default::default(),
+        optimize: OptLevel::Default,
+        pipeline: Pipeline::Default,
+        unroll_loops: false,
+        unroll_functions: Vec::new(),
+        unroll_budget: None,
+        ignore_inline_never: false,
+        llvm_args: Vec::new(),
+        disable_expand_memcpy_in_order: false,
+        disable_memory_builtins: false,
+        btf: true,
+        prune_btf: false,
+        allow_bpf_trap: false,
+        lazy_load: false,
+        thin_link: false,
+        remarks: None,
+    })
+    .expect("failed to create the linker");
+    linker.set_time_report(true);
+
+    let mut group = c.benchmark_group("link_to_buffer");
+    let _: &mut _ = group.sample_size(20);
+    for corpus in &corpora {
+        let _: &mut _ = group.bench_function(corpus.name, |b| b.iter(|| link(&linker, corpus)));
+    }
+    group.finish();
+
+    let mut group = c.benchmark_group("phases");
+    let _: &mut _ = group.sample_size(20);
+    for corpus in &corpora {
+        for phase in PHASES {
+            let id = BenchmarkId::new(*phase, corpus.name);
+            let _: &mut _ = group.bench_function(id, |b| {
+                b.iter_custom(|iters| {
+                    let _: TimeReport = linker.take_time_report();
+                    for _ in 0..iters {
+                        link(&linker, corpus);
+                    }
+                    linker
+                        .take_time_report()
+                        .phases()
+                        .iter()
+                        .filter(|time| time.name == *phase)
+                        .map(|time| time.duration)
+                        .sum::<Duration>()
+                })
+            });
+        }
+    }
+    group.finish();
+}
+
+criterion_group!(benches, bench_link);
+criterion_main!(benches);
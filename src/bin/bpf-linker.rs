@@ -1,9 +1,14 @@
 #![expect(unused_crate_dependencies, reason = "used in lib")]
 
+#[path = "bpf-linker/server.rs"]
+mod server;
+
 use std::{
+    convert::Infallible,
     env,
-    ffi::CString,
-    fs, io,
+    ffi::{CString, OsString},
+    fs,
+    io::{self, Write as _},
     path::{Component, Path, PathBuf},
     str::FromStr,
 };
@@ -14,7 +19,10 @@ use std::{
     feature = "rust-llvm-21"
 ))]
 use aya_rustc_llvm_proxy as _;
-use bpf_linker::{Cpu, Linker, LinkerInput, LinkerOptions, OptLevel, OutputType};
+use bpf_linker::{
+    Cpu, Linker, LinkerError, LinkerInput, LinkerOptions, OptLevel, OutputType, Pipeline,
+    ProgramReport,
+};
 use clap::{
     builder::{PathBufValueParser, TypedValueParser as _},
     error::ErrorKind,
@@ -22,17 +30,34 @@ use clap::{
 };
 use thiserror::Error;
 use tracing::{info, Level};
-use tracing_subscriber::{fmt::MakeWriter, prelude::*, EnvFilter};
+use tracing_subscriber::{
+    fmt::{writer::BoxMakeWriter, MakeWriter},
+    prelude::*,
+    EnvFilter,
+};
 use tracing_tree::HierarchicalLayer;
 
 #[derive(Debug, Error)]
 enum CliError {
-    #[error("optimization level needs to be between 0-3, s or z (instead was `{0}`)")]
+    #[error("optimization level needs to be between 0-3, s, z or auto (instead was `{0}`)")]
     InvalidOptimization(String),
     #[error("unknown emission type: `{0}` - expected one of: `llvm-bc`, `asm`, `llvm-ir`, `obj`")]
     InvalidOutputType(String),
+    #[error("the linker was created with different options")]
+    IncompatibleLinker,
+    #[error("--split-programs can't write to the standard output")]
+    SplitProgramsToStdout,
+    #[error("--program-report requires --emit=obj")]
+    ProgramReportNeedsObject,
+    #[error("{0} requires a single --emit")]
+    NeedsSingleEmit(&'static str),
+    #[error("only one --emit can write to the standard output")]
+    SeveralEmitsToStdout,
 }
 
+/// The output path meaning the standard output.
+const STDOUT: &str = "-";
+
 #[derive(Copy, Clone, Debug)]
 struct CliOptLevel(OptLevel);
 
@@ -47,25 +72,60 @@ impl FromStr for CliOptLevel {
             "3" => OptLevel::Aggressive,
             "s" => OptLevel::Size,
             "z" => OptLevel::SizeMin,
+            "auto" => OptLevel::Auto,
             _ => return Err(CliError::InvalidOptimization(s.to_string())),
         }))
     }
 }
 
-#[derive(Copy, Clone, Debug)]
-struct CliOutputType(OutputType);
+#[derive(Clone, Debug)]
+struct CliPipeline(Pipeline);
 
-impl FromStr for CliOutputType {
-    type Err = CliError;
+impl FromStr for CliPipeline {
+    type Err = Infallible;
 
     fn from_str(s: &str) -> Result<Self, Self::Err> {
         Ok(Self(match s {
+            "default" => Pipeline::Default,
+            "fast" => Pipeline::Fast,
+            passes => Pipeline::Custom(passes.to_owned()),
+        }))
+    }
+}
+
+/// An output type, optionally with the path to write it to, like `asm=prog.s`.
+#[derive(Clone, Debug)]
+struct CliEmit {
+    output_type: OutputType,
+    path: Option<PathBuf>,
+}
+
+impl FromStr for CliEmit {
+    type Err = CliError;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        let (output_type, path) = match s.split_once('=') {
+            Some((output_type, path)) => (output_type, Some(PathBuf::from(path))),
+            None => (s, None),
+        };
+        let output_type = match output_type {
             "llvm-bc" => OutputType::Bitcode,
             "asm" => OutputType::Assembly,
             "llvm-ir" => OutputType::LlvmAssembly,
             "obj" => OutputType::Object,
-            _ => return Err(CliError::InvalidOutputType(s.to_string())),
-        }))
+            _ => return Err(CliError::InvalidOutputType(output_type.to_string())),
+        };
+        Ok(Self { output_type, path })
+    }
+}
+
+// Returns the usual extension of the files of `output_type`.
+fn output_extension(output_type: OutputType) -> &'static str {
+    match output_type {
+        OutputType::Bitcode => "bc",
+        OutputType::Assembly => "s",
+        OutputType::LlvmAssembly => "ll",
+        OutputType::Object => "o",
     }
 }
 
@@ -100,18 +160,26 @@ struct CommandLine {
     #[clap(long, value_name = "features", default_value = "")]
     cpu_features: CString,
 
-    /// Write output to <output>
-    #[clap(short, long)]
-    output: PathBuf,
+    /// Write output to <output>, or to the standard output if <output> is `-`
+    #[clap(short, long, required_unless_present = "serve")]
+    output: Option<PathBuf>,
 
-    /// Output type. Can be one of `llvm-bc`, `asm`, `llvm-ir`, `obj`
+    /// Output type. Can be one of `llvm-bc`, `asm`, `llvm-ir`, `obj`, optionally followed by
+    /// `=<path>` to write it to <path> instead of <output>. Can be given several times to link
+    /// and optimize once for all the output types, in which case the outputs without a path are
+    /// written to <output> with the extension of their type
     #[clap(long, default_value = "obj")]
-    emit: Vec<CliOutputType>,
+    emit: Vec<CliEmit>,
 
     /// Emit BTF information
     #[clap(long)]
     btf: bool,
 
+    /// Only emit the BTF of the exported programs and of the maps, dropping the debug info of
+    /// the other global variables
+    #[clap(long, requires = "btf")]
+    prune_btf: bool,
+
     /// Permit automatic insertion of __bpf_trap calls.
     /// See: https://github.com/llvm/llvm-project/commit/ab391beb11f733b526b86f9df23734a34657d876
     #[clap(long)]
@@ -121,10 +189,19 @@ struct CommandLine {
     #[clap(short = 'L', number_of_values = 1)]
     _libs: Vec<PathBuf>,
 
-    /// Optimization level. 0-3, s, or z
+    /// Optimization level. 0-3, s, z or auto. 0 is the same as 1 with the default pipeline. auto
+    /// tries 2, 3, s and z, with and without loop unrolling, and keeps the variant generating the
+    /// smallest code the verifier accepts, for each program with --split-programs
     #[clap(short = 'O', default_value = "2")]
     optimize: Vec<CliOptLevel>,
 
+    /// Optimization pipeline. `default` runs the LLVM pipeline for the optimization level.
+    /// `fast` only runs the passes needed to generate code the verifier accepts, which is much
+    /// faster and useful for development builds. Anything else is a pipeline in the syntax of
+    /// `opt -passes`
+    #[clap(long, value_name = "pipeline", default_value = "default")]
+    passes: CliPipeline,
+
     /// Export the symbols specified in the file `path`. The symbols must be separated by new lines
     #[clap(long, value_name = "path")]
     export_symbols: Option<PathBuf>,
@@ -146,6 +223,22 @@ struct CommandLine {
     #[clap(long)]
     unroll_loops: bool,
 
+    /// With --unroll-loops, only unroll the loops of the given functions, like the programs that
+    /// need it, and of the functions they call
+    #[clap(
+        long,
+        value_name = "functions",
+        requires = "unroll_loops",
+        use_value_delimiter = true,
+        action = clap::ArgAction::Append
+    )]
+    unroll_function: Vec<String>,
+
+    /// With --unroll-loops, the size up to which a loop is unrolled, like LLVM's
+    /// -unroll-threshold. Unlimited by default
+    #[clap(long, value_name = "cost", requires = "unroll_loops")]
+    unroll_budget: Option<u32>,
+
     /// Ignore `noinline`/`#[inline(never)]`. Useful when targeting kernels that don't support function calls
     #[clap(long)]
     ignore_inline_never: bool,
@@ -154,6 +247,57 @@ struct CommandLine {
     #[clap(long, value_name = "path")]
     dump_module: Option<PathBuf>,
 
+    /// Cache the linker outputs in the given `path`, and reuse them when linking the same inputs
+    /// with the same options again
+    #[clap(long, value_name = "path")]
+    cache_dir: Option<PathBuf>,
+
+    /// Write the time spent in each phase of the link, and the size of the module and the memory
+    /// usage at each stage, to the given `path`, as JSON
+    #[clap(long, value_name = "path")]
+    time_report: Option<PathBuf>,
+
+    /// Write the number of instructions, the stack usage and the call depth of each program, and
+    /// the inlined functions taking the most instructions, to the given `path`. Requires
+    /// `--emit=obj`
+    #[clap(long, value_name = "path")]
+    program_report: Option<PathBuf>,
+
+    /// Write the program report as JSON instead of text
+    #[clap(long, requires = "program_report")]
+    program_report_json: bool,
+
+    /// Write the optimization remarks, like the functions inlined and the loops unrolled or not,
+    /// and the number of instructions of each function before and after optimization, to the
+    /// given `path`, as JSON
+    #[clap(long, value_name = "path")]
+    remarks_output: Option<PathBuf>,
+
+    /// Only collect the remarks of the passes whose name matches the regular expression `regex`,
+    /// like `inline|loop-unroll|sroa`. Defaults to all the passes. The remarks only hold the
+    /// text LLVM formats them as, without the name of the pass that emitted them
+    #[clap(long, value_name = "regex", requires = "remarks_output")]
+    remarks_filter: Option<CString>,
+
+    /// Only write the remarks and the function sizes of the given programs. Remarks are only
+    /// attributed to programs when they're optimized separately, so this requires
+    /// --split-programs
+    #[clap(
+        long,
+        value_name = "programs",
+        requires = "remarks_output",
+        requires = "split_programs",
+        use_value_delimiter = true,
+        action = clap::ArgAction::Append
+    )]
+    remarks_program: Vec<String>,
+
+    /// Enable the LLVM pass timers. LLVM prints the time spent in each optimization pass to
+    /// stderr when the process exits; the timers aren't part of --time-report. The timers are
+    /// global to the process, so links with this flag are never sent to a linker server
+    #[clap(long)]
+    time_passes: bool,
+
     /// Extra command line arguments to pass to LLVM
     #[clap(long, value_name = "args", use_value_delimiter = true, action = clap::ArgAction::Append)]
     llvm_args: Vec<CString>,
@@ -168,8 +312,38 @@ struct CommandLine {
     #[clap(long)]
     disable_memory_builtins: bool,
 
+    /// Only materialize and link the code reachable from the exported symbols. Speeds up linking
+    /// large dependencies of which only a small fraction is used
+    #[clap(long)]
+    lazy_load: bool,
+
+    /// Optimize and generate the code of each exported program separately and in parallel. The
+    /// output is a directory, where one file named after each program is written
+    #[clap(long)]
+    split_programs: bool,
+
+    /// With --split-programs, link each program from the inputs it needs, importing only the
+    /// definitions it uses, instead of linking all the inputs together first
+    #[clap(long, requires = "split_programs")]
+    thin_link: bool,
+
+    /// Link all the inputs, including every member of the archives, into a prelinked bundle
+    /// instead of a program. A bundle of the dependencies shared by several crates can be given
+    /// as an input to their links, which then only load the parts of it they need
+    #[clap(
+        long,
+        conflicts_with_all = ["split_programs", "program_report", "remarks_output"]
+    )]
+    bundle: bool,
+
+    /// Serve link requests on the Unix socket at `path` instead of linking, keeping LLVM
+    /// initialized and the parsed inputs in memory between links. bpf-linker sends its links to
+    /// the server when the `BPF_LINKER_SERVER` environment variable is set to the socket path
+    #[clap(long, value_name = "path", conflicts_with_all = ["output", "inputs"])]
+    serve: Option<PathBuf>,
+
     /// Input files. Can be object files or static libraries
-    #[clap(required = true)]
+    #[clap(required_unless_present = "serve")]
     inputs: Vec<PathBuf>,
 
     /// Comma separated list of symbols to export. See also `--export-symbols`
@@ -197,13 +371,126 @@ where
         .with_writer(writer)
 }
 fn main() -> anyhow::Result<()> {
-    let args = env::args().map(|arg| {
+    let Some(mut command_line) = parse_command_line(env::args_os())? else {
+        return Ok(());
+    };
+
+    let output_to_stdout = command_line.output.as_deref() == Some(Path::new(STDOUT));
+
+    // Configure tracing.
+    let _guard = {
+        let filter = EnvFilter::from_default_env();
+        let filter = match command_line.log_level {
+            None => filter,
+            Some(log_level) => filter.add_directive(log_level.into()),
+        };
+        let subscriber_registry = tracing_subscriber::registry().with(filter);
+        match command_line.log_file.take() {
+            Some((parent, file_name)) => {
+                let file_appender = tracing_appender::rolling::never(parent, file_name);
+                let (non_blocking, guard) = tracing_appender::non_blocking(file_appender);
+                // Don't mix the logs with the output.
+                let console = if output_to_stdout {
+                    BoxMakeWriter::new(io::stderr)
+                } else {
+                    BoxMakeWriter::new(io::stdout)
+                };
+                let subscriber = subscriber_registry
+                    .with(tracing_layer(console))
+                    .with(tracing_layer(non_blocking));
+                tracing::subscriber::set_global_default(subscriber)?;
+                Some(guard)
+            }
+            None => {
+                let subscriber = subscriber_registry.with(tracing_layer(io::stderr));
+                tracing::subscriber::set_global_default(subscriber)?;
+                None
+            }
+        }
+    };
+
+    info!("command line: {:?}", env::args_os().collect::<Vec<_>>());
+
+    if let Some(socket) = command_line.serve.take() {
+        return server::serve(&socket);
+    }
+    // The server can't write to our standard output, nor print its pass timers to our stderr.
+    if let Some(socket) =
+        env::var_os(server::SERVER_ENV).filter(|_| !output_to_stdout && !command_line.time_passes)
+    {
+        if let Some(result) = server::link_remotely(Path::new(&socket)) {
+            return result;
+        }
+    }
+
+    link(command_line, &mut None, false)
+}
+
+/// Parses the command line in `args`. Returns None if help or version information was requested
+/// and printed instead.
+fn parse_command_line<I>(args: I) -> anyhow::Result<Option<CommandLine>>
+where
+    I: IntoIterator<Item = OsString>,
+{
+    let args = args.into_iter().map(|arg| {
         if arg == "-flavor" {
-            "--flavor".to_string()
+            "--flavor".into()
         } else {
             arg
         }
     });
+    match Parser::try_parse_from(args) {
+        Ok(command_line) => Ok(Some(command_line)),
+        Err(err) => match err.kind() {
+            ErrorKind::DisplayHelp | ErrorKind::DisplayVersion => {
+                print!("{err}");
+                Ok(None)
+            }
+            _ => Err(err.into()),
+        },
+    }
+}
+
+/// The configuration a [`Linker`] is created with.
+#[derive(PartialEq)]
+struct LinkerConfig {
+    options: LinkerOptions,
+    dump_module: Option<PathBuf>,
+    cache_dir: Option<PathBuf>,
+}
+
+impl LinkerConfig {
+    fn create_linker(&self, module_cache: bool) -> Result<Linker, LinkerError> {
+        let Self {
+            options,
+            dump_module,
+            cache_dir,
+        } = self;
+
+        let mut linker = Linker::try_new(options.clone())?;
+
+        if let Some(path) = dump_module {
+            linker.set_dump_module_path(path);
+        }
+        if let Some(path) = cache_dir {
+            linker.set_cache_dir(path);
+        }
+        linker.set_module_cache(module_cache);
+
+        Ok(linker)
+    }
+}
+
+/// Links as instructed by `command_line`.
+///
+/// The linker in `linker` is used if there is one, otherwise a new linker is created and stored
+/// there. LLVM can only be configured once per process, so it's an error for `linker` to hold a
+/// linker created with a different configuration.
+fn link(
+    command_line: CommandLine,
+    linker: &mut Option<(LinkerConfig, Linker)>,
+    module_cache: bool,
+) -> anyhow::Result<()> {
     let CommandLine {
         target,
         cpu,
@@ -211,64 +498,45 @@ fn main() -> anyhow::Result<()> {
         output,
         emit,
         btf,
+        prune_btf,
         allow_bpf_trap,
         optimize,
+        passes: CliPipeline(pipeline),
         export_symbols,
-        log_file,
-        log_level,
+        log_file: _,
+        log_level: _,
         unroll_loops,
+        unroll_function,
+        unroll_budget,
         ignore_inline_never,
         dump_module,
-        llvm_args,
+        cache_dir,
+        time_report,
+        program_report,
+        program_report_json,
+        remarks_output,
+        remarks_filter,
+        remarks_program,
+        time_passes,
+        mut llvm_args,
         disable_expand_memcpy_in_order,
         disable_memory_builtins,
+        lazy_load,
+        split_programs,
+        thin_link,
+        bundle,
+        serve: _,
         inputs,
         export,
         fatal_errors,
         _debug,
         _libs,
-    } = match Parser::try_parse_from(args) {
-        Ok(command_line) => command_line,
-        Err(err) => match err.kind() {
-            ErrorKind::DisplayHelp | ErrorKind::DisplayVersion => {
-                print!("{err}");
-                return Ok(());
-            }
-            _ => return Err(err.into()),
-        },
-    };
+    } = command_line;
 
-    // Configure tracing.
-    let _guard = {
-        let filter = EnvFilter::from_default_env();
-        let filter = match log_level {
-            None => filter,
-            Some(log_level) => filter.add_directive(log_level.into()),
-        };
-        let subscriber_registry = tracing_subscriber::registry().with(filter);
-        match log_file {
-            Some((parent, file_name)) => {
-                let file_appender = tracing_appender::rolling::never(parent, file_name);
-                let (non_blocking, guard) = tracing_appender::non_blocking(file_appender);
-                let subscriber = subscriber_registry
-                    .with(tracing_layer(io::stdout))
-                    .with(tracing_layer(non_blocking));
-                tracing::subscriber::set_global_default(subscriber)?;
-                Some(guard)
-            }
-            None => {
-                let subscriber = subscriber_registry.with(tracing_layer(io::stderr));
-                tracing::subscriber::set_global_default(subscriber)?;
-                None
-            }
-        }
+    let Some(output) = output else {
+        return Err(anyhow::anyhow!("no output path given"));
     };
 
-    info!(
-        "command line: {:?}",
-        env::args().collect::<Vec<_>>().join(" ")
-    );
-
     let export_symbols = export_symbols.map(fs::read_to_string).transpose()?;
 
     let export_symbols = export_symbols
@@ -277,38 +545,192 @@ fn main() -> anyhow::Result<()> {
         .flat_map(str::lines)
         .chain(export.iter().map(String::as_str));
 
-    let output_type = match *emit.as_slice() {
+    let several_emits = emit.len() > 1;
+    let emits = emit
+        .into_iter()
+        .map(|CliEmit { output_type, path }| {
+            let path = path.unwrap_or_else(|| {
+                if several_emits && output != Path::new(STDOUT) {
+                    output.with_extension(output_extension(output_type))
+                } else {
+                    output.clone()
+                }
+            });
+            (output_type, path)
+        })
+        .collect::<Vec<_>>();
+    let (output_type, output) = match emits.as_slice() {
         [] => unreachable!("emit has a default value"),
-        [CliOutputType(output_type), ..] => output_type,
+        [(output_type, output), ..] => (*output_type, output.clone()),
     };
+    if emits
+        .iter()
+        .filter(|(_, path)| path.as_path() == Path::new(STDOUT))
+        .count()
+        > 1
+    {
+        return Err(CliError::SeveralEmitsToStdout.into());
+    }
     let optimize = match *optimize.as_slice() {
         [] => unreachable!("emit has a default value"),
         [.., CliOptLevel(optimize)] => optimize,
     };
 
-    let mut linker = Linker::new(LinkerOptions {
-        target,
-        cpu,
-        cpu_features,
-        optimize,
-        unroll_loops,
-        ignore_inline_never,
-        llvm_args,
-        disable_expand_memcpy_in_order,
-        disable_memory_builtins,
-        btf,
-        allow_bpf_trap,
-    });
-
-    if let Some(path) = dump_module {
-        linker.set_dump_module_path(path);
+    if time_passes {
+        llvm_args.push(c"-time-passes".to_owned());
+    }
+    let remarks = remarks_output
+        .is_some()
+        .then(|| remarks_filter.unwrap_or_else(|| c".*".to_owned()));
+
+    let config = LinkerConfig {
+        options: LinkerOptions {
+            target,
+            cpu,
+            cpu_features,
+            optimize,
+            pipeline,
+            unroll_loops,
+            unroll_functions: unroll_function,
+            unroll_budget,
+            ignore_inline_never,
+            llvm_args,
+            disable_expand_memcpy_in_order,
+            disable_memory_builtins,
+            btf,
+            prune_btf,
+            allow_bpf_trap,
+            lazy_load,
+            thin_link,
+            remarks,
+        },
+        dump_module,
+        cache_dir,
+    };
+    if linker
+        .as_ref()
+        .is_some_and(|(linker_config, _)| *linker_config != config)
+    {
+        return Err(CliError::IncompatibleLinker.into());
     }
+    let (_, linker) = match linker {
+        Some(linker) => linker,
+        linker @ None => {
+            let created = config.create_linker(module_cache)?;
+            linker.insert((config, created))
+        }
+    };
+    linker.clear_errors();
+    linker.set_time_report(time_report.is_some());
 
     let inputs = inputs
         .iter()
         .map(|p| LinkerInput::new_from_file(p.as_path()));
 
-    linker.link_to_file(inputs, &output, output_type, export_symbols)?;
+    if program_report.is_some()
+        && !emits
+            .iter()
+            .any(|(output_type, _)| matches!(output_type, OutputType::Object))
+    {
+        return Err(CliError::ProgramReportNeedsObject.into());
+    }
+    // The objects the program report is built from.
+    let mut objects = Vec::new();
+
+    if bundle {
+        let bundle = linker.link_bundle(inputs)?;
+        if output == Path::new(STDOUT) {
+            io::stdout().lock().write_all(&bundle)?;
+        } else {
+            fs::write(&output, &bundle)?;
+        }
+    } else if split_programs {
+        if several_emits {
+            return Err(CliError::NeedsSingleEmit("--split-programs").into());
+        }
+        if output == Path::new(STDOUT) {
+            return Err(CliError::SplitProgramsToStdout.into());
+        }
+        let extension = output_extension(output_type);
+        fs::create_dir_all(&output)?;
+        for (name, program) in
+            linker.link_programs_to_buffers(inputs, output_type, export_symbols)?
+        {
+            let path = output.join(format!("{name}.{extension}"));
+            info!("writing {:?} to {:?}", output_type, path);
+            fs::write(path, &program)?;
+            if program_report.is_some() {
+                objects.push(program);
+            }
+        }
+    } else if several_emits {
+        let output_types = emits
+            .iter()
+            .map(|(output_type, _)| *output_type)
+            .collect::<Vec<_>>();
+        let outputs = linker.link_to_buffers(inputs, &output_types, export_symbols)?;
+        for ((output_type, path), output) in emits.iter().zip(outputs) {
+            info!("writing {:?} to {:?}", output_type, path);
+            if path.as_path() == Path::new(STDOUT) {
+                io::stdout().lock().write_all(&output)?;
+            } else {
+                fs::write(path, &output)?;
+            }
+            if program_report.is_some()
+                && objects.is_empty()
+                && matches!(output_type, OutputType::Object)
+            {
+                objects.push(output);
+            }
+        }
+    } else if program_report.is_some() {
+        let object = linker.link_to_buffer(inputs, output_type, export_symbols)?;
+        if output == Path::new(STDOUT) {
+            io::stdout().lock().write_all(&object)?;
+        } else {
+            fs::write(&output, &object)?;
+        }
+        objects.push(object);
+    } else if output == Path::new(STDOUT) {
+        linker.link_to_writer(
+            inputs,
+            output_type,
+            export_symbols,
+            &mut io::stdout().lock(),
+        )?;
+    } else {
+        linker.link_to_file(inputs, &output, output_type, export_symbols)?;
+    }
+
+    if let Some(path) = program_report {
+        let report = ProgramReport::from_objects(objects.iter().map(|object| &**object))?;
+        let report = if program_report_json {
+            let mut report = report.to_json();
+            report.push('\n');
+            report
+        } else {
+            report.to_string()
+        };
+        fs::write(path, report)?;
+    }
+
+    if let Some(path) = time_report {
+        let mut report = linker.take_time_report().to_json();
+        report.push('\n');
+        fs::write(path, report)?;
+    }
+
+    if let Some(path) = remarks_output {
+        let mut report = linker.take_remarks();
+        if !remarks_program.is_empty() {
+            report.retain_programs(|program| {
+                program.is_some_and(|program| remarks_program.iter().any(|name| name == program))
+            });
+        }
+        let mut report = report.to_json();
+        report.push('\n');
+        fs::write(path, report)?;
+    }
 
     if fatal_errors && linker.has_errors() {
         return Err(anyhow::anyhow!(
@@ -388,4 +810,46 @@ mod test {
             [PathBuf::from("symbols.o"), PathBuf::from("rcgu.o")]
         );
     }
+
+    #[test]
+    fn test_emit_args() {
+        let args = [
+            "bpf-linker",
+            "-o",
+            "/tmp/bin.o",
+            "--emit=obj",
+            "--emit",
+            "asm=/tmp/prog.s",
+            "symbols.o",
+        ];
+        let CommandLine { emit, .. } = Parser::parse_from(args);
+        let emit = emit
+            .into_iter()
+            .map(|CliEmit { output_type, path }| (output_extension(output_type), path))
+            .collect::<Vec<_>>();
+        assert_eq!(
+            emit,
+            [("o", None), ("s", Some(PathBuf::from("/tmp/prog.s")))]
+        );
+    }
+
+    #[test]
+    fn test_serve_args() {
+        let args = [
+            "bpf-linker",
+            "--serve",
+            "/tmp/bpf-linker.sock",
+            "--log-level",
+            "info",
+        ];
+        let CommandLine {
+            serve,
+            output,
+            inputs,
+            ..
+        } = Parser::parse_from(args);
+        assert_eq!(serve, Some(PathBuf::from("/tmp/bpf-linker.sock")));
+        assert_eq!(output, None);
+        assert!(inputs.is_empty());
+    }
 }
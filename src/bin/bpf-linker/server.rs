@@ -0,0 +1,182 @@
+//! A persistent linker server and its client.
+//!
+//! Every link pays for initializing LLVM and for parsing the same dependencies, typically `core`
+//! and `aya-ebpf`, which dominates short incremental links. A server started with `--serve` keeps
+//! a single [`Linker`] and the modules it parsed between links, and serves link requests over a
+//! Unix socket. When `BPF_LINKER_SERVER` is set, `bpf-linker` sends its command line to the server
+//! instead of linking, which lets rustc keep invoking it as its linker as usual.
+//!
+//! A request is made of two frames: the working directory of the client and its command line,
+//! with the arguments separated by NUL bytes. The response is a status byte followed by a frame
+//! holding the error message, if any. Frames are prefixed by their length as a little endian
+//! `u32`, and are at most [`MAX_FRAME_LEN`] long.
+//!
+//! The socket is only accessible to the user running the server, since the server links with
+//! its permissions whatever it's sent.
+
+use std::{
+    env,
+    ffi::OsString,
+    fs,
+    io::{self, Read, Write},
+    os::unix::{
+        ffi::{OsStrExt as _, OsStringExt as _},
+        net::{UnixListener, UnixStream},
+    },
+    path::{Path, PathBuf},
+};
+
+use bpf_linker::Linker;
+use tracing::{info, warn};
+
+use crate::{link, parse_command_line, CliError, LinkerConfig};
+
+/// The environment variable holding the path of the socket of the server to link with.
+pub(crate) const SERVER_ENV: &str = "BPF_LINKER_SERVER";
+
+/// The link succeeded.
+const STATUS_OK: u8 = 0;
+/// The link failed.
+const STATUS_FAILED: u8 = 1;
+/// The server can't serve the link, the client should link by itself.
+const STATUS_REJECTED: u8 = 2;
+
+/// The maximum length of a frame, well above the longest command lines.
+const MAX_FRAME_LEN: usize = 16 << 20;
+
+/// Serves link requests on the Unix socket at `socket`, until the process is killed.
+///
+/// Requests are served one at a time, by a linker created for the configuration of the first
+/// request. LLVM can only be configured once per process, so requests with a different
+/// configuration are rejected, and linked by the client instead.
+pub(crate) fn serve(socket: &Path) -> anyhow::Result<()> {
+    if UnixStream::connect(socket).is_ok() {
+        return Err(anyhow::anyhow!(
+            "a linker server is already listening on {:?}",
+            socket
+        ));
+    }
+    // Remove the socket left behind by a server that is no longer running.
+    match fs::remove_file(socket) {
+        Ok(()) => {}
+        Err(err) if err.kind() == io::ErrorKind::NotFound => {}
+        Err(err) => return Err(err.into()),
+    }
+
+    // The socket is created with the permissions left by the umask, so it's narrowed while
+    // binding rather than after, for the socket to never be accessible to other users.
+    let umask = unsafe { libc::umask(0o177) };
+    let listener = UnixListener::bind(socket);
+    let _: libc::mode_t = unsafe { libc::umask(umask) };
+    let listener = listener?;
+    info!("serving link requests on {:?}", socket);
+
+    let mut linker = None;
+    for stream in listener.incoming() {
+        let res = stream.and_then(|stream| serve_request(stream, &mut linker));
+        if let Err(err) = res {
+            warn!("failed to serve link request: {}", err);
+        }
+    }
+
+    Ok(())
+}
+
+fn serve_request(
+    mut stream: UnixStream,
+    linker: &mut Option<(LinkerConfig, Linker)>,
+) -> io::Result<()> {
+    let cwd = PathBuf::from(OsString::from_vec(read_frame(&mut stream)?));
+    let args = read_frame(&mut stream)?;
+    let args = args
+        .split(|&byte| byte == 0)
+        .map(|arg| OsString::from_vec(arg.to_vec()))
+        .collect::<Vec<_>>();
+    info!("link request in {:?}: {:?}", cwd, args);
+
+    // Relative paths in the command line are relative to the client's working directory.
+    env::set_current_dir(&cwd)?;
+
+    let res = parse_command_line(args).and_then(|command_line| match command_line {
+        Some(command_line) => link(command_line, linker, true),
+        None => Ok(()),
+    });
+    let (status, message) = match res {
+        Ok(()) => (STATUS_OK, String::new()),
+        Err(err) => match err.downcast_ref::<CliError>() {
+            Some(CliError::IncompatibleLinker) => (STATUS_REJECTED, err.to_string()),
+            _ => (STATUS_FAILED, format!("{err:?}")),
+        },
+    };
+
+    stream.write_all(&[status])?;
+    write_frame(&mut stream, message.as_bytes())
+}
+
+/// Sends the command line of the current process to the server listening on `socket`.
+///
+/// Returns the result of the link, or None if the link has to be done locally because the server
+/// can't be reached or can't serve it.
+pub(crate) fn link_remotely(socket: &Path) -> Option<anyhow::Result<()>> {
+    match request(socket) {
+        Ok((STATUS_OK, _)) => Some(Ok(())),
+        Ok((STATUS_FAILED, message)) => Some(Err(anyhow::anyhow!("{}", message))),
+        Ok((_, message)) => {
+            info!(
+                "the linker server rejected the link, linking locally: {}",
+                message
+            );
+            None
+        }
+        Err(err) => {
+            info!(
+                "failed to link with the server on {:?}, linking locally: {}",
+                socket, err
+            );
+            None
+        }
+    }
+}
+
+fn request(socket: &Path) -> io::Result<(u8, String)> {
+    let mut stream = UnixStream::connect(socket)?;
+
+    let cwd = env::current_dir()?;
+    let args = env::args_os()
+        .map(OsString::into_vec)
+        .collect::<Vec<_>>()
+        .join(&0);
+    write_frame(&mut stream, cwd.as_os_str().as_bytes())?;
+    write_frame(&mut stream, &args)?;
+
+    let mut status = [0];
+    stream.read_exact(&mut status)?;
+    let [status] = status;
+    let message = read_frame(&mut stream)?;
+
+    Ok((status, String::from_utf8_lossy(&message).into_owned()))
+}
+
+fn read_frame(reader: &mut impl Read) -> io::Result<Vec<u8>> {
+    let mut len = [0; 4];
+    reader.read_exact(&mut len)?;
+    let len = u32::from_le_bytes(len) as usize;
+    if len > MAX_FRAME_LEN {
+        return Err(io::Error::new(
+            io::ErrorKind::InvalidData,
+            format!("frame of {len} bytes is larger than {MAX_FRAME_LEN} bytes"),
+        ));
+    }
+    let mut frame = vec![0; len];
+    reader.read_exact(&mut frame)?;
+    Ok(frame)
+}
+
+fn write_frame(writer: &mut impl Write, frame: &[u8]) -> io::Result<()> {
+    let len = u32::try_from(frame.len())
+        .ok()
+        .filter(|_| frame.len() <= MAX_FRAME_LEN)
+        .ok_or_else(|| io::Error::new(io::ErrorKind::InvalidInput, "frame too large"))?;
+    writer.write_all(&len.to_le_bytes())?;
+    writer.write_all(frame)
+}
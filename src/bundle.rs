@@ -0,0 +1,81 @@
+use std::collections::HashSet;
+
+/// The magic number bundles start with. The last byte is the version of the format.
+pub(crate) const MAGIC: &[u8; 8] = b"BPFBNDL\x01";
+
+/// A prelinked bundle read from a linker input: a set of dependencies linked once into a single
+/// bitcode module, along with the index of the symbols it defines.
+///
+/// Both the symbols and the bitcode borrow the input.
+pub(crate) struct Bundle<'d> {
+    /// The symbols the bitcode defines, except the local ones.
+    pub(crate) symbols: HashSet<&'d [u8]>,
+    pub(crate) bitcode: &'d [u8],
+}
+
+impl<'d> Bundle<'d> {
+    pub(crate) fn parse(data: &'d [u8]) -> Result<Self, String> {
+        let mut data = data
+            .strip_prefix(MAGIC.as_slice())
+            .ok_or_else(|| "not a bundle".to_owned())?;
+        let count = read_u32(&mut data)?;
+        let mut symbols = HashSet::new();
+        for _ in 0..count {
+            let len = read_u32(&mut data)? as usize;
+            if data.len() < len {
+                return Err("truncated symbol index".to_owned());
+            }
+            let (symbol, rest) = data.split_at(len);
+            let _: bool = symbols.insert(symbol);
+            data = rest;
+        }
+        Ok(Self {
+            symbols,
+            bitcode: data,
+        })
+    }
+}
+
+/// Writes a bundle of `bitcode`, which defines `symbols`.
+///
+/// A bundle starts with [`MAGIC`], followed by the number of symbols as a little endian `u32`,
+/// then each symbol as its length as a little endian `u32` followed by its name. The bitcode
+/// takes the rest of the file.
+pub(crate) fn write<'a, I>(symbols: I, bitcode: &[u8]) -> Vec<u8>
+where
+    I: ExactSizeIterator<Item = &'a [u8]>,
+{
+    let mut bundle = MAGIC.to_vec();
+    bundle.extend(u32::try_from(symbols.len()).unwrap().to_le_bytes());
+    for symbol in symbols {
+        bundle.extend(u32::try_from(symbol.len()).unwrap().to_le_bytes());
+        bundle.extend(symbol);
+    }
+    bundle.extend(bitcode);
+    bundle
+}
+
+fn read_u32(data: &mut &[u8]) -> Result<u32, String> {
+    let Some((bytes, rest)) = data.split_first_chunk() else {
+        return Err("truncated symbol index".to_owned());
+    };
+    *data = rest;
+    Ok(u32::from_le_bytes(*bytes))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_bundle() {
+        let symbols: [&[u8]; 2] = [b"memcpy", b"core::fmt::write"];
+        let bundle = write(symbols.into_iter(), b"\x42\x43\xC0\xDE");
+        let parsed = Bundle::parse(&bundle).unwrap();
+        assert_eq!(parsed.symbols, HashSet::from(symbols));
+        assert_eq!(parsed.bitcode, b"\x42\x43\xC0\xDE");
+
+        assert!(Bundle::parse(&bundle[..12]).is_err());
+        assert!(Bundle::parse(b"\x42\x43\xC0\xDE").is_err());
+    }
+}
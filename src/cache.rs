@@ -0,0 +1,305 @@
+use std::{
+    borrow::Cow,
+    collections::HashSet,
+    fmt, fs, io,
+    path::{Path, PathBuf},
+    process,
+    sync::atomic::{AtomicUsize, Ordering},
+};
+
+use sha2::{Digest as _, Sha256};
+use tracing::{info, warn};
+
+use crate::{linker, llvm, LinkerOptions, OutputType};
+
+/// A content-addressed cache of link outputs.
+///
+/// Outputs are stored in a flat directory, named after a hash of everything that can affect them:
+/// the contents of the inputs, the linker options, the exported symbols, the output type and the
+/// versions of bpf-linker and LLVM. An output is never modified once stored, so the directory can
+/// be shared by concurrent linker processes, and entries can be deleted at any time to trim it.
+pub(crate) struct LinkCache {
+    dir: PathBuf,
+}
+
+/// The key identifying a link output in a [`LinkCache`].
+pub(crate) struct CacheKey([u8; 32]);
+
+impl fmt::Display for CacheKey {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let Self(hash) = self;
+        hash.iter().try_for_each(|byte| write!(f, "{byte:02x}"))
+    }
+}
+
+impl LinkCache {
+    pub(crate) fn new(dir: PathBuf) -> Self {
+        Self { dir }
+    }
+
+    /// Computes the key of the output obtained by linking `inputs`.
+    pub(crate) fn key(
+        options: &LinkerOptions,
+        inputs: &[&[u8]],
+        export_symbols: &HashSet<Cow<'_, [u8]>>,
+        output_type: OutputType,
+    ) -> CacheKey {
+        Self::hash(b"link", options, inputs, export_symbols, output_type)
+    }
+
+    /// Computes the key of the code of a program exporting `roots`, from the `bitcode` of the
+    /// module left once everything not reachable from them was internalized and removed.
+    ///
+    /// Editing one program of a crate only changes its own key, so the other programs are taken
+    /// from the cache without being optimized and compiled again.
+    pub(crate) fn program_key(
+        options: &LinkerOptions,
+        bitcode: &[u8],
+        roots: &HashSet<Cow<'_, [u8]>>,
+        output_type: OutputType,
+    ) -> CacheKey {
+        Self::hash(b"program", options, &[bitcode], roots, output_type)
+    }
+
+    fn hash(
+        kind: &[u8],
+        options: &LinkerOptions,
+        inputs: &[&[u8]],
+        export_symbols: &HashSet<Cow<'_, [u8]>>,
+        output_type: OutputType,
+    ) -> CacheKey {
+        // Destructure the options so that new fields can't be forgotten here.
+        let LinkerOptions {
+            target,
+            cpu,
+            cpu_features,
+            optimize,
+            pipeline,
+            unroll_loops,
+            unroll_functions,
+            unroll_budget,
+            ignore_inline_never,
+            llvm_args,
+            disable_expand_memcpy_in_order,
+            disable_memory_builtins,
+            btf,
+            prune_btf,
+            allow_bpf_trap,
+            lazy_load,
+            thin_link,
+            // Remarks don't change the output, and the links collecting them bypass the cache.
+            remarks: _,
+        } = options;
+
+        let mut hasher = KeyHasher(Sha256::new());
+        hasher.bytes(env!("CARGO_PKG_VERSION").as_bytes());
+        let (major, minor, patch) = llvm::version();
+        hasher.bytes(format!("{major}.{minor}.{patch}").as_bytes());
+        hasher.bytes(kind);
+
+        hasher.bytes(target.as_ref().map_or(&[][..], |target| target.to_bytes()));
+        hasher.bytes(cpu.to_string().as_bytes());
+        hasher.bytes(cpu_features.to_bytes());
+        hasher.bytes(format!("{optimize:?}").as_bytes());
+        hasher.bytes(format!("{pipeline:?}").as_bytes());
+        hasher.len(unroll_functions.len());
+        for function in unroll_functions {
+            hasher.bytes(function.as_bytes());
+        }
+        hasher.bytes(format!("{unroll_budget:?}").as_bytes());
+        hasher.flags(&[
+            *unroll_loops,
+            *ignore_inline_never,
+            *disable_expand_memcpy_in_order,
+            *disable_memory_builtins,
+            *btf,
+            *prune_btf,
+            *allow_bpf_trap,
+            *lazy_load,
+            *thin_link,
+        ]);
+        let llvm_args = llvm_args
+            .iter()
+            .filter(|arg| !linker::reports_only(arg))
+            .collect::<Vec<_>>();
+        hasher.len(llvm_args.len());
+        for arg in llvm_args {
+            hasher.bytes(arg.to_bytes());
+        }
+
+        let mut export_symbols = export_symbols.iter().collect::<Vec<_>>();
+        export_symbols.sort_unstable();
+        hasher.len(export_symbols.len());
+        for symbol in export_symbols {
+            hasher.bytes(symbol);
+        }
+
+        hasher.bytes(format!("{output_type:?}").as_bytes());
+
+        hasher.len(inputs.len());
+        for input in inputs {
+            hasher.bytes(input);
+        }
+
+        let KeyHasher(hasher) = hasher;
+        CacheKey(hasher.finalize().into())
+    }
+
+    /// Returns the path of the cached output for `key`, if there is one.
+    pub(crate) fn lookup(&self, key: &CacheKey) -> Option<PathBuf> {
+        let path = self.entry_path(key);
+        if path.is_file() {
+            info!("link cache hit {}", key);
+            Some(path)
+        } else {
+            info!("link cache miss {}", key);
+            None
+        }
+    }
+
+    /// Stores a copy of the output file `path` as the output for `key`.
+    ///
+    /// Failing to update the cache doesn't fail the link, so errors are only logged.
+    pub(crate) fn store_file(&self, key: &CacheKey, path: &Path) {
+        self.store(key, |tmp| fs::copy(path, tmp).map(|_: u64| ()));
+    }
+
+    /// Stores `bytes` as the output for `key`.
+    ///
+    /// Failing to update the cache doesn't fail the link, so errors are only logged.
+    pub(crate) fn store_bytes(&self, key: &CacheKey, bytes: &[u8]) {
+        self.store(key, |tmp| fs::write(tmp, bytes));
+    }
+
+    fn store<F>(&self, key: &CacheKey, write: F)
+    where
+        F: FnOnce(&Path) -> io::Result<()>,
+    {
+        // Entries are written to a temporary file first and then renamed, so that concurrent
+        // linkers never see partially written outputs.
+        static TMP_COUNTER: AtomicUsize = AtomicUsize::new(0);
+        let tmp = self.dir.join(format!(
+            "{}.{}.{}.tmp",
+            key,
+            process::id(),
+            TMP_COUNTER.fetch_add(1, Ordering::Relaxed)
+        ));
+        let res = fs::create_dir_all(&self.dir)
+            .and_then(|()| write(&tmp))
+            .and_then(|()| fs::rename(&tmp, self.entry_path(key)));
+        match res {
+            Ok(()) => info!("link cache store {}", key),
+            Err(err) => {
+                warn!(
+                    "failed to store {} in the link cache {:?}: {}",
+                    key, self.dir, err
+                );
+                let _: io::Result<()> = fs::remove_file(&tmp);
+            }
+        }
+    }
+
+    fn entry_path(&self, key: &CacheKey) -> PathBuf {
+        self.dir.join(key.to_string())
+    }
+}
+
+/// Feeds the fields of a cache key to the hash function, prefixing variable length fields with
+/// their length so that distinct keys can't produce the same byte stream.
+struct KeyHasher(Sha256);
+
+impl KeyHasher {
+    fn len(&mut self, len: usize) {
+        self.0.update((len as u64).to_le_bytes());
+    }
+
+    fn bytes(&mut self, bytes: &[u8]) {
+        self.len(bytes.len());
+        self.0.update(bytes);
+    }
+
+    fn flags(&mut self, flags: &[bool]) {
+        self.len(flags.len());
+        self.0
+            .update(flags.iter().map(|&flag| u8::from(flag)).collect::<Vec<_>>());
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::ffi::CString;
+
+    use super::*;
+    use crate::{Cpu, OptLevel, Pipeline};
+
+    fn options() -> LinkerOptions {
+        LinkerOptions {
+            target: None,
+            cpu: Cpu::Generic,
+            cpu_features: CString::default(),
+            optimize: OptLevel::Default,
+            pipeline: Pipeline::Default,
+            unroll_loops: false,
+            unroll_functions: vec![],
+            unroll_budget: None,
+            ignore_inline_never: false,
+            llvm_args: vec![],
+            disable_expand_memcpy_in_order: false,
+            disable_memory_builtins: false,
+            btf: false,
+            prune_btf: false,
+            allow_bpf_trap: false,
+            lazy_load: false,
+            thin_link: false,
+            remarks: None,
+        }
+    }
+
+    fn key(options: &LinkerOptions, inputs: &[&[u8]], export_symbols: &[&str]) -> String {
+        let export_symbols = export_symbols
+            .iter()
+            .map(|symbol| Cow::Borrowed(symbol.as_bytes()))
+            .collect();
+        LinkCache::key(options, inputs, &export_symbols, OutputType::Object).to_string()
+    }
+
+    #[test]
+    fn test_key() {
+        let options = options();
+        let base = key(&options, &[b"foo", b"bar"], &["a", "b"]);
+        assert_eq!(base.len(), 64);
+
+        // The order of the export symbols doesn't matter, the order of the inputs does.
+        assert_eq!(base, key(&options, &[b"foo", b"bar"], &["b", "a"]));
+        assert_ne!(base, key(&options, &[b"bar", b"foo"], &["a", "b"]));
+        // Input boundaries are part of the key.
+        assert_ne!(base, key(&options, &[b"foob", b"ar"], &["a", "b"]));
+        assert_ne!(base, key(&options, &[b"foo", b"bar"], &["a"]));
+
+        let options = LinkerOptions {
+            btf: true,
+            ..options
+        };
+        assert_ne!(base, key(&options, &[b"foo", b"bar"], &["a", "b"]));
+
+        let options = LinkerOptions {
+            pipeline: Pipeline::Fast,
+            ..options
+        };
+        assert_ne!(base, key(&options, &[b"foo", b"bar"], &["a", "b"]));
+    }
+
+    #[test]
+    fn test_program_key() {
+        let options = options();
+        let roots = HashSet::from([Cow::Borrowed(&b"prog"[..])]);
+        let program_key = |bitcode: &[u8]| {
+            LinkCache::program_key(&options, bitcode, &roots, OutputType::Object).to_string()
+        };
+        let base = program_key(b"foo");
+        assert_eq!(base, program_key(b"foo"));
+        assert_ne!(base, program_key(b"bar"));
+        // A program never shares its key with a link of the same bitcode.
+        assert_ne!(base, key(&options, &[b"foo"], &["prog"]));
+    }
+}
@@ -0,0 +1,58 @@
+use std::sync::{
+    atomic::{AtomicBool, Ordering},
+    Arc,
+};
+
+use crate::LinkerError;
+
+/// Cancels the links of a [`crate::Linker`] from another thread, like when a newer build
+/// supersedes the one a link is for.
+///
+/// A linker given a token with [`crate::Linker::set_cancellation_token`] checks it between the
+/// phases of its links, between inputs and between archive members, and fails with
+/// [`LinkerError::Cancelled`] once it's cancelled. LLVM can't be interrupted, so a phase that
+/// has started runs to completion: a link stops within the time of its longest phase, usually
+/// optimization or code generation.
+#[derive(Clone, Debug, Default)]
+pub struct CancellationToken(Arc<AtomicBool>);
+
+impl CancellationToken {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Cancel the link in progress, and the later links of the linkers using this token.
+    pub fn cancel(&self) {
+        self.0.store(true, Ordering::Relaxed)
+    }
+
+    pub fn is_cancelled(&self) -> bool {
+        self.0.load(Ordering::Relaxed)
+    }
+}
+
+/// Fails with [`LinkerError::Cancelled`] if `token` was cancelled.
+pub(crate) fn checkpoint(token: Option<&CancellationToken>) -> Result<(), LinkerError> {
+    match token {
+        Some(token) if token.is_cancelled() => Err(LinkerError::Cancelled),
+        _ => Ok(()),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_checkpoint() {
+        let token = CancellationToken::new();
+        assert!(checkpoint(None).is_ok());
+        assert!(checkpoint(Some(&token)).is_ok());
+
+        token.clone().cancel();
+        assert!(matches!(
+            checkpoint(Some(&token)),
+            Err(LinkerError::Cancelled)
+        ));
+    }
+}
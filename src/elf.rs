@@ -0,0 +1,64 @@
+use std::borrow::Cow;
+
+use object::{
+    elf,
+    read::{
+        elf::{CompressionHeader as _, FileHeader, SectionHeader as _},
+        CompressedFileRange, CompressionFormat,
+    },
+    Endianness, FileKind,
+};
+
+/// The section rustc and clang embed bitcode in.
+const BITCODE_SECTION: &[u8] = b".llvmbc";
+
+/// Returns the contents of the `.llvmbc` sections of the ELF object file in `data`.
+///
+/// Only the file header and the section headers are read, so this is cheap enough to run on every
+/// object of an archive and doesn't need an LLVM context. Sections are borrowed from `data`,
+/// unless they're compressed.
+pub(crate) fn find_embedded_bitcode(data: &[u8]) -> Result<Vec<Cow<'_, [u8]>>, String> {
+    let bitcode = match FileKind::parse(data) {
+        Ok(FileKind::Elf32) => embedded_bitcode::<elf::FileHeader32<Endianness>>(data),
+        Ok(FileKind::Elf64) => embedded_bitcode::<elf::FileHeader64<Endianness>>(data),
+        Ok(kind) => return Err(format!("unexpected {kind:?} file")),
+        Err(err) => Err(err),
+    };
+    bitcode.map_err(|err| err.to_string())
+}
+
+fn embedded_bitcode<Elf>(data: &[u8]) -> object::Result<Vec<Cow<'_, [u8]>>>
+where
+    Elf: FileHeader<Endian = Endianness>,
+{
+    let header = Elf::parse(data)?;
+    let endian = header.endian()?;
+    let sections = header.sections(endian, data)?;
+
+    let mut bitcode = Vec::new();
+    for section in sections.iter() {
+        if sections.section_name(endian, section)? != BITCODE_SECTION {
+            continue;
+        }
+        let contents = match section.compression(endian, data)? {
+            None => Cow::Borrowed(section.data(endian, data)?),
+            Some((compression, offset, compressed_size)) => {
+                let format = match compression.ch_type(endian) {
+                    elf::ELFCOMPRESS_ZLIB => CompressionFormat::Zlib,
+                    elf::ELFCOMPRESS_ZSTD => CompressionFormat::Zstandard,
+                    _ => CompressionFormat::Unknown,
+                };
+                CompressedFileRange {
+                    format,
+                    offset,
+                    compressed_size,
+                    uncompressed_size: compression.ch_size(endian).into(),
+                }
+                .data(data)?
+                .decompress()?
+            }
+        };
+        bitcode.push(contents);
+    }
+    Ok(bitcode)
+}
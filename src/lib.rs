@@ -42,7 +42,19 @@ pub extern crate llvm_sys_20 as llvm_sys;
 #[cfg(feature = "llvm-21")]
 pub extern crate llvm_sys_21 as llvm_sys;
 
+mod bundle;
+mod cache;
+mod cancel;
+mod elf;
 mod linker;
 mod llvm;
+mod mmap;
+mod remarks;
+mod report;
+mod timings;
 
+pub use cancel::CancellationToken;
 pub use linker::*;
+pub use remarks::{FunctionSize, Remark, RemarksReport};
+pub use report::{InlinedFunction, ProgramReport, ProgramStats};
+pub use timings::{ModuleStats, PhaseTime, StageStats, TimeReport};
@@ -1,24 +1,45 @@
 use std::{
     borrow::Cow,
-    collections::HashSet,
+    cell::{Cell, RefCell},
+    collections::{hash_map::Entry, HashMap, HashSet},
     ffi::{CStr, CString, OsStr},
-    fs::File,
-    io::{self, Read, Seek},
+    fs::{self, File},
+    io::{self, Read as _, Write},
+    mem,
+    num::NonZeroUsize,
     ops::Deref,
     os::unix::ffi::OsStrExt as _,
+    panic,
     path::{Path, PathBuf},
     str::{self, FromStr},
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        mpsc::{self, Receiver, SyncSender},
+        Arc, Mutex,
+    },
+    thread::{self, ScopedJoinHandle},
 };
 
-use ar::Archive;
-use llvm_sys::{
-    error_handling::{LLVMEnablePrettyStackTrace, LLVMInstallFatalErrorHandler},
-    target_machine::LLVMCodeGenFileType,
-};
+use llvm_sys::target_machine::LLVMCodeGenFileType;
+use object::read::archive::{ArchiveFile, ArchiveOffset};
+use sha2::{Digest as _, Sha256};
 use thiserror::Error;
 use tracing::{debug, error, info, warn};
 
-use crate::llvm::{self, LLVMContext, LLVMModule, LLVMTargetMachine, MemoryBuffer};
+use crate::{
+    bundle::{self, Bundle},
+    cache::{CacheKey, LinkCache},
+    cancel::{self, CancellationToken},
+    elf,
+    llvm::{
+        self, LLVMContext, LLVMModule, LLVMTargetMachine, LinkedSymbols, MemoryBuffer, ModuleCache,
+        ModuleSummary, SummaryCache,
+    },
+    mmap::Mmap,
+    remarks::{Remarks, RemarksReport},
+    report::ProgramReport,
+    timings::{Phase, Stage, TimeReport, Timings},
+};
 
 /// Linker error
 #[derive(Debug, Error)]
@@ -47,6 +68,10 @@ pub enum LinkerError {
     #[error("failure linking module {1} from {0}")]
     LinkArchiveModuleError(PathBuf, PathBuf),
 
+    /// The archive file or its symbol table is malformed.
+    #[error("invalid archive `{0}`: {1}")]
+    ArchiveError(PathBuf, String),
+
     /// Optimizing the BPF code failed.
     #[error("LLVMRunPasses failed: {0}")]
     OptimizeError(String),
@@ -63,6 +88,10 @@ pub enum LinkerError {
     #[error("LLVMPrintModuleToFile failed: {0}")]
     WriteIRError(String),
 
+    /// Writing the output to a writer failed.
+    #[error("failed to write the output: {0}")]
+    WriteOutputError(io::Error),
+
     /// There was an error extracting the bitcode embedded in an object file.
     #[error("error reading embedded bitcode: {0}")]
     EmbeddedBitcodeError(String),
@@ -71,13 +100,29 @@ pub enum LinkerError {
     #[error("no bitcode section found in {0}")]
     MissingBitcodeSection(PathBuf),
 
+    /// The prelinked bundle is malformed.
+    #[error("invalid bundle `{0}`: {1}")]
+    InvalidBundle(PathBuf, String),
+
     /// LLVM cannot create a module for linking.
     #[error("failed to create module")]
     CreateModuleError,
+
+    /// LLVM was already initialized with different options by another linker.
+    #[error("LLVM was initialized with the command line {0:?}, the options require {1:?}")]
+    IncompatibleLlvmOptions(Vec<CString>, Vec<CString>),
+
+    /// The object file given for a program report is invalid.
+    #[error("invalid BPF object: {0}")]
+    InvalidObject(String),
+
+    /// The link was cancelled through its [`CancellationToken`].
+    #[error("the link was cancelled")]
+    Cancelled,
 }
 
 /// BPF Cpu type
-#[derive(Clone, Copy, Debug)]
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
 pub enum Cpu {
     Generic,
     Probe,
@@ -126,7 +171,7 @@ impl FromStr for Cpu {
 }
 
 /// Optimization level
-#[derive(Clone, Copy, Debug)]
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
 pub enum OptLevel {
     /// No optimizations. Equivalent to -O0.
     No,
@@ -140,6 +185,28 @@ pub enum OptLevel {
     Size,
     /// Aggressively optimize for size. Equivalent to -Oz.
     SizeMin,
+    /// Try -O2, -O3, -Os and -Oz, each with and without loop unrolling, in parallel, and keep
+    /// the variant generating the smallest code within the limits of the verifier.
+    ///
+    /// The variants are scored by the instructions and the stack depth of the exported programs.
+    /// [`Linker::link_programs_to_buffers`] picks a variant for each program, the other link
+    /// methods one for the whole output. Only [`Pipeline::Default`] has variants to explore.
+    Auto,
+}
+
+/// The optimization pipeline run on the linked module.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub enum Pipeline {
+    /// The default LLVM pipeline for the optimization level. [`OptLevel::No`] runs the -O1
+    /// pipeline, as the BPF verifier rejects pretty much all unoptimized code.
+    Default,
+    /// Only the passes needed for the BPF backend and the verifier to accept the code: inlining
+    /// the `always_inline` functions, SROA, instcombine and dead code elimination, on top of the
+    /// internalization of the symbols that aren't exported. Much faster than the default
+    /// pipeline, for development builds.
+    Fast,
+    /// A pipeline in the syntax of `opt -passes`, like `function(sroa,instcombine)`.
+    Custom(String),
 }
 
 pub struct FileInput<'a> {
@@ -151,9 +218,15 @@ pub struct BufferInput<'a> {
     bytes: &'a [u8],
 }
 
+pub struct SharedBufferInput {
+    name: String,
+    bytes: Arc<[u8]>,
+}
+
 pub enum LinkerInput<'a> {
     File(FileInput<'a>),
     Buffer(BufferInput<'a>),
+    SharedBuffer(SharedBufferInput),
 }
 
 impl<'a> LinkerInput<'a> {
@@ -164,33 +237,81 @@ impl<'a> LinkerInput<'a> {
     pub fn new_from_buffer(name: &'a str, bytes: &'a [u8]) -> Self {
         LinkerInput::Buffer(BufferInput { name, bytes })
     }
+
+    /// Creates an input from a buffer owned by the input, so that it doesn't borrow anything.
+    ///
+    /// Like borrowed buffers, the bytes are parsed in place, without being copied. Converting a
+    /// `Vec<u8>` into an `Arc<[u8]>` copies it though, so build the `Arc` directly when possible.
+    pub fn new_from_shared_buffer(name: impl Into<String>, bytes: impl Into<Arc<[u8]>>) -> Self {
+        LinkerInput::SharedBuffer(SharedBufferInput {
+            name: name.into(),
+            bytes: bytes.into(),
+        })
+    }
 }
 
-enum InputReader<'a> {
-    File {
-        path: &'a Path,
-        file: File,
-    },
-    Buffer {
-        name: &'a str,
-        cursor: io::Cursor<&'a [u8]>,
-    },
+/// One of the outputs of [`Linker::link_many_to_buffers`].
+pub struct BatchOutput<'i, 'a> {
+    /// The inputs linked into this output only, after the shared inputs.
+    pub inputs: Vec<LinkerInput<'i>>,
+    /// The symbols exported by this output.
+    pub export_symbols: Vec<&'a str>,
 }
 
-impl Seek for InputReader<'_> {
-    fn seek(&mut self, pos: io::SeekFrom) -> io::Result<u64> {
+/// The contents of an input file.
+enum FileData {
+    /// The file mapped into memory.
+    Mapped(Mmap),
+    /// The file read into memory, for inputs that can't be mapped (e.g. pipes).
+    Read(Vec<u8>),
+}
+
+impl FileData {
+    fn open(path: &Path) -> Result<Self, LinkerError> {
+        let mut file =
+            File::open(path).map_err(|err| LinkerError::IoError(path.to_owned(), err))?;
+        match Mmap::map(&file) {
+            Ok(mmap) => Ok(Self::Mapped(mmap)),
+            Err(err) => {
+                debug!("failed to map {:?}, reading it instead: {}", path, err);
+                let mut data = Vec::new();
+                let _: usize = file
+                    .read_to_end(&mut data)
+                    .map_err(|err| LinkerError::IoError(path.to_owned(), err))?;
+                Ok(Self::Read(data))
+            }
+        }
+    }
+
+    fn as_slice(&self) -> &[u8] {
         match self {
-            InputReader::File { file, .. } => file.seek(pos),
-            InputReader::Buffer { cursor, .. } => cursor.seek(pos),
+            Self::Mapped(mmap) => mmap.as_slice(),
+            Self::Read(data) => data.as_slice(),
         }
     }
 }
 
-impl Read for InputReader<'_> {
-    fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+/// A linker input with its contents available in memory.
+enum InputData<'a> {
+    File { path: &'a Path, data: FileData },
+    Buffer { name: &'a str, bytes: &'a [u8] },
+    SharedBuffer { name: String, bytes: Arc<[u8]> },
+}
+
+impl InputData<'_> {
+    fn path(&self) -> PathBuf {
         match self {
-            InputReader::File { file, .. } => file.read(buf),
-            InputReader::Buffer { cursor, .. } => cursor.read(buf),
+            InputData::File { path, .. } => (*path).into(),
+            InputData::Buffer { name, .. } => PathBuf::from(format!("in_memory::{}", name)),
+            InputData::SharedBuffer { name, .. } => PathBuf::from(format!("in_memory::{}", name)),
+        }
+    }
+
+    fn as_slice(&self) -> &[u8] {
+        match self {
+            InputData::File { data, .. } => data.as_slice(),
+            InputData::Buffer { bytes, .. } => bytes,
+            InputData::SharedBuffer { bytes, .. } => bytes,
         }
     }
 }
@@ -206,6 +327,8 @@ enum InputType {
     MachO,
     /// Archive file. (.a)
     Archive,
+    /// Prelinked bundle, see [`Linker::link_bundle`].
+    Bundle,
 }
 
 impl std::fmt::Display for InputType {
@@ -218,6 +341,7 @@ impl std::fmt::Display for InputType {
                 Self::Elf => "elf",
                 Self::MachO => "Mach-O",
                 Self::Archive => "archive",
+                Self::Bundle => "bundle",
             }
         )
     }
@@ -237,7 +361,7 @@ pub enum OutputType {
 }
 
 /// Options to configure the linker
-#[derive(Debug)]
+#[derive(Clone, Debug, PartialEq, Eq)]
 pub struct LinkerOptions {
     /// The LLVM target to generate code for. If None, the target will be inferred from the input
     /// modules.
@@ -248,8 +372,17 @@ pub struct LinkerOptions {
     pub cpu_features: CString,
     /// Optimization level.
     pub optimize: OptLevel,
+    /// Optimization pipeline.
+    pub pipeline: Pipeline,
     /// Whether to aggressively unroll loops. Useful for older kernels that don't support loops.
     pub unroll_loops: bool,
+    /// With `unroll_loops`, only unroll the loops of these functions, typically exported
+    /// programs, and of the functions they call, instead of all the loops of the module. The
+    /// other loops are unrolled as usual for the optimization level.
+    pub unroll_functions: Vec<String>,
+    /// With `unroll_loops`, the size up to which a loop is unrolled, in LLVM's cost units, like
+    /// `-unroll-threshold`. Unlimited if None.
+    pub unroll_budget: Option<u32>,
     /// Remove `noinline` attributes from functions. Useful for kernels before 5.8 that don't
     /// support function calls.
     pub ignore_inline_never: bool,
@@ -263,29 +396,101 @@ pub struct LinkerOptions {
     pub disable_memory_builtins: bool,
     /// Emit BTF information
     pub btf: bool,
+    /// Only emit the BTF of the exported programs and of the maps, dropping the debug info of the
+    /// other global variables. Has no effect unless `btf` is set.
+    pub prune_btf: bool,
     /// Permit automatic insertion of __bpf_trap calls.
     /// See: https://github.com/llvm/llvm-project/commit/ab391beb11f733b526b86f9df23734a34657d876
     pub allow_bpf_trap: bool,
+    /// Load input modules lazily and only materialize the functions and globals reachable from
+    /// the exported symbols, instead of fully parsing and linking every input.
+    pub lazy_load: bool,
+    /// In [`Linker::link_programs_to_buffers`], link each program from the inputs it needs,
+    /// importing only the definitions it uses, instead of linking all the inputs together first.
+    /// The inputs are summarized once to find what each program imports, and the summaries are
+    /// kept for the next links.
+    pub thin_link: bool,
+    /// Collect the optimization remarks of the passes whose name matches this regular
+    /// expression, like `inline|loop-unroll|sroa`, along with the size of each function before
+    /// and after optimization. The remarks are retrieved with [`Linker::take_remarks`].
+    ///
+    /// The passes are selected through LLVM's `-pass-remarks`, `-pass-remarks-missed` and
+    /// `-pass-remarks-analysis` options, which are global to the process like the other LLVM
+    /// options. LLVM only hands the text of the remarks to the linker, see [`crate::Remark`].
+    pub remarks: Option<CString>,
 }
 
 /// BPF Linker
+///
+/// A linker can be moved to another thread, but not shared between threads. Use a linker per
+/// thread to link in parallel.
 pub struct Linker {
     options: LinkerOptions,
+    // Holds modules parsed in `context`, so it must be dropped first.
+    module_cache: Option<RefCell<ModuleCache>>,
     context: LLVMContext,
     diagnostic_handler: llvm::InstalledDiagnosticHandler<DiagnosticHandler>,
     dump_module: Option<PathBuf>,
+    cache: Option<LinkCache>,
+    timings: Timings,
+    remarks: Remarks,
+    summaries: RefCell<SummaryCache>,
+    cancellation: Option<CancellationToken>,
 }
 
+// SAFETY: the LLVM context and everything created in it, including the cached modules and the
+// diagnostic handler, are only reachable through the linker, so they move to another thread
+// together. LLVM allows using a context from any thread, as long as it's one at a time, which
+// holds since the linker isn't `Sync`.
+unsafe impl Send for Linker {}
+
 impl Linker {
     /// Create a new linker instance with the given options.
+    ///
+    /// # Panics
+    ///
+    /// Panics if an earlier linker configured LLVM differently, since the options couldn't be
+    /// honored, see [`Linker::try_new`].
+    #[deprecated(note = "panics if LLVM was configured differently, use `Linker::try_new` instead")]
     pub fn new(options: LinkerOptions) -> Self {
-        let (context, diagnostic_handler) = llvm_init(&options);
+        Self::try_new(options).unwrap_or_else(|err| panic!("{err}"))
+    }
+
+    /// Create a new linker instance with the given options, failing if LLVM was configured
+    /// differently by an earlier linker.
+    ///
+    /// Some of the options configure LLVM through its command line options, which are global to
+    /// the process: the first linker created sets them, and they stay set for as long as the
+    /// process runs, even after that linker is dropped. Every later linker must use the same.
+    ///
+    /// The options that configure LLVM are [`LinkerOptions::unroll_loops`] and the unrolling
+    /// options after it, [`LinkerOptions::llvm_args`], [`LinkerOptions::disable_expand_memcpy_in_order`],
+    /// [`LinkerOptions::allow_bpf_trap`] and [`LinkerOptions::remarks`]. Linkers for which
+    /// they're the same can be used in parallel, each from its own thread. `-time-passes` in
+    /// [`LinkerOptions::llvm_args`] is the exception: it only enables the pass timers, for the
+    /// whole process, so it's ignored when comparing the options.
+    pub fn try_new(options: LinkerOptions) -> Result<Self, LinkerError> {
+        let (context, diagnostic_handler) = llvm_init(&options)?;
+        Ok(Self::from_context(options, context, diagnostic_handler))
+    }
 
+    fn from_context(
+        options: LinkerOptions,
+        context: LLVMContext,
+        diagnostic_handler: llvm::InstalledDiagnosticHandler<DiagnosticHandler>,
+    ) -> Self {
+        let remarks = Remarks::new(options.remarks.is_some());
         Self {
             options,
+            module_cache: None,
             context,
             diagnostic_handler,
             dump_module: None,
+            cache: None,
+            timings: Timings::new(false),
+            remarks,
+            summaries: RefCell::new(SummaryCache::new()),
+            cancellation: None,
         }
     }
 
@@ -300,13 +505,85 @@ impl Linker {
         self.dump_module = Some(path.as_ref().to_path_buf())
     }
 
+    /// Set the directory where the linker caches its outputs.
+    ///
+    /// Outputs are keyed on the contents of the inputs, the linker options, the exported symbols
+    /// and the LLVM version. When an input set was linked before with the same configuration,
+    /// the cached output is returned and linking, optimization and code generation are skipped.
+    ///
+    /// The directory is created if it does not already exist. It can be shared by concurrent
+    /// linkers. The cache is bypassed when a dump module path is set.
+    pub fn set_cache_dir(&mut self, path: impl AsRef<Path>) {
+        self.cache = Some(LinkCache::new(path.as_ref().to_path_buf()))
+    }
+
+    /// Keep the modules parsed from the inputs in memory, and reuse them whenever the same
+    /// bitcode is linked again by this linker instead of parsing it again.
+    ///
+    /// This is useful for long running linkers, which typically link the same dependencies over
+    /// and over. Modules that haven't been linked in the last few links are evicted. The cache
+    /// is not used in lazy load mode.
+    ///
+    /// The cache is not used either when emitting BTF: the copies of a cached module share its
+    /// uniqued debug info nodes, which are rewritten in place when sanitizing the debug info of
+    /// the linked module. The inputs are parsed for every link then.
+    pub fn set_module_cache(&mut self, enabled: bool) {
+        self.module_cache =
+            (enabled && !self.options.btf).then(|| RefCell::new(ModuleCache::new()));
+    }
+
+    /// Measure the time spent in each phase of the links, like parsing the inputs, linking them,
+    /// optimizing and generating code, and the size of the module and the memory usage after
+    /// linking, after processing the debug information and after optimizing. The timings are
+    /// accumulated until they're retrieved with [`Linker::take_time_report`].
+    ///
+    /// Measuring the size of the module walks all of it, which slows the links down a little.
+    pub fn set_time_report(&mut self, enabled: bool) {
+        self.timings = Timings::new(enabled);
+    }
+
+    /// Check `token` during the links, and fail them with [`LinkerError::Cancelled`] once it's
+    /// cancelled, or stop checking if None. See [`CancellationToken`].
+    ///
+    /// Together with moving the linker to a thread of its own, since it's `Send`, this lets an
+    /// asynchronous build run links without blocking, and abandon those that are superseded.
+    pub fn set_cancellation_token(&mut self, token: Option<CancellationToken>) {
+        self.cancellation = token;
+    }
+
+    /// Returns the time spent in each phase of the links done since the report was last taken,
+    /// and resets the timings. The report is empty unless enabled with
+    /// [`Linker::set_time_report`].
+    pub fn take_time_report(&self) -> TimeReport {
+        self.timings.take()
+    }
+
+    /// Returns the optimization remarks emitted during the links done since the report was last
+    /// taken, and the size of the functions before and after optimization, and resets them. The
+    /// report is empty unless [`LinkerOptions::remarks`] is set.
+    ///
+    /// Remarks are attributed to the program they're about when the programs are optimized
+    /// separately by [`Linker::link_programs_to_buffers`].
+    pub fn take_remarks(&self) -> RemarksReport {
+        let Self {
+            diagnostic_handler,
+            remarks,
+            ..
+        } = self;
+        remarks.record_remarks(
+            None,
+            diagnostic_handler.with_view(DiagnosticHandler::take_remarks),
+        );
+        remarks.take()
+    }
+
     /// Link and generate the output code to file.
     ///
     /// # Example
     ///
     /// ```rust,no_run
     /// # use std::{collections::HashSet, path::Path, borrow::Cow, ffi::CString};
-    /// # use bpf_linker::{Cpu, Linker, LinkerInput, LinkerOptions, OptLevel, OutputType};
+    /// # use bpf_linker::{Cpu, Linker, LinkerInput, LinkerOptions, OptLevel, OutputType, Pipeline};
     /// # fn main() -> Result<(), Box<dyn std::error::Error>> {
     /// let path = Path::new("/path/to/object-or-bitcode");
     /// let bytes: &[u8] = &[]; // An in memory object/bitcode
@@ -315,15 +592,22 @@ impl Linker {
     /// #     cpu: Cpu::Generic,
     /// #     cpu_features: CString::default(),
     /// #     optimize: OptLevel::Default,
+    /// #     pipeline: Pipeline::Default,
     /// #     unroll_loops: false,
+    /// #     unroll_functions: vec![],
+    /// #     unroll_budget: None,
     /// #     ignore_inline_never: false,
     /// #     llvm_args: vec![],
     /// #     disable_expand_memcpy_in_order: false,
     /// #     disable_memory_builtins: false,
     /// #     allow_bpf_trap: false,
     /// #     btf: false,
+    /// #     prune_btf: false,
+    /// #     lazy_load: false,
+    /// #     thin_link: false,
+    /// #     remarks: None,
     /// # };
-    /// # let linker = Linker::new(options);
+    /// # let linker = Linker::try_new(options)?;
     ///
     /// let export_symbols = ["my_sym_1", "my_sym_2"];
     ///
@@ -351,13 +635,35 @@ impl Linker {
         E: IntoIterator<Item = &'a str>,
         P: AsRef<Path>,
     {
-        let (linked_module, target_machine) = self.link(inputs, export_symbols)?;
+        let _timer = self.timings.start(Phase::Total);
+        let output = output.as_ref();
+        let inputs = open_inputs(&self.timings, inputs)?;
+        let export_symbols = export_symbols_set(&self.options, export_symbols);
+
+        let input_data = inputs.iter().map(InputData::as_slice).collect::<Vec<_>>();
+        let cache_key = self.cache_key(&input_data, &export_symbols, output_type);
+        if let Some((cache, key)) = &cache_key {
+            if let Some(cached) = cache.lookup(key) {
+                info!("writing cached {:?} to {:?}", output_type, output);
+                let _: u64 = fs::copy(cached, output)
+                    .map_err(|err| LinkerError::IoError(output.to_owned(), err))?;
+                return Ok(());
+            }
+        }
+
+        let (linked_module, target_machine) = self.link(&inputs, &export_symbols)?;
         codegen_to_file(
+            &self.timings,
             &linked_module,
             &target_machine,
-            output.as_ref(),
+            output,
             output_type,
         )?;
+        if let Some((cache, key)) = &cache_key {
+            if !self.has_errors() {
+                cache.store_file(key, output);
+            }
+        }
         Ok(())
     }
 
@@ -367,7 +673,7 @@ impl Linker {
     ///
     /// ```rust,no_run
     /// # use std::{collections::HashSet, path::Path, borrow::Cow, ffi::CString};
-    /// # use bpf_linker::{Cpu, Linker, LinkerInput, LinkerOptions, OptLevel, OutputType};
+    /// # use bpf_linker::{Cpu, Linker, LinkerInput, LinkerOptions, OptLevel, OutputType, Pipeline};
     /// # fn main() -> Result<(), Box<dyn std::error::Error>> {
     /// let path = Path::new("/path/to/object-or-bitcode");
     /// let bytes: &[u8] = &[]; // An in memory object/bitcode
@@ -376,15 +682,22 @@ impl Linker {
     /// #     cpu: Cpu::Generic,
     /// #     cpu_features: CString::default(),
     /// #     optimize: OptLevel::Default,
+    /// #     pipeline: Pipeline::Default,
     /// #     unroll_loops: false,
+    /// #     unroll_functions: vec![],
+    /// #     unroll_budget: None,
     /// #     ignore_inline_never: false,
     /// #     llvm_args: vec![],
     /// #     disable_expand_memcpy_in_order: false,
     /// #     disable_memory_builtins: false,
     /// #     allow_bpf_trap: false,
     /// #     btf: false,
+    /// #     prune_btf: false,
+    /// #     lazy_load: false,
+    /// #     thin_link: false,
+    /// #     remarks: None,
     /// # };
-    /// # let linker = Linker::new(options);
+    /// # let linker = Linker::try_new(options)?;
     ///
     /// let export_symbols = ["my_sym_1", "my_sym_2"];
     ///
@@ -414,201 +727,1614 @@ impl Linker {
         I: IntoIterator<Item = LinkerInput<'i>>,
         E: IntoIterator<Item = &'a str>,
     {
-        let (linked_module, target_machine) = self.link(inputs, export_symbols)?;
-        codegen_to_buffer(&linked_module, &target_machine, output_type)
+        let _timer = self.timings.start(Phase::Total);
+        let inputs = open_inputs(&self.timings, inputs)?;
+        let export_symbols = export_symbols_set(&self.options, export_symbols);
+
+        let input_data = inputs.iter().map(InputData::as_slice).collect::<Vec<_>>();
+        let cache_key = self.cache_key(&input_data, &export_symbols, output_type);
+        if let Some(output) = cached_output(&cache_key)? {
+            return Ok(output);
+        }
+
+        let (linked_module, target_machine) = self.link(&inputs, &export_symbols)?;
+        let output =
+            codegen_to_buffer(&self.timings, &linked_module, &target_machine, output_type)?;
+        self.store_output(&cache_key, &output);
+        Ok(output)
     }
 
-    /// Link and generate the output code.
-    fn link<'ctx, 'i, 'a, I, E>(
-        &'ctx self,
+    /// Link and write the output code to `writer`.
+    ///
+    /// LLVM can only generate code to files and to its own buffers, so the code is generated to
+    /// a buffer that is written to `writer` and freed right away. The linked module is freed
+    /// before writing, so the output is the only copy of the code held in memory.
+    ///
+    /// # Example
+    ///
+    /// ```rust,no_run
+    /// # use std::{ffi::CString, io, path::Path};
+    /// # use bpf_linker::{Cpu, Linker, LinkerInput, LinkerOptions, OptLevel, OutputType, Pipeline};
+    /// # fn main() -> Result<(), Box<dyn std::error::Error>> {
+    /// # let options = LinkerOptions {
+    /// #     target: None,
+    /// #     cpu: Cpu::Generic,
+    /// #     cpu_features: CString::default(),
+    /// #     optimize: OptLevel::Default,
+    /// #     pipeline: Pipeline::Default,
+    /// #     unroll_loops: false,
+    /// #     unroll_functions: vec![],
+    /// #     unroll_budget: None,
+    /// #     ignore_inline_never: false,
+    /// #     llvm_args: vec![],
+    /// #     disable_expand_memcpy_in_order: false,
+    /// #     disable_memory_builtins: false,
+    /// #     allow_bpf_trap: false,
+    /// #     btf: false,
+    /// #     prune_btf: false,
+    /// #     lazy_load: false,
+    /// #     thin_link: false,
+    /// #     remarks: None,
+    /// # };
+    /// # let linker = Linker::try_new(options)?;
+    /// linker.link_to_writer(
+    ///     [LinkerInput::new_from_file(Path::new("/path/to/object-or-bitcode"))],
+    ///     OutputType::Object,
+    ///     ["my_sym_1", "my_sym_2"],
+    ///     &mut io::stdout().lock(),
+    /// )?;
+    /// # Ok(())
+    /// # }
+    /// ```
+    pub fn link_to_writer<'i, 'a, I, E, W>(
+        &self,
+        inputs: I,
+        output_type: OutputType,
+        export_symbols: E,
+        writer: &mut W,
+    ) -> Result<(), LinkerError>
+    where
+        I: IntoIterator<Item = LinkerInput<'i>>,
+        E: IntoIterator<Item = &'a str>,
+        W: Write + ?Sized,
+    {
+        let _timer = self.timings.start(Phase::Total);
+        let inputs = open_inputs(&self.timings, inputs)?;
+        let export_symbols = export_symbols_set(&self.options, export_symbols);
+
+        let input_data = inputs.iter().map(InputData::as_slice).collect::<Vec<_>>();
+        let cache_key = self.cache_key(&input_data, &export_symbols, output_type);
+        let output = match cached_output(&cache_key)? {
+            Some(output) => output,
+            None => {
+                let (linked_module, target_machine) = self.link(&inputs, &export_symbols)?;
+                let output =
+                    codegen_to_buffer(&self.timings, &linked_module, &target_machine, output_type)?;
+                self.store_output(&cache_key, &output);
+                output
+            }
+        };
+        writer
+            .write_all(output.as_slice())
+            .and_then(|()| writer.flush())
+            .map_err(LinkerError::WriteOutputError)
+    }
+
+    /// Link once, and generate the code of each of `output_types` to an in-memory buffer.
+    ///
+    /// The inputs are linked and optimized only once. Generating machine code changes the module,
+    /// so each assembly or object output but the last is generated on its own thread, in its own
+    /// LLVM context, from a copy of the optimized module, while the last one is generated from
+    /// the module itself. The outputs are the same as with a call to [`Linker::link_to_buffer`]
+    /// for each output type, and are returned in the order of `output_types`.
+    ///
+    /// # Example
+    ///
+    /// ```rust,no_run
+    /// # use std::{ffi::CString, path::Path};
+    /// # use bpf_linker::{Cpu, Linker, LinkerInput, LinkerOptions, OptLevel, OutputType, Pipeline};
+    /// # fn main() -> Result<(), Box<dyn std::error::Error>> {
+    /// # let options = LinkerOptions {
+    /// #     target: None,
+    /// #     cpu: Cpu::Generic,
+    /// #     cpu_features: CString::default(),
+    /// #     optimize: OptLevel::Default,
+    /// #     pipeline: Pipeline::Default,
+    /// #     unroll_loops: false,
+    /// #     unroll_functions: vec![],
+    /// #     unroll_budget: None,
+    /// #     ignore_inline_never: false,
+    /// #     llvm_args: vec![],
+    /// #     disable_expand_memcpy_in_order: false,
+    /// #     disable_memory_builtins: false,
+    /// #     allow_bpf_trap: false,
+    /// #     btf: false,
+    /// #     prune_btf: false,
+    /// #     lazy_load: false,
+    /// #     thin_link: false,
+    /// #     remarks: None,
+    /// # };
+    /// # let linker = Linker::try_new(options)?;
+    /// let outputs = linker.link_to_buffers(
+    ///     [LinkerInput::new_from_file(Path::new("/path/to/object-or-bitcode"))],
+    ///     &[OutputType::Object, OutputType::Assembly],
+    ///     ["my_sym_1", "my_sym_2"],
+    /// )?;
+    /// assert_eq!(outputs.len(), 2);
+    /// # Ok(())
+    /// # }
+    /// ```
+    pub fn link_to_buffers<'i, 'a, I, E>(
+        &self,
         inputs: I,
+        output_types: &[OutputType],
         export_symbols: E,
-    ) -> Result<(LLVMModule<'ctx>, LLVMTargetMachine), LinkerError>
+    ) -> Result<Vec<LinkerOutput>, LinkerError>
     where
         I: IntoIterator<Item = LinkerInput<'i>>,
         E: IntoIterator<Item = &'a str>,
     {
         let Self {
             options,
-            context,
-            dump_module,
+            timings,
+            diagnostic_handler,
+            remarks,
             ..
         } = self;
 
-        let inputs = inputs
-            .into_iter()
-            .map(|value| match value {
-                LinkerInput::File(file_input) => {
-                    let FileInput { path } = file_input;
-
-                    let file = File::open(path)
-                        .map_err(|err| LinkerError::IoError(path.to_owned(), err))?;
-                    Ok(InputReader::File { path, file })
-                }
-                LinkerInput::Buffer(buffer_input) => {
-                    let BufferInput { name, bytes } = buffer_input;
-
-                    Ok(InputReader::Buffer {
-                        name,
-                        cursor: io::Cursor::new(bytes),
-                    })
-                }
+        let _timer = timings.start(Phase::Total);
+        let inputs = open_inputs(timings, inputs)?;
+        let export_symbols = export_symbols_set(options, export_symbols);
+
+        let input_data = inputs.iter().map(InputData::as_slice).collect::<Vec<_>>();
+        let mut results = output_types
+            .iter()
+            .map(|&output_type| {
+                let cache_key = self.cache_key(&input_data, &export_symbols, output_type);
+                let output = cached_output(&cache_key)?;
+                Ok((cache_key, output))
             })
-            .collect::<Result<Vec<_>, _>>()?;
+            .collect::<Result<Vec<_>, LinkerError>>()?;
 
-        let mut module = link_modules(context, inputs)?;
+        if results.iter().all(|(_, output)| output.is_some()) {
+            return Ok(results
+                .into_iter()
+                .filter_map(|(_, output)| output)
+                .collect());
+        }
 
-        let target_machine = create_target_machine(options, &module)?;
+        let (linked_module, target_machine) = self.link(&inputs, &export_symbols)?;
 
-        if let Some(path) = dump_module {
-            std::fs::create_dir_all(path)
-                .map_err(|err| LinkerError::IoError(path.to_owned(), err))?;
+        // Bitcode and IR are written out of the module without changing it.
+        let mut machine_code = Vec::new();
+        for (index, ((cache_key, result), &output_type)) in
+            results.iter_mut().zip(output_types).enumerate()
+        {
+            if result.is_some() {
+                continue;
+            }
+            match output_type {
+                OutputType::Bitcode | OutputType::LlvmAssembly => {
+                    let output =
+                        codegen_to_buffer(timings, &linked_module, &target_machine, output_type)?;
+                    self.store_output(cache_key, &output);
+                    *result = Some(output);
+                }
+                OutputType::Assembly | OutputType::Object => machine_code.push(index),
+            }
         }
-        if let Some(path) = dump_module {
-            // dump IR before optimization
-            let path = path.join("pre-opt.ll");
-            let path = CString::new(path.as_os_str().as_encoded_bytes()).unwrap();
-            module
-                .write_ir_to_path(&path)
-                .map_err(LinkerError::WriteIRError)?;
-        };
-        optimize(
-            options,
-            context,
-            &target_machine,
-            &mut module,
-            export_symbols,
-        )?;
-        if let Some(path) = dump_module {
-            // dump IR before optimization
-            let path = path.join("post-opt.ll");
-            let path = CString::new(path.as_os_str().as_encoded_bytes()).unwrap();
-            module
-                .write_ir_to_path(&path)
-                .map_err(LinkerError::WriteIRError)?;
+        let Some(last) = machine_code.pop() else {
+            return Ok(results
+                .into_iter()
+                .filter_map(|(_, output)| output)
+                .collect());
         };
 
-        Ok((module, target_machine))
-    }
-
-    pub fn has_errors(&self) -> bool {
-        self.diagnostic_handler.with_view(|h| h.has_errors)
-    }
-}
-
-fn link_modules<'ctx, 'i, I>(
-    context: &'ctx LLVMContext,
-    inputs: I,
-) -> Result<LLVMModule<'ctx>, LinkerError>
-where
-    I: IntoIterator<Item = InputReader<'i>>,
-{
-    let mut module = context
-        .create_module(c"linked_module")
-        .ok_or(LinkerError::CreateModuleError)?;
-
-    // buffer used to perform file type detection
-    let mut buf = [0u8; 8];
-    for mut input in inputs {
-        let path = match input {
-            InputReader::File { path, .. } => path.into(),
-            InputReader::Buffer { name, .. } => PathBuf::from(format!("in_memory::{}", name)),
+        // The copies are parsed from the bitcode of the optimized module.
+        let optimized = (!machine_code.is_empty()).then(|| linked_module.write_bitcode_to_memory());
+        let bitcode = optimized.as_ref().map_or(&[][..], MemoryBuffer::as_slice);
+        let cancel = self.cancellation.as_ref();
+        cancel::checkpoint(cancel)?;
+        let codegen_copy = |output_type| {
+            let mut context = LLVMContext::new();
+            let diagnostic_handler =
+                context.set_diagnostic_handler(DiagnosticHandler::new(remarks.enabled()));
+            let output = cancel::checkpoint(cancel)
+                .and_then(|()| {
+                    timings
+                        .time(Phase::ParseBitcode, || context.parse_bitcode(bitcode))
+                        .ok_or(LinkerError::CreateModuleError)
+                })
+                .and_then(|module| {
+                    let target_machine = create_target_machine(options, &module)?;
+                    cancel::checkpoint(cancel)?;
+                    codegen_to_buffer(timings, &module, &target_machine, output_type)
+                });
+            remarks.record_remarks(
+                None,
+                diagnostic_handler.with_view(DiagnosticHandler::take_remarks),
+            );
+            let has_errors = diagnostic_handler.with_view(|h| h.has_errors.get());
+            (output, has_errors)
         };
+        let (copies, output) = thread::scope(|s| {
+            let workers = machine_code
+                .iter()
+                .map(|&index| s.spawn(move || codegen_copy(output_types[index])))
+                .collect::<Vec<_>>();
+            let output =
+                codegen_to_buffer(timings, &linked_module, &target_machine, output_types[last]);
+            let copies = workers
+                .into_iter()
+                .map(|worker| {
+                    let (output, has_errors) = worker
+                        .join()
+                        .unwrap_or_else(|err| panic::resume_unwind(err));
+                    if has_errors {
+                        diagnostic_handler.with_view(|h| h.has_errors.set(true));
+                    }
+                    output
+                })
+                .collect::<Vec<_>>();
+            (copies, output)
+        });
+
+        for (index, output) in machine_code.into_iter().zip(copies).chain([(last, output)]) {
+            let (cache_key, result) = &mut results[index];
+            let output = output?;
+            self.store_output(cache_key, &output);
+            *result = Some(output);
+        }
+        Ok(results
+            .into_iter()
+            .filter_map(|(_, output)| output)
+            .collect())
+    }
 
-        // determine whether the input is bitcode, ELF with embedded bitcode, an archive file
-        // or an invalid file
-        input
-            .read_exact(&mut buf)
-            .map_err(|e| LinkerError::IoError(path.clone(), e))?;
-        input
-            .rewind()
-            .map_err(|e| LinkerError::IoError(path.clone(), e))?;
-        let in_type =
-            detect_input_type(&buf).ok_or_else(|| LinkerError::InvalidInputType(path.clone()))?;
+    /// Link several outputs that share a common set of inputs, and generate their code to
+    /// in-memory buffers.
+    ///
+    /// The `shared` inputs are read and linked only once. The resulting module is then copied
+    /// for each of the `outputs`, the inputs of the output are linked into the copy, and it's
+    /// optimized and compiled for the symbols exported by the output. The result is equivalent to
+    /// calling [`Linker::link_to_buffer`] for every output, with the shared inputs followed by
+    /// the inputs of the output.
+    ///
+    /// When a dump module path is set, the modules of each output are dumped to a subdirectory
+    /// named after the index of the output.
+    ///
+    /// # Example
+    ///
+    /// ```rust,no_run
+    /// # use std::{path::Path, ffi::CString};
+    /// # use bpf_linker::{
+    /// #     BatchOutput, Cpu, Linker, LinkerInput, LinkerOptions, OptLevel, OutputType, Pipeline,
+    /// # };
+    /// # fn main() -> Result<(), Box<dyn std::error::Error>> {
+    /// # let options = LinkerOptions {
+    /// #     target: None,
+    /// #     cpu: Cpu::Generic,
+    /// #     cpu_features: CString::default(),
+    /// #     optimize: OptLevel::Default,
+    /// #     pipeline: Pipeline::Default,
+    /// #     unroll_loops: false,
+    /// #     unroll_functions: vec![],
+    /// #     unroll_budget: None,
+    /// #     ignore_inline_never: false,
+    /// #     llvm_args: vec![],
+    /// #     disable_expand_memcpy_in_order: false,
+    /// #     disable_memory_builtins: false,
+    /// #     allow_bpf_trap: false,
+    /// #     btf: false,
+    /// #     prune_btf: false,
+    /// #     lazy_load: false,
+    /// #     thin_link: false,
+    /// #     remarks: None,
+    /// # };
+    /// # let linker = Linker::try_new(options)?;
+    /// let outputs = linker.link_many_to_buffers(
+    ///     [LinkerInput::new_from_file(Path::new("/path/to/libaya_ebpf.rlib"))],
+    ///     [
+    ///         BatchOutput {
+    ///             inputs: vec![LinkerInput::new_from_file(Path::new("/path/to/prog1.o"))],
+    ///             export_symbols: vec!["prog1"],
+    ///         },
+    ///         BatchOutput {
+    ///             inputs: vec![LinkerInput::new_from_file(Path::new("/path/to/prog2.o"))],
+    ///             export_symbols: vec!["prog2"],
+    ///         },
+    ///     ],
+    ///     OutputType::Object,
+    /// )?;
+    /// assert_eq!(outputs.len(), 2);
+    /// # Ok(())
+    /// # }
+    /// ```
+    pub fn link_many_to_buffers<'i, 'a, I, O>(
+        &self,
+        shared: I,
+        outputs: O,
+        output_type: OutputType,
+    ) -> Result<Vec<LinkerOutput>, LinkerError>
+    where
+        I: IntoIterator<Item = LinkerInput<'i>>,
+        O: IntoIterator<Item = BatchOutput<'i, 'a>>,
+    {
+        let Self {
+            options,
+            context,
+            dump_module,
+            timings,
+            ..
+        } = self;
 
-        match in_type {
-            InputType::Archive => {
-                info!("linking archive {:?}", path);
+        let _timer = timings.start(Phase::Total);
+        let shared = open_inputs(timings, shared)?;
+        let outputs = outputs
+            .into_iter()
+            .map(|output| {
+                let BatchOutput {
+                    inputs,
+                    export_symbols,
+                } = output;
+                let inputs = open_inputs(timings, inputs)?;
+                let export_symbols = export_symbols_set(options, export_symbols);
+                Ok((inputs, export_symbols))
+            })
+            .collect::<Result<Vec<_>, LinkerError>>()?;
+
+        let mut results = outputs
+            .iter()
+            .map(|(inputs, export_symbols)| {
+                let input_data = shared
+                    .iter()
+                    .chain(inputs)
+                    .map(InputData::as_slice)
+                    .collect::<Vec<_>>();
+                let cache_key = self.cache_key(&input_data, export_symbols, output_type);
+                let output = cached_output(&cache_key)?;
+                Ok((cache_key, output))
+            })
+            .collect::<Result<Vec<_>, LinkerError>>()?;
+        if results.iter().all(|(_, output)| output.is_some()) {
+            return Ok(results
+                .into_iter()
+                .filter_map(|(_, output)| output)
+                .collect());
+        }
 
-                // Extract the archive and call link_reader() for each item.
-                let mut archive = Archive::new(input);
-                while let Some(Ok(item)) = archive.next_entry() {
-                    let name = PathBuf::from(OsStr::from_bytes(item.header().identifier()));
-                    info!("linking archive item {:?}", name);
-
-                    match link_reader(context, &mut module, &name, item, None) {
-                        Ok(_) => continue,
-                        Err(LinkerError::InvalidInputType(_)) => {
-                            info!("ignoring archive item {:?}: invalid type", name);
-                            continue;
-                        }
-                        Err(LinkerError::MissingBitcodeSection(_)) => {
-                            warn!("ignoring archive item {:?}: no embedded bitcode", name);
-                            continue;
-                        }
-                        Err(_) => return Err(LinkerError::LinkArchiveModuleError(path, name)),
-                    };
+        let output_dump_dir = |index: usize| {
+            dump_module
+                .as_ref()
+                .map(|path| path.join(index.to_string()))
+        };
+        if options.lazy_load {
+            // Lazy loading only materializes what the exports of each output need, so only the
+            // extraction of the shared bitcode can be shared.
+            let mut shared_sink = CollectSink::default();
+            link_modules(
+                timings,
+                self.cancellation.as_ref(),
+                &shared,
+                &mut shared_sink,
+            )?;
+            for (index, ((inputs, export_symbols), (cache_key, result))) in
+                outputs.iter().zip(&mut results).enumerate()
+            {
+                if result.is_some() {
+                    continue;
                 }
+                // Bitcode that is part of the shared inputs too is linked only once.
+                let mut sink = CollectSink {
+                    bitcodes: Vec::new(),
+                    seen: shared_sink.seen.clone(),
+                };
+                link_modules(timings, self.cancellation.as_ref(), inputs, &mut sink)?;
+                let bitcodes = shared_sink
+                    .bitcodes
+                    .iter()
+                    .chain(&sink.bitcodes)
+                    .collect::<Vec<_>>();
+                let mut module = create_module(context)?;
+                self.link_lazily(&mut module, &bitcodes, export_symbols)?;
+                let (module, target_machine) = finish_link(
+                    options,
+                    context,
+                    timings,
+                    self.cancellation.as_ref(),
+                    (&self.remarks, None),
+                    module,
+                    None,
+                    export_symbols,
+                    output_dump_dir(index).as_deref(),
+                )?;
+                let output = codegen_to_buffer(timings, &module, &target_machine, output_type)?;
+                self.store_output(cache_key, &output);
+                *result = Some(output);
             }
-            ty => {
-                info!("linking file {:?} type {}", path, ty);
-                match link_reader(context, &mut module, &path, input, Some(ty)) {
-                    Ok(_) => {}
-                    Err(LinkerError::InvalidInputType(_)) => {
-                        info!("ignoring file {:?}: invalid type", path);
-                        continue;
-                    }
-                    Err(LinkerError::MissingBitcodeSection(_)) => {
-                        warn!("ignoring file {:?}: no embedded bitcode", path);
-                    }
-                    Err(err) => return Err(err),
+        } else {
+            // Archives in the shared inputs can provide symbols needed by the inputs of any
+            // output, so the members they link are tracked and the search goes on for each output.
+            let roots = outputs
+                .iter()
+                .flat_map(|(_, export_symbols)| export_symbols.iter().cloned())
+                .collect::<HashSet<_>>();
+            let mut shared_module = create_module(context)?;
+            let mut shared_seen = SeenBitcode::default();
+            let mut shared_archives = Vec::new();
+            self.link_eagerly(
+                &mut shared_module,
+                &shared,
+                &mut shared_seen,
+                &mut shared_archives,
+                &roots,
+            )?;
+            // Each output starts from a copy of the shared module. LLVMCloneModule would share
+            // the uniqued debug info nodes of the shared module with the copies, and sanitizing
+            // the debug info of one output rewrites them in place. So the copies are parsed from
+            // bitcode instead, once the shared module is gone, and one at a time.
+            let shared_bitcode = shared_module.write_bitcode_to_memory();
+            drop(shared_module);
+            for (index, ((inputs, export_symbols), (cache_key, result))) in
+                outputs.iter().zip(&mut results).enumerate()
+            {
+                if result.is_some() {
+                    continue;
                 }
+                let mut module = timings
+                    .time(Phase::ParseBitcode, || {
+                        context.parse_bitcode(shared_bitcode.as_slice())
+                    })
+                    .ok_or(LinkerError::CreateModuleError)?;
+                let mut seen = shared_seen.clone();
+                let mut archives = shared_archives.clone();
+                self.link_eagerly(
+                    &mut module,
+                    inputs,
+                    &mut seen,
+                    &mut archives,
+                    export_symbols,
+                )?;
+                let (module, target_machine) = finish_link(
+                    options,
+                    context,
+                    timings,
+                    self.cancellation.as_ref(),
+                    (&self.remarks, None),
+                    module,
+                    None,
+                    export_symbols,
+                    output_dump_dir(index).as_deref(),
+                )?;
+                let output = codegen_to_buffer(timings, &module, &target_machine, output_type)?;
+                self.store_output(cache_key, &output);
+                *result = Some(output);
             }
         }
-    }
-
-    Ok(module)
-}
 
-// link in a `Read`-er, which can be a file or an archive item
-fn link_reader<'ctx>(
-    context: &'ctx LLVMContext,
-    module: &mut LLVMModule<'ctx>,
-    path: &Path,
-    mut reader: impl Read,
-    in_type: Option<InputType>,
-) -> Result<(), LinkerError> {
-    let mut data = Vec::new();
-    let _: usize = reader
-        .read_to_end(&mut data)
-        .map_err(|e| LinkerError::IoError(path.to_owned(), e))?;
-    // in_type is unknown when we're linking an item from an archive file
-    let in_type = in_type
-        .or_else(|| detect_input_type(&data))
-        .ok_or_else(|| LinkerError::InvalidInputType(path.to_owned()))?;
+        Ok(results
+            .into_iter()
+            .filter_map(|(_, output)| output)
+            .collect())
+    }
 
-    let bitcode = match in_type {
-        InputType::Bitcode => data,
-        InputType::Elf => match llvm::find_embedded_bitcode(context, &data) {
-            Ok(Some(bitcode)) => bitcode,
-            Ok(None) => return Err(LinkerError::MissingBitcodeSection(path.to_owned())),
-            Err(e) => return Err(LinkerError::EmbeddedBitcodeError(e)),
-        },
-        // we need to handle this here since archive files could contain
-        // mach-o files, eg somecrate.rlib containing lib.rmeta which is
-        // mach-o on macos
-        InputType::MachO => return Err(LinkerError::InvalidInputType(path.to_owned())),
-        // this can't really happen
-        InputType::Archive => panic!("nested archives not supported duh"),
-    };
+    /// Link, then optimize and generate the code of every exported program separately, in
+    /// parallel.
+    ///
+    /// Programs are the exported functions placed in an explicit section, like the functions
+    /// annotated with `#[link_section]` or `SEC()`. Each program is optimized and compiled on
+    /// its own thread, in its own LLVM context, and only keeps the code reachable from it. The
+    /// other exported symbols, such as maps and the license, are kept in all the programs.
+    ///
+    /// With [`LinkerOptions::thin_link`], the inputs aren't linked together first: each program
+    /// is linked from the inputs it needs, importing only the definitions it uses, on its own
+    /// thread too.
+    ///
+    /// With a link cache, the code of each program is cached on its own, keyed by the IR reachable
+    /// from it. Relinking after changing one program only optimizes and compiles that program
+    /// again, the others are read from the cache.
+    ///
+    /// Returns the name of each program along with its code. When a dump module path is set, the
+    /// modules of each program are dumped to a subdirectory named after the program.
+    pub fn link_programs_to_buffers<'i, 'a, I, E>(
+        &self,
+        inputs: I,
+        output_type: OutputType,
+        export_symbols: E,
+    ) -> Result<Vec<(String, LinkerOutput)>, LinkerError>
+    where
+        I: IntoIterator<Item = LinkerInput<'i>>,
+        E: IntoIterator<Item = &'a str>,
+    {
+        let Self {
+            options,
+            dump_module,
+            diagnostic_handler,
+            timings,
+            remarks,
+            cancellation,
+            cache,
+            ..
+        } = self;
+        let cancel = cancellation.as_ref();
+        // Like for whole links, the module dumps and the remarks are only produced by actually
+        // optimizing the programs.
+        let cache = cache
+            .as_ref()
+            .filter(|_| dump_module.is_none() && !remarks.enabled());
+
+        let _timer = timings.start(Phase::Total);
+        let inputs = open_inputs(timings, inputs)?;
+        let export_symbols = export_symbols_set(options, export_symbols);
+
+        let mut sink = CollectSink::default();
+        let (linked, summaries);
+        let (programs, modules) = if options.thin_link {
+            link_modules(timings, cancel, &inputs, &mut sink)?;
+            summaries = timings.time(Phase::SummarizeInputs, || self.summarize(&sink.bitcodes))?;
+            let mut programs = Vec::new();
+            for summary in &summaries {
+                for program in &summary.programs {
+                    if export_symbols.contains(program.as_slice()) && !programs.contains(program) {
+                        programs.push(program.clone());
+                    }
+                }
+            }
+            // The first module defining a symbol provides it, like with a traditional linker.
+            let mut providers = HashMap::new();
+            for (index, summary) in summaries.iter().enumerate() {
+                for name in &summary.defined {
+                    let _: &mut usize = providers.entry(name.as_slice()).or_insert(index);
+                }
+            }
+            let modules = ProgramModules::Thin {
+                bitcodes: &sink.bitcodes,
+                summaries: &summaries,
+                providers,
+            };
+            (programs, modules)
+        } else {
+            let module = self.link_unoptimized(&inputs, &export_symbols)?;
+            let programs = llvm::exported_programs(&module, &export_symbols);
+            // The partitions are created in their own contexts by parsing the linked module.
+            linked = module.write_bitcode_to_memory();
+            (programs, ProgramModules::Linked(linked.as_slice()))
+        };
+        info!("optimizing {} programs in parallel", programs.len());
+        let roots = program_roots(&programs, &export_symbols);
+
+        let workers = thread::available_parallelism()
+            .map_or(1, NonZeroUsize::get)
+            .min(programs.len())
+            .max(1);
+        let next = AtomicUsize::new(0);
+        let worker = || {
+            let mut context = LLVMContext::new();
+            let diagnostic_handler =
+                context.set_diagnostic_handler(DiagnosticHandler::new(remarks.enabled()));
+            let mut outputs = Vec::new();
+            loop {
+                let index = next.fetch_add(1, Ordering::Relaxed);
+                let (Some(program), Some(roots)) = (programs.get(index), roots.get(index)) else {
+                    break;
+                };
+                let dump_module = dump_module
+                    .as_ref()
+                    .map(|path| path.join(OsStr::from_bytes(program)));
+                let output = modules
+                    .load(&context, timings, roots)
+                    .and_then(|mut module| {
+                        let (cache_key, prepared) = match cache {
+                            Some(cache) => {
+                                let (key, target_machine) = program_cache_key(
+                                    options,
+                                    &context,
+                                    timings,
+                                    &mut module,
+                                    roots,
+                                    output_type,
+                                )?;
+                                (Some((cache, key)), Some(target_machine))
+                            }
+                            None => (None, None),
+                        };
+                        if let Some(output) = cached_output(&cache_key)? {
+                            return Ok(output);
+                        }
+                        let (module, target_machine) = finish_link(
+                            options,
+                            &context,
+                            timings,
+                            cancel,
+                            (remarks, Some(program.as_slice())),
+                            module,
+                            prepared,
+                            roots,
+                            dump_module.as_deref(),
+                        )?;
+                        let output =
+                            codegen_to_buffer(timings, &module, &target_machine, output_type)?;
+                        if let Some((cache, key)) = &cache_key {
+                            if !diagnostic_handler.with_view(|h| h.has_errors.get()) {
+                                cache.store_bytes(key, output.as_slice());
+                            }
+                        }
+                        Ok(output)
+                    });
+                remarks.record_remarks(
+                    Some(program.as_slice()),
+                    diagnostic_handler.with_view(DiagnosticHandler::take_remarks),
+                );
+                outputs.push((index, output));
+            }
+            let has_errors = diagnostic_handler.with_view(|h| h.has_errors.get());
+            (outputs, has_errors)
+        };
+
+        let mut outputs = thread::scope(|s| {
+            let workers = (0..workers).map(|_| s.spawn(worker)).collect::<Vec<_>>();
+            let mut outputs = Vec::with_capacity(programs.len());
+            for worker in workers {
+                let (worker_outputs, has_errors) = worker
+                    .join()
+                    .unwrap_or_else(|err| panic::resume_unwind(err));
+                if has_errors {
+                    diagnostic_handler.with_view(|h| h.has_errors.set(true));
+                }
+                outputs.extend(worker_outputs);
+            }
+            outputs
+        });
+        outputs.sort_unstable_by_key(|(index, _)| *index);
+
+        outputs
+            .into_iter()
+            .map(|(index, output)| {
+                let name = String::from_utf8_lossy(&programs[index]).into_owned();
+                Ok((name, output?))
+            })
+            .collect()
+    }
+
+    /// Link all of `inputs`, including every member of the archives among them, into a prelinked
+    /// bundle.
+    ///
+    /// A bundle holds dependencies shared by many programs, like `core`, `compiler_builtins` and
+    /// `aya-ebpf`, so that they're extracted and linked only once. It's then given to the later
+    /// links as an input like any other, and they only materialize the parts of it they need:
+    /// its bitcode is loaded lazily after the other inputs, and not loaded at all when its symbol
+    /// index has none of the symbols that are still undefined.
+    ///
+    /// Nothing is internalized or optimized, and the debug information is kept as is, since that
+    /// depends on what the later links export.
+    pub fn link_bundle<'i, I>(&self, inputs: I) -> Result<Vec<u8>, LinkerError>
+    where
+        I: IntoIterator<Item = LinkerInput<'i>>,
+    {
+        let Self {
+            context, timings, ..
+        } = self;
+
+        let _timer = timings.start(Phase::Total);
+        let inputs = open_inputs(timings, inputs)?;
+        // The sink doesn't know which symbols are needed, so all the archive members are linked.
+        let mut sink = CollectSink::default();
+        let cancel = self.cancellation.as_ref();
+        link_modules(timings, cancel, &inputs, &mut sink)?;
+
+        let mut module = create_module(context)?;
+        for (path, _, bitcode) in &sink.bitcodes {
+            cancel::checkpoint(cancel)?;
+            let parsed = timings
+                .time(Phase::ParseBitcode, || context.parse_bitcode(bitcode))
+                .ok_or_else(|| LinkerError::LinkModuleError(path.clone()))?;
+            if !timings.time(Phase::LinkModules, || module.link(parsed)) {
+                return Err(LinkerError::LinkModuleError(path.clone()));
+            }
+        }
+
+        cancel::checkpoint(cancel)?;
+        let _timer = timings.start(Phase::Codegen);
+        let bitcode = module.write_bitcode_to_memory();
+        let summary = ModuleSummary::new(context, bitcode.as_slice())
+            .ok_or(LinkerError::CreateModuleError)?;
+        let mut symbols = summary
+            .defined
+            .iter()
+            .map(Vec::as_slice)
+            .collect::<Vec<_>>();
+        symbols.sort_unstable();
+        Ok(bundle::write(symbols.into_iter(), bitcode.as_slice()))
+    }
+
+    // Returns the summaries of the modules in `bitcodes`, reusing the summaries of the modules
+    // summarized by the previous links.
+    fn summarize(
+        &self,
+        bitcodes: &[(PathBuf, [u8; 32], Cow<'_, [u8]>)],
+    ) -> Result<Vec<Arc<ModuleSummary>>, LinkerError> {
+        let mut summaries = self.summaries.borrow_mut();
+        let summarized = bitcodes
+            .iter()
+            .map(|(path, digest, bitcode)| {
+                summaries
+                    .summary(*digest, bitcode)
+                    .ok_or_else(|| LinkerError::LinkModuleError(path.clone()))
+            })
+            .collect();
+        summaries.finish_link();
+        summarized
+    }
+
+    /// Returns the link cache and the key of the output of linking inputs with the contents in
+    /// `input_data`, unless caching is disabled.
+    fn cache_key(
+        &self,
+        input_data: &[&[u8]],
+        export_symbols: &HashSet<Cow<'_, [u8]>>,
+        output_type: OutputType,
+    ) -> Option<(&LinkCache, CacheKey)> {
+        let Self {
+            options,
+            cache,
+            dump_module,
+            ..
+        } = self;
+        // The module dumps and the remarks are only produced by actually linking.
+        if dump_module.is_some() || self.remarks.enabled() {
+            return None;
+        }
+        let cache = cache.as_ref()?;
+        let key = LinkCache::key(options, input_data, export_symbols, output_type);
+        Some((cache, key))
+    }
+
+    /// Stores `output` in the link cache, unless LLVM reported errors.
+    fn store_output(&self, cache_key: &Option<(&LinkCache, CacheKey)>, output: &LinkerOutput) {
+        if let Some((cache, key)) = cache_key {
+            if !self.has_errors() {
+                cache.store_bytes(key, output.as_slice());
+            }
+        }
+    }
+
+    /// Link and generate the output code.
+    fn link<'ctx>(
+        &'ctx self,
+        inputs: &[InputData<'_>],
+        export_symbols: &HashSet<Cow<'_, [u8]>>,
+    ) -> Result<(LLVMModule<'ctx>, LLVMTargetMachine), LinkerError> {
+        let Self {
+            options,
+            context,
+            dump_module,
+            timings,
+            ..
+        } = self;
+
+        let module = self.link_unoptimized(inputs, export_symbols)?;
+        finish_link(
+            options,
+            context,
+            timings,
+            self.cancellation.as_ref(),
+            (&self.remarks, None),
+            module,
+            None,
+            export_symbols,
+            dump_module.as_deref(),
+        )
+    }
+
+    // Link `inputs` into a new module, without optimizing it.
+    fn link_unoptimized<'ctx>(
+        &'ctx self,
+        inputs: &[InputData<'_>],
+        export_symbols: &HashSet<Cow<'_, [u8]>>,
+    ) -> Result<LLVMModule<'ctx>, LinkerError> {
+        let Self {
+            options,
+            context,
+            timings,
+            ..
+        } = self;
+
+        let mut module = create_module(context)?;
+        if options.lazy_load {
+            let mut sink = CollectSink::default();
+            link_modules(timings, self.cancellation.as_ref(), inputs, &mut sink)?;
+            let bitcodes = sink.bitcodes.iter().collect::<Vec<_>>();
+            self.link_lazily(&mut module, &bitcodes, export_symbols)?;
+        } else {
+            self.link_eagerly(
+                &mut module,
+                inputs,
+                &mut SeenBitcode::default(),
+                &mut Vec::new(),
+                export_symbols,
+            )?;
+        }
+
+        Ok(module)
+    }
+
+    // Link `inputs` into `module` as they are read, skipping the bitcode in `seen`. The archives
+    // found in `inputs` are added to `archives`, and all the archives in `archives` are searched
+    // for undefined symbols.
+    fn link_eagerly<'ctx, 'd>(
+        &'ctx self,
+        module: &mut LLVMModule<'ctx>,
+        inputs: &'d [InputData<'_>],
+        seen: &mut SeenBitcode,
+        archives: &mut Vec<InputArchive<'d>>,
+        export_symbols: &HashSet<Cow<'_, [u8]>>,
+    ) -> Result<(), LinkerError> {
+        let Self {
+            module_cache,
+            context,
+            timings,
+            ..
+        } = self;
+
+        let mut module_cache = module_cache.as_ref().map(RefCell::borrow_mut);
+        let symbols = LinkedSymbols::new(module, export_symbols);
+        let mut sink = ModuleSink {
+            context,
+            timings,
+            module,
+            module_cache: module_cache.as_deref_mut(),
+            export_symbols,
+            symbols,
+            seen,
+            bundles: Vec::new(),
+        };
+        let cancel = self.cancellation.as_ref();
+        let linked = link_inputs(timings, cancel, inputs, &mut sink, archives).and_then(|()| {
+            // The definitions pulled from the bundles can need members of the archives and the
+            // other way around, so both are searched again until neither provides anything.
+            loop {
+                link_archives(timings, cancel, archives, &mut sink)?;
+                if !sink.link_bundles()? {
+                    break Ok(());
+                }
+            }
+        });
+        if let Some(module_cache) = module_cache.as_deref_mut() {
+            module_cache.finish_link();
+        }
+        linked
+    }
+
+    // Link the previously extracted `bitcodes` into `module`, materializing only what's
+    // reachable from `export_symbols`.
+    fn link_lazily<'ctx>(
+        &'ctx self,
+        module: &mut LLVMModule<'ctx>,
+        bitcodes: &[&(PathBuf, [u8; 32], Cow<'_, [u8]>)],
+        export_symbols: &HashSet<Cow<'_, [u8]>>,
+    ) -> Result<(), LinkerError> {
+        let buffers = bitcodes
+            .iter()
+            .map(|(_, _, bitcode)| bitcode.as_ref())
+            .collect::<Vec<_>>();
+        self.timings
+            .time(Phase::LinkModules, || {
+                llvm::link_bitcode_buffers_lazily(&self.context, module, &buffers, export_symbols)
+            })
+            .map_err(|index| LinkerError::LinkModuleError(bitcodes[index].0.clone()))
+    }
+
+    pub fn has_errors(&self) -> bool {
+        self.diagnostic_handler.with_view(|h| h.has_errors.get())
+    }
+
+    /// Forget the errors reported by LLVM so far, so that [`Linker::has_errors`] only reports the
+    /// errors of the next links.
+    pub fn clear_errors(&self) {
+        self.diagnostic_handler
+            .with_view(|h| h.has_errors.set(false))
+    }
+}
+
+/// Where [`Linker::link_programs_to_buffers`] gets the module of each program from.
+enum ProgramModules<'a, 'd> {
+    /// The bitcode of the module linked from all the inputs, which each program parses.
+    Linked(&'a [u8]),
+    /// The bitcode of the inputs, their summaries, and the index of the input providing each
+    /// symbol.
+    Thin {
+        bitcodes: &'a [(PathBuf, [u8; 32], Cow<'d, [u8]>)],
+        summaries: &'a [Arc<ModuleSummary>],
+        providers: HashMap<&'a [u8], usize>,
+    },
+}
+
+impl ProgramModules<'_, '_> {
+    // Creates the module of a program keeping `roots` in `context`.
+    fn load<'ctx>(
+        &self,
+        context: &'ctx LLVMContext,
+        timings: &Timings,
+        roots: &HashSet<Cow<'_, [u8]>>,
+    ) -> Result<LLVMModule<'ctx>, LinkerError> {
+        match self {
+            Self::Linked(bitcode) => timings
+                .time(Phase::ParseBitcode, || context.parse_bitcode(bitcode))
+                .ok_or(LinkerError::CreateModuleError),
+            Self::Thin {
+                bitcodes,
+                summaries,
+                providers,
+            } => {
+                let imports = thin_imports(summaries, providers, roots);
+                let buffers = imports
+                    .iter()
+                    .map(|&import| bitcodes[import].2.as_ref())
+                    .collect::<Vec<_>>();
+                let mut module = create_module(context)?;
+                timings
+                    .time(Phase::LinkModules, || {
+                        llvm::link_bitcode_buffers_lazily(context, &mut module, &buffers, roots)
+                    })
+                    .map_err(|i| LinkerError::LinkModuleError(bitcodes[imports[i]].0.clone()))?;
+                Ok(module)
+            }
+        }
+    }
+}
+
+// Returns the symbols to keep in each program: all the exports but the other programs.
+fn program_roots<'a>(
+    programs: &[Vec<u8>],
+    export_symbols: &HashSet<Cow<'a, [u8]>>,
+) -> Vec<HashSet<Cow<'a, [u8]>>> {
+    programs
+        .iter()
+        .map(|program| {
+            export_symbols
+                .iter()
+                .filter(|name| **name == *program || !programs.iter().any(|other| **name == *other))
+                .cloned()
+                .collect()
+        })
+        .collect()
+}
+
+// Returns the indices, in input order, of the modules a program keeping `roots` imports
+// definitions from: the provider of each root, then the provider of each symbol the modules
+// imported so far need.
+fn thin_imports(
+    summaries: &[Arc<ModuleSummary>],
+    providers: &HashMap<&[u8], usize>,
+    roots: &HashSet<Cow<'_, [u8]>>,
+) -> Vec<usize> {
+    let mut imports = HashSet::new();
+    let mut resolved = HashSet::new();
+    let mut pending = roots.iter().map(AsRef::as_ref).collect::<Vec<&[u8]>>();
+    while let Some(name) = pending.pop() {
+        if !resolved.insert(name) {
+            continue;
+        }
+        let Some(&index) = providers.get(name) else {
+            continue;
+        };
+        if imports.insert(index) {
+            pending.extend(summaries[index].undefined.iter().map(Vec::as_slice));
+        }
+    }
+
+    let mut imports = imports.into_iter().collect::<Vec<_>>();
+    imports.sort_unstable();
+    imports
+}
+
+/// Receives the bitcode extracted from the linker inputs by [`link_modules`].
+trait BitcodeSink<'d> {
+    /// Links `bitcode`, extracted from `path`. Returns whether linking succeeded.
+    fn link(&mut self, path: &Path, bitcode: Cow<'d, [u8]>) -> bool;
+
+    /// Links the prelinked `bundle` read from `path`. Like the other bitcode by default.
+    fn link_bundle(&mut self, path: &Path, bundle: Bundle<'d>) -> bool {
+        self.link(path, Cow::Borrowed(bundle.bitcode))
+    }
+
+    /// Returns the symbols that are needed but not defined by what has been linked so far, or
+    /// None if they are not known yet. In the latter case all archive members get linked.
+    fn undefined_symbols(&self) -> Option<&HashSet<Vec<u8>>>;
+}
+
+/// Links bitcode into a module as soon as it's extracted.
+///
+/// Bundles are linked last, lazily, by [`ModuleSink::link_bundles`], so that they only provide
+/// what the rest of the inputs need.
+struct ModuleSink<'m, 'ctx, 'r, 'd> {
+    context: &'ctx LLVMContext,
+    timings: &'m Timings,
+    module: &'m mut LLVMModule<'ctx>,
+    module_cache: Option<&'m mut ModuleCache>,
+    export_symbols: &'m HashSet<Cow<'r, [u8]>>,
+    /// The symbols of `module`, updated as bitcode is linked into it.
+    symbols: LinkedSymbols,
+    seen: &'m mut SeenBitcode,
+    bundles: Vec<(PathBuf, Bundle<'d>)>,
+}
+
+impl ModuleSink<'_, '_, '_, '_> {
+    // Link the definitions of the bundles the module needs, materializing only them and what
+    // they reference. Bundles defining none of the undefined symbols aren't even loaded. The
+    // bundles are kept, since what gets linked later can need more of them. Returns whether any
+    // undefined symbol got defined.
+    fn link_bundles(&mut self) -> Result<bool, LinkerError> {
+        let Self {
+            context,
+            timings,
+            module,
+            export_symbols,
+            symbols,
+            bundles,
+            ..
+        } = self;
+
+        let undefined = symbols.undefined();
+        let (paths, buffers): (Vec<_>, Vec<_>) = bundles
+            .iter()
+            .filter(|(path, bundle)| {
+                let needed = undefined
+                    .iter()
+                    .any(|name| bundle.symbols.contains(name.as_slice()));
+                if !needed {
+                    info!("skipping bundle {:?}: none of its symbols are needed", path);
+                }
+                needed
+            })
+            .map(|(path, bundle)| (path.as_path(), bundle.bitcode))
+            .unzip();
+        if buffers.is_empty() {
+            return Ok(false);
+        }
+        // The symbols the module already defines must not be linked again, so only the undefined
+        // ones are kept as they are.
+        let roots: HashSet<Cow<'_, [u8]>> = undefined
+            .iter()
+            .map(|name| Cow::Borrowed(name.as_slice()))
+            .collect();
+        timings
+            .time(Phase::LinkModules, || {
+                llvm::link_bitcode_buffers_lazily(*context, module, &buffers, &roots)
+            })
+            .map_err(|index| LinkerError::LinkModuleError(paths[index].to_owned()))?;
+        // What got materialized is only known to the module.
+        let linked = LinkedSymbols::new(module, export_symbols);
+        let defined = roots
+            .iter()
+            .any(|name| !linked.undefined().contains(name.as_ref()));
+        drop(roots);
+        *symbols = linked;
+        Ok(defined)
+    }
+}
+
+impl<'d> BitcodeSink<'d> for ModuleSink<'_, '_, '_, 'd> {
+    fn link(&mut self, path: &Path, bitcode: Cow<'d, [u8]>) -> bool {
+        let Self {
+            context,
+            timings,
+            module,
+            module_cache,
+            symbols,
+            seen,
+            ..
+        } = self;
+        let Some(digest) = seen.insert(path, &bitcode) else {
+            return true;
+        };
+        match module_cache {
+            Some(module_cache) => module_cache
+                .link_bitcode_buffer(*context, timings, module, symbols, digest, &bitcode),
+            None => {
+                let Some(parsed) =
+                    timings.time(Phase::ParseBitcode, || context.parse_bitcode(&bitcode))
+                else {
+                    return false;
+                };
+                symbols.add(parsed.as_mut_ptr());
+                timings.time(Phase::LinkModules, || module.link(parsed))
+            }
+        }
+    }
+
+    fn link_bundle(&mut self, path: &Path, bundle: Bundle<'d>) -> bool {
+        if self.seen.insert(path, bundle.bitcode).is_some() {
+            self.bundles.push((path.to_owned(), bundle));
+        }
+        true
+    }
+
+    fn undefined_symbols(&self) -> Option<&HashSet<Vec<u8>>> {
+        Some(self.symbols.undefined())
+    }
+}
+
+/// Collects the extracted bitcode along with its digest, to link it lazily once all of it is
+/// available.
+#[derive(Default)]
+struct CollectSink<'d> {
+    bitcodes: Vec<(PathBuf, [u8; 32], Cow<'d, [u8]>)>,
+    seen: SeenBitcode,
+}
+
+impl<'d> BitcodeSink<'d> for CollectSink<'d> {
+    fn link(&mut self, path: &Path, bitcode: Cow<'d, [u8]>) -> bool {
+        let Self { bitcodes, seen } = self;
+        if let Some(digest) = seen.insert(path, &bitcode) {
+            bitcodes.push((path.to_owned(), digest, bitcode));
+        }
+        true
+    }
+
+    fn undefined_symbols(&self) -> Option<&HashSet<Vec<u8>>> {
+        None
+    }
+}
+
+/// The digests of the bitcode linked into a module.
+///
+/// The same crates often get passed more than once, embedded in different rlibs or found twice
+/// in the search paths. Since linking a copy of a module only makes LLVM reconcile the duplicate
+/// definitions, exact copies are skipped before being parsed. The digests also key the parsed
+/// modules and the summaries cached across links.
+#[derive(Clone, Default)]
+struct SeenBitcode {
+    digests: HashSet<[u8; 32]>,
+}
+
+impl SeenBitcode {
+    // Returns the digest of `bitcode`, or None if identical bitcode was seen before.
+    fn insert(&mut self, path: &Path, bitcode: &[u8]) -> Option<[u8; 32]> {
+        let digest: [u8; 32] = Sha256::digest(bitcode).into();
+        if self.digests.insert(digest) {
+            Some(digest)
+        } else {
+            info!(
+                "skipping {:?}: identical to bitcode already linked, saved {} bytes",
+                path,
+                bitcode.len()
+            );
+            None
+        }
+    }
+}
+
+// Extract the bitcode of all the inputs and hand it over to `sink`, in input order.
+//
+// Object files and bitcode files are always linked. Like with a traditional static linker, archive
+// members are only linked if they define a symbol that is still undefined. Since a member can
+// be needed by something linked after its archive, archives are searched again at the end until
+// none of them provides any of the undefined symbols.
+fn link_modules<'d, S>(
+    timings: &Timings,
+    cancel: Option<&CancellationToken>,
+    inputs: &'d [InputData<'_>],
+    sink: &mut S,
+) -> Result<(), LinkerError>
+where
+    S: BitcodeSink<'d>,
+{
+    let mut archives = Vec::new();
+    link_inputs(timings, cancel, inputs, sink, &mut archives)?;
+    link_archives(timings, cancel, &mut archives, sink)
+}
+
+// Link `inputs` in order, adding the archives among them to `archives` to search them again
+// later with `link_archives`.
+fn link_inputs<'d, S>(
+    timings: &Timings,
+    cancel: Option<&CancellationToken>,
+    inputs: &'d [InputData<'_>],
+    sink: &mut S,
+    archives: &mut Vec<InputArchive<'d>>,
+) -> Result<(), LinkerError>
+where
+    S: BitcodeSink<'d>,
+{
+    for input in inputs {
+        cancel::checkpoint(cancel)?;
+        let path = input.path();
+        let data = input.as_slice();
+
+        // determine whether the input is bitcode, ELF with embedded bitcode, an archive file
+        // or an invalid file
+        let in_type = timings
+            .time(Phase::DetectInputType, || detect_input_type(data))
+            .ok_or_else(|| LinkerError::InvalidInputType(path.clone()))?;
+
+        match in_type {
+            InputType::Archive => {
+                info!("linking archive {:?}", path);
+                let mut archive =
+                    timings.time(Phase::ReadArchives, || InputArchive::parse(path, data))?;
+                archive.link_initial(timings, cancel, sink)?;
+                archives.push(archive);
+            }
+            InputType::Bundle => {
+                info!("linking bundle {:?}", path);
+                let bundle = timings
+                    .time(Phase::ExtractBitcode, || Bundle::parse(data))
+                    .map_err(|err| LinkerError::InvalidBundle(path.clone(), err))?;
+                if !sink.link_bundle(&path, bundle) {
+                    return Err(LinkerError::LinkModuleError(path));
+                }
+            }
+            ty => {
+                info!("linking file {:?} type {}", path, ty);
+                let bitcode = timings.time(Phase::ExtractBitcode, || {
+                    extract_bitcode(&path, data, Some(ty))
+                });
+                match bitcode {
+                    Ok(bitcode) => {
+                        for bitcode in bitcode {
+                            if !sink.link(&path, bitcode) {
+                                return Err(LinkerError::LinkModuleError(path));
+                            }
+                        }
+                    }
+                    Err(LinkerError::InvalidInputType(_)) => {
+                        info!("ignoring file {:?}: invalid type", path);
+                        continue;
+                    }
+                    Err(LinkerError::MissingBitcodeSection(_)) => {
+                        warn!("ignoring file {:?}: no embedded bitcode", path);
+                    }
+                    Err(err) => return Err(err),
+                }
+            }
+        }
+    }
+
+    Ok(())
+}
+
+// Search `archives` for the symbols that are still undefined, until none of them provides any.
+fn link_archives<'d, S>(
+    timings: &Timings,
+    cancel: Option<&CancellationToken>,
+    archives: &mut [InputArchive<'d>],
+    sink: &mut S,
+) -> Result<(), LinkerError>
+where
+    S: BitcodeSink<'d>,
+{
+    loop {
+        let mut linked = false;
+        for archive in &mut archives {
+            linked |= archive.link_needed(timings, cancel, sink)?;
+        }
+        if !linked {
+            break;
+        }
+    }
+
+    Ok(())
+}
+
+/// An archive given as linker input.
+#[derive(Clone)]
+struct InputArchive<'d> {
+    path: PathBuf,
+    data: &'d [u8],
+    file: ArchiveFile<'d>,
+    /// Maps the symbols listed in the archive symbol table to the offset of the data of the
+    /// member defining them.
+    symbols: HashMap<&'d [u8], u64>,
+    /// Data offsets of the members that have been linked already.
+    linked: HashSet<u64>,
+}
+
+impl<'d> InputArchive<'d> {
+    fn parse(path: PathBuf, data: &'d [u8]) -> Result<Self, LinkerError> {
+        let file = ArchiveFile::parse(data)
+            .map_err(|err| LinkerError::ArchiveError(path.clone(), err.to_string()))?;
+
+        let symbols = Self::parse_symbols(&file).unwrap_or_else(|err| {
+            warn!(
+                "ignoring the symbol table of archive {:?}: {}, linking all its members",
+                path, err
+            );
+            HashMap::new()
+        });
+
+        Ok(Self {
+            path,
+            data,
+            file,
+            symbols,
+            linked: HashSet::new(),
+        })
+    }
+
+    fn parse_symbols(file: &ArchiveFile<'d>) -> object::Result<HashMap<&'d [u8], u64>> {
+        let mut symbols = HashMap::new();
+        let mut members = HashMap::new();
+        let Some(iter) = file.symbols()? else {
+            return Ok(symbols);
+        };
+        for symbol in iter {
+            let symbol = symbol?;
+            let ArchiveOffset(header_offset) = symbol.offset();
+            let data_offset = match members.entry(header_offset) {
+                Entry::Occupied(entry) => *entry.get(),
+                Entry::Vacant(entry) => {
+                    let (data_offset, _) = file.member(symbol.offset())?.file_range();
+                    *entry.insert(data_offset)
+                }
+            };
+            let _: &mut u64 = symbols.entry(symbol.name()).or_insert(data_offset);
+        }
+        Ok(symbols)
+    }
+
+    // Link the members needed so far, plus those that are missing from the symbol table. The
+    // latter are typically bitcode files added by archivers that can't read bitcode symbols, or
+    // non-object files like `lib.rmeta`. All members are linked when there is no symbol table or
+    // it's not known yet which symbols are needed.
+    fn link_initial<S>(
+        &mut self,
+        timings: &Timings,
+        cancel: Option<&CancellationToken>,
+        sink: &mut S,
+    ) -> Result<(), LinkerError>
+    where
+        S: BitcodeSink<'d>,
+    {
+        let undefined = (!self.symbols.is_empty())
+            .then(|| sink.undefined_symbols())
+            .flatten();
+        let needed = undefined.map(|undefined| self.providers(undefined));
+        let indexed = self.symbols.values().copied().collect::<HashSet<_>>();
+        self.link_members(timings, cancel, sink, |offset| {
+            needed
+                .as_ref()
+                .is_none_or(|needed| needed.contains(&offset) || !indexed.contains(&offset))
+        })?;
+        while self.link_needed(timings, cancel, sink)? {}
+        Ok(())
+    }
+
+    // Link the members defining any of the undefined symbols. Returns whether any was linked.
+    fn link_needed<S>(
+        &mut self,
+        timings: &Timings,
+        cancel: Option<&CancellationToken>,
+        sink: &mut S,
+    ) -> Result<bool, LinkerError>
+    where
+        S: BitcodeSink<'d>,
+    {
+        if self.symbols.is_empty() {
+            return Ok(false);
+        }
+        let Some(undefined) = sink.undefined_symbols() else {
+            return Ok(false);
+        };
+        let needed = self.providers(undefined);
+        if needed.is_empty() {
+            return Ok(false);
+        }
+        self.link_members(timings, cancel, sink, |offset| needed.contains(&offset))?;
+        Ok(true)
+    }
 
-    if !llvm::link_bitcode_buffer(context, module, &bitcode) {
-        return Err(LinkerError::LinkModuleError(path.to_owned()));
+    // Returns the data offsets of the members that define any of the `undefined` symbols and
+    // haven't been linked yet.
+    fn providers(&self, undefined: &HashSet<Vec<u8>>) -> HashSet<u64> {
+        undefined
+            .iter()
+            .filter_map(|name| self.symbols.get(name.as_slice()))
+            .filter(|offset| !self.linked.contains(offset))
+            .copied()
+            .collect()
+    }
+
+    fn link_members<S, P>(
+        &mut self,
+        timings: &Timings,
+        cancel: Option<&CancellationToken>,
+        sink: &mut S,
+        mut predicate: P,
+    ) -> Result<(), LinkerError>
+    where
+        S: BitcodeSink<'d>,
+        P: FnMut(u64) -> bool,
+    {
+        let read_members = timings.start(Phase::ReadArchives);
+        let mut members = Vec::new();
+        for member in self.file.members() {
+            let member = member
+                .map_err(|err| LinkerError::ArchiveError(self.path.clone(), err.to_string()))?;
+            let name = PathBuf::from(OsStr::from_bytes(member.name()));
+            let (offset, _) = member.file_range();
+            if self.linked.contains(&offset) || !predicate(offset) {
+                continue;
+            }
+            let data = member
+                .data(self.data)
+                .map_err(|err| LinkerError::ArchiveError(self.path.clone(), err.to_string()))?;
+            let _: bool = self.linked.insert(offset);
+            members.push((name, data));
+        }
+        drop(read_members);
+        link_archive_members(timings, cancel, &self.path, members, sink)
+    }
+}
+
+/// Upper bound on the number of threads extracting bitcode from archive members.
+const MAX_ARCHIVE_WORKERS: usize = 8;
+
+/// An archive member queued by [`link_archive_members`], waiting for a worker.
+struct ArchiveJob<'d> {
+    name: PathBuf,
+    data: &'d [u8],
+    in_type: InputType,
+    result: SyncSender<Result<Vec<Cow<'d, [u8]>>, LinkerError>>,
+}
+
+// Link archive members, in order.
+//
+// Detecting the type of the members and extracting embedded bitcode doesn't need the linker's
+// context, so it's done ahead of time on a pipeline of threads: a dispatcher thread checks the
+// type of each member from its header and hands the objects to a bounded pool of workers, while
+// this thread links the extracted bitcode in member order.
+fn link_archive_members<'d, S>(
+    timings: &Timings,
+    cancel: Option<&CancellationToken>,
+    path: &Path,
+    members: Vec<(PathBuf, &'d [u8])>,
+    sink: &mut S,
+) -> Result<(), LinkerError>
+where
+    S: BitcodeSink<'d>,
+{
+    let workers = thread::available_parallelism()
+        .map_or(1, NonZeroUsize::get)
+        .min(MAX_ARCHIVE_WORKERS)
+        .min(members.len())
+        .max(1);
+
+    let (jobs_tx, jobs_rx) = mpsc::sync_channel::<ArchiveJob<'d>>(workers);
+    let jobs_rx = Arc::new(Mutex::new(jobs_rx));
+    // Members are queued in archive order, each with the channel its result will arrive on.
+    // The bound limits how far the dispatcher can get ahead of the linker.
+    let (members_tx, members_rx) = mpsc::sync_channel(2 * workers);
+
+    thread::scope(|s| {
+        let _: ScopedJoinHandle<'_, ()> = s.spawn(move || {
+            for (name, data) in members {
+                let (result_tx, result_rx) = mpsc::sync_channel(1);
+                if members_tx.send((name.clone(), result_rx)).is_err() {
+                    // The linker stopped early.
+                    break;
+                }
+                // Members that are neither bitcode nor objects, like `lib.rmeta`, are rejected
+                // without being read any further.
+                let Some(in_type) =
+                    timings.time(Phase::DetectInputType, || detect_input_type(data))
+                else {
+                    let _: Result<(), _> = result_tx.send(Err(LinkerError::InvalidInputType(name)));
+                    continue;
+                };
+                let job = ArchiveJob {
+                    name,
+                    data,
+                    in_type,
+                    result: result_tx,
+                };
+                if jobs_tx.send(job).is_err() {
+                    break;
+                }
+            }
+        });
+
+        for _ in 0..workers {
+            let jobs_rx = Arc::clone(&jobs_rx);
+            let _: ScopedJoinHandle<'_, ()> = s.spawn(move || loop {
+                let job = jobs_rx.lock().unwrap().recv();
+                let Ok(ArchiveJob {
+                    name,
+                    data,
+                    in_type,
+                    result,
+                }) = job
+                else {
+                    break;
+                };
+                let bitcode = timings.time(Phase::ExtractBitcode, || {
+                    extract_bitcode(&name, data, Some(in_type))
+                });
+                let _: Result<(), _> = result.send(bitcode);
+            });
+        }
+        // Only the workers hold the job queue, so that the dispatcher stops if they all exit.
+        drop(jobs_rx);
+
+        link_extracted_members(cancel, path, members_rx, sink)
+    })
+}
+
+// Link the members queued by `link_archive_members` as their bitcode becomes available. Takes
+// ownership of the queue so that it's dropped as soon as linking stops, which unblocks the
+// dispatcher thread.
+fn link_extracted_members<'d, S>(
+    cancel: Option<&CancellationToken>,
+    path: &Path,
+    members: Receiver<(PathBuf, Receiver<Result<Vec<Cow<'d, [u8]>>, LinkerError>>)>,
+    sink: &mut S,
+) -> Result<(), LinkerError>
+where
+    S: BitcodeSink<'d>,
+{
+    for (name, bitcode) in members {
+        cancel::checkpoint(cancel)?;
+        info!("linking archive item {:?}", name);
+
+        // The sender is only dropped without a reply if a worker panicked, in which case the
+        // panic is propagated when the thread scope ends.
+        let Ok(bitcode) = bitcode.recv() else {
+            break;
+        };
+        match bitcode {
+            Ok(bitcode) => {
+                for bitcode in bitcode {
+                    if !sink.link(&name, bitcode) {
+                        return Err(LinkerError::LinkArchiveModuleError(path.to_owned(), name));
+                    }
+                }
+            }
+            Err(LinkerError::InvalidInputType(_)) => {
+                info!("ignoring archive item {:?}: invalid type", name);
+            }
+            Err(LinkerError::MissingBitcodeSection(_)) => {
+                warn!("ignoring archive item {:?}: no embedded bitcode", name);
+            }
+            Err(_) => return Err(LinkerError::LinkArchiveModuleError(path.to_owned(), name)),
+        }
     }
 
     Ok(())
 }
 
+// find the bitcode in an in-memory input, which can be a file or an archive item. Objects can
+// embed several modules.
+fn extract_bitcode<'d>(
+    path: &Path,
+    data: &'d [u8],
+    in_type: Option<InputType>,
+) -> Result<Vec<Cow<'d, [u8]>>, LinkerError> {
+    // in_type is unknown when we're linking an item from an archive file
+    let in_type = in_type
+        .or_else(|| detect_input_type(data))
+        .ok_or_else(|| LinkerError::InvalidInputType(path.to_owned()))?;
+
+    match in_type {
+        InputType::Bitcode => Ok(vec![Cow::Borrowed(data)]),
+        InputType::Bundle => Bundle::parse(data)
+            .map(|bundle| vec![Cow::Borrowed(bundle.bitcode)])
+            .map_err(|err| LinkerError::InvalidBundle(path.to_owned(), err)),
+        InputType::Elf => match elf::find_embedded_bitcode(data) {
+            Ok(bitcode) if bitcode.is_empty() => {
+                Err(LinkerError::MissingBitcodeSection(path.to_owned()))
+            }
+            Ok(bitcode) => Ok(bitcode),
+            Err(e) => Err(LinkerError::EmbeddedBitcodeError(e)),
+        },
+        // we need to handle this here since archive files could contain
+        // mach-o files, eg somecrate.rlib containing lib.rmeta which is
+        // mach-o on macos
+        InputType::MachO => Err(LinkerError::InvalidInputType(path.to_owned())),
+        // this can't really happen
+        InputType::Archive => panic!("nested archives not supported duh"),
+    }
+}
+
 fn create_target_machine(
     options: &LinkerOptions,
     module: &LLVMModule<'_>,
@@ -665,70 +2391,510 @@ fn create_target_machine(
     Ok(target_machine)
 }
 
-fn optimize<'ctx, 'a, E>(
+// Make the contents of the inputs available in memory.
+fn open_inputs<'i, I>(timings: &Timings, inputs: I) -> Result<Vec<InputData<'i>>, LinkerError>
+where
+    I: IntoIterator<Item = LinkerInput<'i>>,
+{
+    let _timer = timings.start(Phase::OpenInputs);
+    inputs
+        .into_iter()
+        .map(|value| match value {
+            LinkerInput::File(file_input) => {
+                let FileInput { path } = file_input;
+
+                let data = FileData::open(path)?;
+                Ok(InputData::File { path, data })
+            }
+            LinkerInput::Buffer(buffer_input) => {
+                let BufferInput { name, bytes } = buffer_input;
+
+                Ok(InputData::Buffer { name, bytes })
+            }
+            LinkerInput::SharedBuffer(buffer_input) => {
+                let SharedBufferInput { name, bytes } = buffer_input;
+
+                Ok(InputData::SharedBuffer { name, bytes })
+            }
+        })
+        .collect()
+}
+
+// Optimize the linked `module`, dumping it before and after optimization to `dump_module`.
+fn finish_link<'ctx>(
     options: &LinkerOptions,
     context: &'ctx LLVMContext,
+    timings: &Timings,
+    cancel: Option<&CancellationToken>,
+    remarks: (&Remarks, Option<&[u8]>),
+    mut module: LLVMModule<'ctx>,
+    prepared: Option<LLVMTargetMachine>,
+    export_symbols: &HashSet<Cow<'_, [u8]>>,
+    dump_module: Option<&Path>,
+) -> Result<(LLVMModule<'ctx>, LLVMTargetMachine), LinkerError> {
+    // A module prepared by `program_cache_key` comes with its target machine, and was
+    // internalized already.
+    let internalized = prepared.is_some();
+    let target_machine = match prepared {
+        Some(target_machine) => target_machine,
+        None => create_target_machine(options, &module)?,
+    };
+
+    if let Some(path) = dump_module {
+        std::fs::create_dir_all(path).map_err(|err| LinkerError::IoError(path.to_owned(), err))?;
+    }
+    if let Some(path) = dump_module {
+        // dump IR before optimization
+        let path = path.join("pre-opt.ll");
+        let path = CString::new(path.as_os_str().as_encoded_bytes()).unwrap();
+        module
+            .write_ir_to_path(&path)
+            .map_err(LinkerError::WriteIRError)?;
+    };
+    optimize(
+        options,
+        context,
+        timings,
+        cancel,
+        remarks,
+        &target_machine,
+        &mut module,
+        internalized,
+        export_symbols,
+    )?;
+    if let Some(path) = dump_module {
+        // dump IR before optimization
+        let path = path.join("post-opt.ll");
+        let path = CString::new(path.as_os_str().as_encoded_bytes()).unwrap();
+        module
+            .write_ir_to_path(&path)
+            .map_err(LinkerError::WriteIRError)?;
+    };
+
+    // The code is generated next.
+    cancel::checkpoint(cancel)?;
+    Ok((module, target_machine))
+}
+
+fn create_module(context: &LLVMContext) -> Result<LLVMModule<'_>, LinkerError> {
+    context
+        .create_module(c"linked_module")
+        .ok_or(LinkerError::CreateModuleError)
+}
+
+// Returns the key of the code of the program exporting `roots` in the link cache, along with the
+// target machine of `module`.
+//
+// The key is computed from the IR reachable from the program, so `module` is internalized and its
+// dead globals removed first. Optimizing it then skips these. The key leaves out the debug info
+// the output doesn't depend on: all of it without BTF, since it's stripped, and the checksums
+// of the files and the lines of the types and variables with BTF, which only describes them by
+// name. The lines of the code are kept, since the line info of the BTF refers to them.
+fn program_cache_key(
+    options: &LinkerOptions,
+    context: &LLVMContext,
+    timings: &Timings,
+    module: &mut LLVMModule<'_>,
+    roots: &HashSet<Cow<'_, [u8]>>,
+    output_type: OutputType,
+) -> Result<(CacheKey, LLVMTargetMachine), LinkerError> {
+    let target_machine = create_target_machine(options, module)?;
+    internalize(
+        options,
+        context,
+        timings,
+        &target_machine,
+        module,
+        roots,
+        true,
+    )?;
+    let key = if options.btf {
+        let ir = module.write_ir_to_memory();
+        let ir = btf_cache_key_ir(ir.as_slice());
+        LinkCache::program_key(options, &ir, roots, output_type)
+    } else {
+        let _: bool = timings.time(Phase::StripDebugInfo, || module.strip_debug_info());
+        let bitcode = module.write_bitcode_to_memory();
+        LinkCache::program_key(options, bitcode.as_slice(), roots, output_type)
+    };
+    Ok((key, target_machine))
+}
+
+// Returns the textual `ir` of a module without the fields of its debug info that BTF doesn't
+// describe, see `program_cache_key`.
+fn btf_cache_key_ir(ir: &[u8]) -> Vec<u8> {
+    const FIELDS: [&[u8]; 3] = [b"line: ", b"checksumkind: ", b"checksum: "];
+    let find = |haystack: &[u8], needle: &[u8]| {
+        haystack
+            .windows(needle.len())
+            .position(|window| window == needle)
+    };
+    let mut key = Vec::with_capacity(ir.len());
+    for line in ir.split_inclusive(|&byte| byte == b'\n') {
+        if find(line, b"!DILocation(").is_some() || find(line, b"!DISubprogram(").is_some() {
+            key.extend_from_slice(line);
+            continue;
+        }
+        let mut rest = line;
+        while let Some(start) = FIELDS.iter().filter_map(|field| find(rest, field)).min() {
+            key.extend_from_slice(&rest[..start]);
+            let field = &rest[start..];
+            let end = field
+                .iter()
+                .position(|&byte| matches!(byte, b',' | b')'))
+                .unwrap_or(field.len());
+            rest = &field[end..];
+        }
+        key.extend_from_slice(rest);
+    }
+    key
+}
+
+// Internalize what `module` doesn't export and remove what isn't reachable from the exports.
+//
+// The compile units of a `program` split from the other programs of its crate still list the
+// global variables and types of all of them, so they're trimmed to what the program keeps when
+// the BTF is pruned.
+fn internalize(
+    options: &LinkerOptions,
+    context: &LLVMContext,
+    timings: &Timings,
     target_machine: &LLVMTargetMachine,
-    module: &mut LLVMModule<'ctx>,
-    export_symbols: E,
-) -> Result<(), LinkerError>
+    module: &mut LLVMModule<'_>,
+    export_symbols: &HashSet<Cow<'_, [u8]>>,
+    program: bool,
+) -> Result<(), LinkerError> {
+    timings
+        .time(Phase::Internalize, || {
+            llvm::internalize_module(module, options.ignore_inline_never, export_symbols);
+            llvm::remove_dead_globals(target_machine, module)
+        })
+        .map_err(LinkerError::OptimizeError)?;
+    if program && options.prune_btf {
+        timings.time(Phase::PruneDebugInfo, || {
+            llvm::trim_compile_units(context, module)
+        });
+    }
+    Ok(())
+}
+
+// Returns the output found in the link cache for `cache_key`, if any.
+fn cached_output(
+    cache_key: &Option<(&LinkCache, CacheKey)>,
+) -> Result<Option<LinkerOutput>, LinkerError> {
+    let Some((cache, key)) = cache_key else {
+        return Ok(None);
+    };
+    let Some(cached) = cache.lookup(key) else {
+        return Ok(None);
+    };
+    Ok(Some(LinkerOutput {
+        inner: OutputData::Cached(FileData::open(&cached)?),
+    }))
+}
+
+// Collect the symbols to export, including the memory builtins unless disabled.
+fn export_symbols_set<'a, E>(options: &LinkerOptions, export_symbols: E) -> HashSet<Cow<'a, [u8]>>
 where
     E: IntoIterator<Item = &'a str>,
 {
-    let LinkerOptions {
-        disable_memory_builtins,
-        optimize,
-        btf,
-        ignore_inline_never,
-        ..
-    } = options;
-
     let mut export_symbols: HashSet<Cow<'_, [u8]>> = export_symbols
         .into_iter()
         .map(|s| Cow::Borrowed(s.as_bytes()))
         .collect();
 
-    if !disable_memory_builtins {
+    if !options.disable_memory_builtins {
         export_symbols.extend(
             ["memcpy", "memmove", "memset", "memcmp", "bcmp"]
                 .into_iter()
                 .map(|s| s.as_bytes().into()),
         );
     };
+
+    export_symbols
+}
+
+fn optimize<'ctx>(
+    options: &LinkerOptions,
+    context: &'ctx LLVMContext,
+    timings: &Timings,
+    cancel: Option<&CancellationToken>,
+    (remarks, program): (&Remarks, Option<&[u8]>),
+    target_machine: &LLVMTargetMachine,
+    module: &mut LLVMModule<'ctx>,
+    internalized: bool,
+    export_symbols: &HashSet<Cow<'_, [u8]>>,
+) -> Result<(), LinkerError> {
+    let LinkerOptions {
+        optimize,
+        pipeline,
+        btf,
+        prune_btf,
+        unroll_loops,
+        unroll_functions,
+        ..
+    } = options;
+
     debug!(
-        "linking exporting symbols {:?}, opt level {:?}",
-        export_symbols, optimize
+        "linking exporting symbols {:?}, opt level {:?}, pipeline {:?}",
+        export_symbols, optimize, pipeline
     );
     // run optimizations. Will optionally remove noinline attributes, intern all non exported
     // programs and maps and remove dead code.
 
+    timings.record_stage(Stage::Linked, module);
+
+    // Internalize and remove what isn't reachable from the exported symbols first, so that the
+    // debug info is only sanitized for the code that ends up in the output.
+    if !internalized {
+        cancel::checkpoint(cancel)?;
+        internalize(
+            options,
+            context,
+            timings,
+            target_machine,
+            module,
+            export_symbols,
+            program.is_some(),
+        )?;
+    }
+
+    cancel::checkpoint(cancel)?;
     if *btf {
         // if we want to emit BTF, we need to sanitize the debug information
-        llvm::DISanitizer::new(context, module).run(&export_symbols);
+        timings.time(Phase::SanitizeDebugInfo, || {
+            llvm::DISanitizer::new(context, module).run(export_symbols)
+        });
     } else {
         // if we don't need BTF emission, we can strip DI
-        let ok = module.strip_debug_info();
+        let ok = timings.time(Phase::StripDebugInfo, || module.strip_debug_info());
         debug!("Stripping DI, changed={}", ok);
     }
+    timings.record_stage(Stage::DebugInfo, module);
+
+    if *unroll_loops && !unroll_functions.is_empty() {
+        let _: usize = llvm::mark_loops_for_unrolling(
+            module,
+            unroll_functions.iter().map(|name| name.as_bytes()),
+        );
+    }
+
+    cancel::checkpoint(cancel)?;
+    let function_sizes = remarks.function_sizes(module);
+    let (opt_level, loop_unrolling, optimized) = match (optimize, pipeline) {
+        (OptLevel::Auto, Pipeline::Default) => {
+            // Programs are already optimized on a pool of their own, so their variants are
+            // explored on the program's worker instead of nesting another pool in it.
+            let workers = if program.is_some() {
+                1
+            } else {
+                AUTO_VARIANTS.len()
+            };
+            timings.time(Phase::ExploreOptLevels, || {
+                explore_opt_levels(options, cancel, module, workers)
+            })
+        }
+        (opt_level, _) => (*opt_level, true, None),
+    };
 
+    cancel::checkpoint(cancel)?;
+    // The winning variant's module is reused, unless the remarks are collected: they're emitted
+    // by the passes to the diagnostic handler of this context, so the passes have to run again
+    // here.
+    match optimized.filter(|_| !remarks.enabled()) {
+        Some(optimized) => {
+            *module = timings
+                .time(Phase::ParseBitcode, || {
+                    context.parse_bitcode(optimized.as_slice())
+                })
+                .ok_or(LinkerError::CreateModuleError)?;
+        }
+        None => timings
+            .time(Phase::RunPasses, || {
+                llvm::optimize(target_machine, module, opt_level, loop_unrolling, pipeline)
+            })
+            .map_err(LinkerError::OptimizeError)?,
+    }
+    if let Some(function_sizes) = function_sizes {
+        remarks.record_sizes(program, function_sizes, module);
+    }
+
+    if *btf && *prune_btf {
+        // Done after the passes, so that the debug info of the globals they removed goes too.
+        timings.time(Phase::PruneDebugInfo, || {
+            llvm::prune_debug_info(context, module, export_symbols)
+        });
+    }
+    timings.record_stage(Stage::Optimized, module);
+
+    Ok(())
+}
+
+/// The optimization levels and loop unrolling settings [`OptLevel::Auto`] picks from. Ties go to
+/// the first variant.
+const AUTO_VARIANTS: [(OptLevel, bool); 8] = [
+    (OptLevel::Default, true),
+    (OptLevel::Aggressive, true),
+    (OptLevel::Size, true),
+    (OptLevel::SizeMin, true),
+    (OptLevel::Default, false),
+    (OptLevel::Aggressive, false),
+    (OptLevel::Size, false),
+    (OptLevel::SizeMin, false),
+];
+
+// Optimizes copies of `module` with each of the `AUTO_VARIANTS` on a pool of up to `workers`
+// threads, and returns the variant whose code scores best along with its optimized module. Falls
+// back to -O2, without a module, if all the variants fail.
+fn explore_opt_levels(
+    options: &LinkerOptions,
+    cancel: Option<&CancellationToken>,
+    module: &LLVMModule<'_>,
+    workers: usize,
+) -> (OptLevel, bool, Option<MemoryBuffer>) {
+    // Each variant is optimized in its own context, from a copy of the module.
+    let bitcode = module.write_bitcode_to_memory();
+    let bitcode = bitcode.as_slice();
+    let workers = thread::available_parallelism()
+        .map_or(1, NonZeroUsize::get)
+        .min(workers)
+        .max(1);
+    let next = AtomicUsize::new(0);
+    // Only the best module so far is kept, with the index of its variant so ties can go to the
+    // first one.
+    let best = Mutex::new(None::<(VariantScore, usize, MemoryBuffer)>);
+    let worker = || loop {
+        let index = next.fetch_add(1, Ordering::Relaxed);
+        let Some(&variant) = AUTO_VARIANTS.get(index) else {
+            break;
+        };
+        let scored = score_opt_level(options, cancel, bitcode, variant);
+        debug!(
+            "opt level variant {variant:?}: {:?}",
+            scored.as_ref().map(|(score, _)| score)
+        );
+        let Some((score, optimized)) = scored else {
+            continue;
+        };
+        let mut best = best.lock().unwrap();
+        if best
+            .as_ref()
+            .is_none_or(|&(best_score, best_index, _)| (score, index) < (best_score, best_index))
+        {
+            *best = Some((score, index, optimized));
+        }
+    };
+    thread::scope(|s| {
+        // The current thread is one of the workers.
+        let pool = (1..workers).map(|_| s.spawn(worker)).collect::<Vec<_>>();
+        worker();
+        for handle in pool {
+            handle
+                .join()
+                .unwrap_or_else(|err| panic::resume_unwind(err));
+        }
+    });
+    match best.into_inner().unwrap() {
+        Some((score, index, optimized)) => {
+            let (opt_level, loop_unrolling) = AUTO_VARIANTS[index];
+            info!(
+                "picked opt level {opt_level:?}, loop unrolling {loop_unrolling}, scoring {score:?}"
+            );
+            (opt_level, loop_unrolling, Some(optimized))
+        }
+        None => {
+            warn!(
+                "all the opt level variants failed, falling back to {:?}",
+                OptLevel::Default
+            );
+            (OptLevel::Default, true, None)
+        }
+    }
+}
+
+// Optimizes the module in `bitcode` with `variant` in a context of its own, and scores the object
+// code generated. Returns the score and the optimized module, or None if the variant fails, LLVM
+// reports errors or the link is cancelled.
+fn score_opt_level(
+    options: &LinkerOptions,
+    cancel: Option<&CancellationToken>,
+    bitcode: &[u8],
+    (opt_level, loop_unrolling): (OptLevel, bool),
+) -> Option<(VariantScore, MemoryBuffer)> {
+    cancel::checkpoint(cancel).ok()?;
+    let mut context = LLVMContext::new();
+    let diagnostic_handler = context.set_diagnostic_handler(DiagnosticHandler::new(false));
+    let mut module = context.parse_bitcode(bitcode)?;
+    let target_machine = create_target_machine(options, &module).ok()?;
     llvm::optimize(
-        target_machine,
-        module,
-        options.optimize,
-        *ignore_inline_never,
-        &export_symbols,
+        &target_machine,
+        &mut module,
+        opt_level,
+        loop_unrolling,
+        &options.pipeline,
     )
-    .map_err(LinkerError::OptimizeError)?;
+    .ok()?;
+    cancel::checkpoint(cancel).ok()?;
+    let object = codegen_to_buffer(
+        &Timings::new(false),
+        &module,
+        &target_machine,
+        OutputType::Object,
+    )
+    .ok()?;
+    if diagnostic_handler.with_view(|h| h.has_errors.get()) {
+        return None;
+    }
+    let report = ProgramReport::from_object(&object).ok()?;
+    Some((VariantScore::new(&report), module.write_bitcode_to_memory()))
+}
 
-    Ok(())
+/// How good the code generated with an optimization variant is, lower being better: first the
+/// number of programs the verifier would reject, then the instructions and the stack depth of
+/// all the programs.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, PartialOrd, Ord)]
+struct VariantScore {
+    rejected: usize,
+    instructions: u64,
+    stack_depth: u64,
+}
+
+impl VariantScore {
+    /// The number of instructions the verifier accepts in a program.
+    const MAX_INSTRUCTIONS: u64 = 1_000_000;
+    /// The stack the verifier lets a call chain use, in bytes.
+    const MAX_STACK_DEPTH: u64 = 512;
+    /// The number of frames the verifier lets a call chain have.
+    const MAX_CALL_DEPTH: u32 = 8;
+
+    fn new(report: &ProgramReport) -> Self {
+        let mut score = Self {
+            rejected: 0,
+            instructions: 0,
+            stack_depth: 0,
+        };
+        for program in report.programs() {
+            if program.total_instructions > Self::MAX_INSTRUCTIONS
+                || program.max_stack_depth > Self::MAX_STACK_DEPTH
+                || program.max_call_depth > Self::MAX_CALL_DEPTH
+            {
+                score.rejected += 1;
+            }
+            score.instructions += program.total_instructions;
+            score.stack_depth += program.max_stack_depth;
+        }
+        score
+    }
 }
 
 fn codegen_to_file(
+    timings: &Timings,
     module: &LLVMModule<'_>,
     target_machine: &LLVMTargetMachine,
     output: &Path,
     output_type: OutputType,
 ) -> Result<(), LinkerError> {
+    let _timer = timings.start(Phase::Codegen);
     info!("writing {:?} to {:?}", output_type, output);
     let output = CString::new(output.as_os_str().as_encoded_bytes()).unwrap();
     match output_type {
@@ -748,10 +2914,12 @@ fn codegen_to_file(
 }
 
 fn codegen_to_buffer(
+    timings: &Timings,
     module: &LLVMModule<'_>,
     target_machine: &LLVMTargetMachine,
     output_type: OutputType,
 ) -> Result<LinkerOutput, LinkerError> {
+    let _timer = timings.start(Phase::Codegen);
     let memory_buffer = match output_type {
         OutputType::Bitcode => module.write_bitcode_to_memory(),
         OutputType::LlvmAssembly => module.write_ir_to_memory(),
@@ -764,16 +2932,19 @@ fn codegen_to_buffer(
     };
 
     Ok(LinkerOutput {
-        inner: memory_buffer,
+        inner: OutputData::Generated(memory_buffer),
     })
 }
 
 fn llvm_init(
     options: &LinkerOptions,
-) -> (
-    LLVMContext,
-    llvm::InstalledDiagnosticHandler<DiagnosticHandler>,
-) {
+) -> Result<
+    (
+        LLVMContext,
+        llvm::InstalledDiagnosticHandler<DiagnosticHandler>,
+    ),
+    LinkerError,
+> {
     let mut args = Vec::<Cow<'_, CStr>>::new();
     args.push(c"bpf-linker".into());
     // Disable cold call site detection. Many accessors in aya-ebpf return Result<T, E>
@@ -784,18 +2955,30 @@ fn llvm_init(
     // is ignored and the BPF target fails codegen.
     args.push(c"--cold-callsite-rel-freq=0".into());
     if options.unroll_loops {
+        let budget = options.unroll_budget.unwrap_or(u32::MAX);
         // setting cmdline arguments is the only way to customize the unroll pass with the
         // C API.
-        args.extend([
-            c"--unroll-runtime".into(),
-            c"--unroll-runtime-multi-exit".into(),
-            CString::new(format!("--unroll-max-upperbound={}", u32::MAX))
-                .unwrap()
-                .into(),
-            CString::new(format!("--unroll-threshold={}", u32::MAX))
-                .unwrap()
-                .into(),
-        ]);
+        if options.unroll_functions.is_empty() {
+            args.extend([
+                c"--unroll-runtime-multi-exit".into(),
+                CString::new(format!("--unroll-max-upperbound={}", u32::MAX))
+                    .unwrap()
+                    .into(),
+                c"--unroll-runtime".into(),
+                CString::new(format!("--unroll-threshold={budget}"))
+                    .unwrap()
+                    .into(),
+            ]);
+        } else {
+            // The loops of the selected functions are marked like with `#pragma unroll`, which
+            // enables runtime unrolling for them and has its own threshold. The other options
+            // are global to the unroll pass, so they'd apply to the unmarked loops too.
+            args.push(
+                CString::new(format!("--pragma-unroll-threshold={budget}"))
+                    .unwrap()
+                    .into(),
+            );
+        }
     }
     if !options.disable_expand_memcpy_in_order {
         args.push(c"--bpf-expand-memcpy-in-order".into());
@@ -809,29 +2992,76 @@ fn llvm_init(
         // does not require the .ksyms section.
         args.push(c"--bpf-disable-trap-unreachable".into());
     }
+    if let Some(passes) = &options.remarks {
+        // The remarks are emitted through the diagnostic handler, which only gets their text.
+        let passes = passes.to_bytes();
+        for option in [
+            &b"-pass-remarks="[..],
+            b"-pass-remarks-missed=",
+            b"-pass-remarks-analysis=",
+        ] {
+            args.push(CString::new([option, passes].concat()).unwrap().into());
+        }
+    }
     args.extend(options.llvm_args.iter().map(Into::into));
     info!("LLVM command line: {:?}", args);
-    llvm::init(args.as_slice(), c"BPF linker");
+    let initialized = llvm::init(args.as_slice(), c"BPF linker");
+    if !initialized
+        .iter()
+        .map(CString::as_c_str)
+        .filter(|arg| !reports_only(arg))
+        .eq(args
+            .iter()
+            .map(|arg| &**arg)
+            .filter(|arg| !reports_only(arg)))
+    {
+        return Err(LinkerError::IncompatibleLlvmOptions(
+            initialized.to_vec(),
+            args.iter().map(|arg| CString::from(&**arg)).collect(),
+        ));
+    }
 
     let mut context = LLVMContext::new();
 
-    let diagnostic_handler = context.set_diagnostic_handler(DiagnosticHandler::default());
+    let diagnostic_handler =
+        context.set_diagnostic_handler(DiagnosticHandler::new(options.remarks.is_some()));
 
-    unsafe {
-        LLVMInstallFatalErrorHandler(Some(llvm::fatal_error));
-        LLVMEnablePrettyStackTrace();
-    }
+    Ok((context, diagnostic_handler))
+}
 
-    (context, diagnostic_handler)
+/// Returns whether the LLVM option `arg` only makes LLVM report on what it does, like the pass
+/// timers it prints to stderr when the process exits, without changing the output. These
+/// options don't make linkers incompatible, nor change the keys of the link cache.
+pub(crate) fn reports_only(arg: &CStr) -> bool {
+    matches!(arg.to_bytes(), b"-time-passes" | b"--time-passes")
 }
 
-#[derive(Default)]
 pub(crate) struct DiagnosticHandler {
-    pub(crate) has_errors: bool,
+    pub(crate) has_errors: Cell<bool>,
+    /// The remarks emitted since they were last taken, if they're collected.
+    remarks: Option<RefCell<Vec<String>>>,
     // The handler is passed to LLVM as a raw pointer so it must not be moved.
     _marker: std::marker::PhantomPinned,
 }
 
+impl DiagnosticHandler {
+    pub(crate) fn new(collect_remarks: bool) -> Self {
+        Self {
+            has_errors: Cell::new(false),
+            remarks: collect_remarks.then(RefCell::default),
+            _marker: std::marker::PhantomPinned,
+        }
+    }
+
+    /// Returns the remarks emitted since the last call.
+    pub(crate) fn take_remarks(&self) -> Vec<String> {
+        self.remarks
+            .as_ref()
+            .map(|remarks| remarks.take())
+            .unwrap_or_default()
+    }
+}
+
 impl llvm::LLVMDiagnosticHandler for DiagnosticHandler {
     fn handle_diagnostic(
         &mut self,
@@ -856,12 +3086,17 @@ impl llvm::LLVMDiagnosticHandler for DiagnosticHandler {
                 if MATCHERS.iter().any(|matcher| message.ends_with(matcher)) {
                     return;
                 }
-                self.has_errors = true;
+                self.has_errors.set(true);
 
                 error!("llvm: {}", message)
             }
             llvm_sys::LLVMDiagnosticSeverity::LLVMDSWarning => warn!("llvm: {}", message),
-            llvm_sys::LLVMDiagnosticSeverity::LLVMDSRemark => debug!("remark: {}", message),
+            llvm_sys::LLVMDiagnosticSeverity::LLVMDSRemark => {
+                debug!("remark: {}", message);
+                if let Some(remarks) = &self.remarks {
+                    remarks.borrow_mut().push(message.into_owned());
+                }
+            }
             llvm_sys::LLVMDiagnosticSeverity::LLVMDSNote => debug!("note: {}", message),
         }
     }
@@ -872,6 +3107,10 @@ fn detect_input_type(data: &[u8]) -> Option<InputType> {
         return None;
     }
 
+    if data.starts_with(bundle::MAGIC) {
+        return Some(InputType::Bundle);
+    }
+
     match &data[..4] {
         b"\x42\x43\xC0\xDE" | b"\xDE\xC0\x17\x0b" => Some(InputType::Bitcode),
         b"\x7FELF" => Some(InputType::Elf),
@@ -887,12 +3126,23 @@ fn detect_input_type(data: &[u8]) -> Option<InputType> {
 }
 
 pub struct LinkerOutput {
-    inner: MemoryBuffer,
+    inner: OutputData,
+}
+
+/// The contents of a [`LinkerOutput`].
+enum OutputData {
+    /// Code generated by LLVM.
+    Generated(MemoryBuffer),
+    /// An output found in the link cache.
+    Cached(FileData),
 }
 
 impl LinkerOutput {
     pub fn as_slice(&self) -> &[u8] {
-        self.inner.as_slice()
+        match &self.inner {
+            OutputData::Generated(memory_buffer) => memory_buffer.as_slice(),
+            OutputData::Cached(data) => data.as_slice(),
+        }
     }
 }
 
@@ -1,61 +1,76 @@
 use std::{
     borrow::Cow,
     collections::{hash_map::DefaultHasher, HashMap, HashSet},
-    hash::Hasher as _,
+    ffi::CStr,
+    hash::{BuildHasherDefault, Hasher},
     io::Write as _,
     marker::PhantomData,
-    ptr,
+    mem, ptr,
 };
 
-use gimli::{DW_TAG_pointer_type, DW_TAG_structure_type, DW_TAG_variant_part};
+use gimli::{DW_TAG_pointer_type, DW_TAG_structure_type, DW_TAG_variant_part, DwTag};
 use llvm_sys::{core::*, debuginfo::*, prelude::*};
-use tracing::{span, trace, warn, Level};
+use tracing::{enabled, span, trace, warn, Level};
 
 use super::types::{
-    di::DIType,
-    ir::{Function, MDNode, Metadata, Value},
+    di::{DICompileUnit, DICompositeType},
+    ir::{Function, MDNode, Metadata, MetadataEntries, Value},
 };
-use crate::llvm::{iter::*, types::di::DISubprogram, LLVMContext, LLVMModule};
+use crate::llvm::{iter::*, symbol_name, types::di::DISubprogram, LLVMContext, LLVMModule};
 
 // KSYM_NAME_LEN from linux kernel intentionally set
 // to lower value found across kernel versions to ensure
 // backward compatibility
 const MAX_KSYM_NAME_LEN: usize = 128;
 
+// How deep the types of the members of a structure are encoded to intern it, see
+// `encode_composite`.
+const MAX_ENCODED_DEPTH: usize = 64;
+
 pub(crate) struct DISanitizer<'ctx> {
     context: LLVMContextRef,
     module: LLVMModuleRef,
     builder: LLVMDIBuilderRef,
-    visited_nodes: HashSet<u64>,
-    replace_operands: HashMap<u64, LLVMMetadataRef>,
+    visited_nodes: HashSet<u64, BuildValueIdHasher>,
+    replace_operands: HashMap<u64, LLVMMetadataRef, BuildValueIdHasher>,
+    // The first sanitized structure of each encoding, see `intern_composite`.
+    composites: HashMap<Vec<u8>, LLVMValueRef>,
+    // The encodings of the structures nested in the interned ones, and the index of the encoding
+    // of each of those structures, see `encode_composite`.
+    composite_encodings: HashMap<Vec<u8>, u64>,
+    encoded_composites: HashMap<u64, u64, BuildValueIdHasher>,
+    // The items left to visit, see `visit`.
+    stack: Vec<Visit>,
+    // Scratch buffers reused by the nodes being sanitized, so that visiting a node doesn't
+    // allocate.
+    members: Vec<LLVMMetadataRef>,
+    sanitized_name: Vec<u8>,
     skipped_types_lossy: Vec<String>,
     // TODO: use references of safe wrappers instead of PhantomData
     _marker: PhantomData<LLVMModule<'ctx>>,
 }
 
-// Sanitize Rust type names to be valid C type names.
-fn sanitize_type_name(name: &[u8]) -> Vec<u8> {
-    let mut sanitized = Vec::with_capacity(name.len());
+// Sanitize Rust type names to be valid C type names, replacing the contents of `sanitized`.
+fn sanitize_type_name(name: &[u8], sanitized: &mut Vec<u8>) {
+    sanitized.clear();
     for &byte in name {
         // Characters which are valid in C type names (alphanumeric and `_`).
         if matches!(byte, b'0'..=b'9' | b'A'..=b'Z' | b'a'..=b'z' | b'_') {
             sanitized.push(byte);
         } else {
-            write!(&mut sanitized, "_{:X}_", byte).unwrap();
+            write!(sanitized, "_{:X}_", byte).unwrap();
         }
     }
 
     if sanitized.len() > MAX_KSYM_NAME_LEN {
         let mut hasher = DefaultHasher::new();
-        hasher.write(&sanitized);
+        hasher.write(sanitized);
         let hash = hasher.finish();
         // leave space for underscore
         let trim = MAX_KSYM_NAME_LEN - 2 * size_of_val(&hash) - 1;
         sanitized.truncate(trim);
-        write!(&mut sanitized, "_{:x}", hash).unwrap();
+        write!(sanitized, "_{:x}", hash).unwrap();
     }
-
-    sanitized
 }
 
 impl<'ctx> DISanitizer<'ctx> {
@@ -64,34 +79,51 @@ impl<'ctx> DISanitizer<'ctx> {
             context: context.as_mut_ptr(),
             module: module.as_mut_ptr(),
             builder: unsafe { LLVMCreateDIBuilder(module.as_mut_ptr()) },
-            visited_nodes: HashSet::new(),
-            replace_operands: HashMap::new(),
+            visited_nodes: HashSet::default(),
+            replace_operands: HashMap::default(),
+            composites: HashMap::default(),
+            composite_encodings: HashMap::default(),
+            encoded_composites: HashMap::default(),
+            stack: Vec::new(),
+            members: Vec::new(),
+            sanitized_name: Vec::new(),
             skipped_types_lossy: Vec::new(),
             _marker: PhantomData,
         }
     }
 
-    fn visit_mdnode(&mut self, mdnode: MDNode<'_>) {
+    // Sanitizes `mdnode`, the node of `value_ref`. Returns the node to use instead of it if it
+    // turned out to be a copy of a structure that was already sanitized.
+    fn visit_mdnode(
+        &mut self,
+        value_ref: LLVMValueRef,
+        mdnode: MDNode<'_>,
+    ) -> Option<LLVMValueRef> {
         match mdnode.try_into().expect("MDNode is not Metadata") {
             Metadata::DICompositeType(mut di_composite_type) => {
                 #[expect(clippy::single_match)]
                 #[expect(non_upper_case_globals)]
                 match di_composite_type.tag() {
                     DW_TAG_structure_type => {
-                        let names = di_composite_type
-                            .name()
-                            .map(|name| (name.to_owned(), sanitize_type_name(name)));
-
                         // This is a forward declaration. We don't need to do
                         // anything on the declaration, we're going to process
                         // the actual definition.
                         if di_composite_type.flags() == LLVMDIFlagFwdDecl {
-                            return;
+                            return None;
                         }
 
+                        let has_name = match di_composite_type.name() {
+                            Some(name) => {
+                                sanitize_type_name(name, &mut self.sanitized_name);
+                                true
+                            }
+                            None => false,
+                        };
+
                         let mut is_data_carrying_enum = false;
                         let mut remove_name = false;
-                        let mut members: Vec<DIType<'_>> = Vec::new();
+                        let mut members = mem::take(&mut self.members);
+                        members.clear();
                         for element in di_composite_type.elements() {
                             match element {
                                 Metadata::DICompositeType(di_composite_type_inner) => {
@@ -102,10 +134,10 @@ impl<'ctx> DISanitizer<'ctx> {
                                     // doesn't contain data carried by the enum variant.
                                     match di_composite_type_inner.tag() {
                                         DW_TAG_variant_part => {
-                                            if let Some((ref name, _)) = names {
+                                            if let Some(name) = di_composite_type.name() {
                                                 let file = di_composite_type.file();
-                                                let name = String::from_utf8_lossy(name.as_slice())
-                                                    .to_string();
+                                                let name =
+                                                    String::from_utf8_lossy(name).to_string();
                                                 trace!(
                                                     "found data carrying enum {name} ({filename}:{line}), not emitting the debug info for it",
                                                     filename = file.filename().map_or( "<unknown>".into(), String::from_utf8_lossy),
@@ -136,14 +168,14 @@ impl<'ctx> DISanitizer<'ctx> {
                                                     remove_name = true;
                                                     // And don't include the field in the sanitized DI.
                                                 } else {
-                                                    members.push(di_derived_type.into());
+                                                    members.push(di_derived_type.metadata_ref());
                                                 }
                                             } else {
-                                                members.push(di_derived_type.into());
+                                                members.push(di_derived_type.metadata_ref());
                                             }
                                         }
                                         _ => {
-                                            members.push(di_derived_type.into());
+                                            members.push(di_derived_type.metadata_ref());
                                         }
                                     }
                                 }
@@ -153,20 +185,24 @@ impl<'ctx> DISanitizer<'ctx> {
                         if is_data_carrying_enum {
                             di_composite_type.replace_elements(MDNode::empty(self.context));
                         } else if !members.is_empty() {
-                            members.sort_by_cached_key(|di_type| di_type.offset_in_bits());
+                            members.sort_by_key(|&member| unsafe {
+                                LLVMDITypeGetOffsetInBits(member)
+                            });
                             let sorted_elements =
                                 MDNode::with_elements(self.context, members.as_mut_slice());
                             di_composite_type.replace_elements(sorted_elements);
                         }
+                        self.members = members;
                         if remove_name {
                             // `AyaBtfMapMarker` is a type which is used in fields of BTF map
                             // structs. We need to make such structs anonymous in order to get
                             // BTF maps accepted by the Linux kernel.
                             di_composite_type.replace_name(self.context, &[])
-                        } else if let Some((_, sanitized_name)) = names {
+                        } else if has_name {
                             // Clear the name from characters incompatible with C.
-                            di_composite_type.replace_name(self.context, sanitized_name.as_slice())
+                            di_composite_type.replace_name(self.context, &self.sanitized_name)
                         }
+                        return self.intern_composite(value_ref, &di_composite_type);
                     }
                     _ => (),
                 }
@@ -185,21 +221,189 @@ impl<'ctx> DISanitizer<'ctx> {
             Metadata::DISubprogram(mut di_subprogram) => {
                 // Sanitize function names
                 if let Some(name) = di_subprogram.name() {
-                    let name = sanitize_type_name(name);
-                    di_subprogram.replace_name(self.context, name.as_slice())
+                    sanitize_type_name(name, &mut self.sanitized_name);
+                    di_subprogram.replace_name(self.context, &self.sanitized_name)
                 }
             }
             _ => (),
         }
+        None
+    }
+
+    // Returns the first sanitized structure that is the same as `di_composite_type`, the
+    // structure of `value_ref`, for the BTF: with the same name, size and members.
+    //
+    // Copies of a type can differ only in what the BTF doesn't describe, like their file, line,
+    // identifier or template parameters, or be made identical by the sanitization, which LLVM
+    // then can't merge since changing the operands of a node that collides with another makes
+    // it distinct. Keeping a single copy shrinks the metadata and the BTF.
+    //
+    // The members of each copy are nodes of their own, since their scope is the copy they're in,
+    // so the structures are keyed by an encoding of what the BTF describes of them and of the
+    // types of their members, see `encode_type`.
+    fn intern_composite(
+        &mut self,
+        value_ref: LLVMValueRef,
+        di_composite_type: &DICompositeType<'_>,
+    ) -> Option<LLVMValueRef> {
+        let mut key = Vec::new();
+        let _: usize = self.encode_composite(&mut key, di_composite_type, &mut Vec::new());
+        let interned = *self.composites.entry(key).or_insert(value_ref);
+        (interned != value_ref).then_some(interned)
+    }
+
+    // Appends the encoding of `ty` to `out`: its kind and what the BTF describes of it, followed
+    // by the encodings of the types it refers to, so that two types have the same encoding only
+    // if they're the same for the BTF. `ancestors` are the structures being encoded that
+    // contain `ty`, which it refers back to when the types are recursive.
+    //
+    // Returns the index in `ancestors` of the outermost structure `ty` refers back to, or
+    // `usize::MAX` if it doesn't refer to any.
+    //
+    // The nodes that aren't types, like the subranges of arrays and the enumerators of enums,
+    // and the basic types are uniqued, so they're encoded by their identity.
+    fn encode_type(
+        &mut self,
+        out: &mut Vec<u8>,
+        ty: Option<Metadata<'_>>,
+        ancestors: &mut Vec<LLVMMetadataRef>,
+    ) -> usize {
+        match ty {
+            None => {
+                out.push(0);
+                usize::MAX
+            }
+            Some(Metadata::DICompositeType(di_composite_type)) => {
+                self.encode_composite(out, &di_composite_type, ancestors)
+            }
+            Some(Metadata::DIDerivedType(di_derived_type)) => {
+                let tag = di_derived_type.tag();
+                out.push(3);
+                out.extend_from_slice(&tag.0.to_le_bytes());
+                // The names of pointers are removed by the sanitization.
+                #[expect(non_upper_case_globals)]
+                let name: &[u8] = match tag {
+                    DW_TAG_pointer_type => &[],
+                    _ => di_derived_type.name().unwrap_or_default(),
+                };
+                encode_bytes(out, name);
+                out.extend_from_slice(&di_derived_type.size_in_bits().to_le_bytes());
+                out.extend_from_slice(&di_derived_type.offset_in_bits().to_le_bytes());
+                out.extend_from_slice(&di_derived_type.flags().to_le_bytes());
+                self.encode_type(out, di_derived_type.try_base_type(), ancestors)
+            }
+            Some(Metadata::DISubprogram(_)) => {
+                out.push(5);
+                usize::MAX
+            }
+            Some(Metadata::Other(value)) => {
+                out.push(4);
+                out.extend_from_slice(&(value as usize).to_le_bytes());
+                usize::MAX
+            }
+        }
     }
 
-    // navigate the tree of LLVMValueRefs (DFS-pre-order)
+    // Appends the encoding of `di_composite_type` to `out`, see `encode_type`.
+    //
+    // The structures which don't refer back to the ones containing them are encoded once, and
+    // then referred to by the index of their encoding, which keeps the encodings of the types
+    // of generic code, nested very deeply and shared by many structures, small. Past
+    // `MAX_ENCODED_DEPTH`, the structures are encoded by their identity.
+    fn encode_composite(
+        &mut self,
+        out: &mut Vec<u8>,
+        di_composite_type: &DICompositeType<'_>,
+        ancestors: &mut Vec<LLVMMetadataRef>,
+    ) -> usize {
+        let metadata_ref = di_composite_type.metadata_ref();
+        if let Some(index) = ancestors
+            .iter()
+            .rposition(|&ancestor| ancestor == metadata_ref)
+        {
+            out.push(1);
+            out.extend_from_slice(&((ancestors.len() - index) as u64).to_le_bytes());
+            return index;
+        }
+        if let Some(&id) = self.encoded_composites.get(&(metadata_ref as u64)) {
+            out.push(6);
+            out.extend_from_slice(&id.to_le_bytes());
+            return usize::MAX;
+        }
+        let depth = ancestors.len();
+        if depth >= MAX_ENCODED_DEPTH {
+            out.push(4);
+            out.extend_from_slice(&(metadata_ref as usize).to_le_bytes());
+            return 0;
+        }
+        ancestors.push(metadata_ref);
+        let mut encoding = Vec::new();
+        encoding.push(2);
+        encoding.extend_from_slice(&di_composite_type.tag().0.to_le_bytes());
+        encode_bytes(&mut encoding, di_composite_type.name().unwrap_or_default());
+        encoding.extend_from_slice(&di_composite_type.size_in_bits().to_le_bytes());
+        encoding.extend_from_slice(&di_composite_type.flags().to_le_bytes());
+        let mut outermost =
+            self.encode_type(&mut encoding, di_composite_type.base_type(), ancestors);
+        let elements: Vec<_> = di_composite_type.elements().collect();
+        encoding.extend_from_slice(&(elements.len() as u64).to_le_bytes());
+        for element in elements {
+            outermost = outermost.min(self.encode_type(&mut encoding, Some(element), ancestors));
+        }
+        let _: Option<LLVMMetadataRef> = ancestors.pop();
+        if depth == 0 || outermost < depth {
+            out.extend_from_slice(&encoding);
+            return outermost;
+        }
+        let next_id = self.composite_encodings.len() as u64;
+        let id = *self.composite_encodings.entry(encoding).or_insert(next_id);
+        let _: Option<u64> = self.encoded_composites.insert(metadata_ref as u64, id);
+        out.push(6);
+        out.extend_from_slice(&id.to_le_bytes());
+        usize::MAX
+    }
+
+    // Navigates the tree of LLVMValueRefs (DFS-pre-order), starting from `item`.
+    //
+    // The debug info of generic code can be nested very deeply, so the tree is walked with an
+    // explicit stack rather than by recursing.
+    fn visit(&mut self, item: Item) {
+        self.stack.push(Visit::Item(item));
+        while let Some(visit) = self.stack.pop() {
+            match visit {
+                Visit::Item(item) => self.visit_item(item),
+                Visit::Operands {
+                    parent,
+                    index,
+                    count,
+                } => {
+                    if index < count {
+                        self.stack.push(Visit::Operands {
+                            parent,
+                            index: index + 1,
+                            count,
+                        });
+                        // Operands are read when they are visited, as visiting the previous ones
+                        // may have replaced them.
+                        let value = unsafe { LLVMGetOperand(parent, index) };
+                        self.stack.push(Visit::Item(Item::Operand(Operand {
+                            parent,
+                            value,
+                            index,
+                        })));
+                    }
+                }
+            }
+        }
+    }
+
+    // Visits `item`, and pushes its sub items on the stack.
     fn visit_item(&mut self, mut item: Item) {
         let value_ref = item.value_ref();
         let value_id = item.value_id();
 
-        let item_span = span!(Level::TRACE, "item", value_id);
-        let _enter = item_span.enter();
+        // Creating a span for each of the many items is costly, even when it's disabled.
+        let _span = enabled!(Level::TRACE).then(|| span!(Level::TRACE, "item", value_id).entered());
         trace!(?item, value = ?value_ref, "visiting item");
 
         let value = match (value_ref, &item) {
@@ -227,23 +431,38 @@ impl<'ctx> DISanitizer<'ctx> {
         }
 
         if let Value::MDNode(mdnode) = value.clone() {
-            self.visit_mdnode(mdnode)
+            let interned = self.visit_mdnode(value_ref, mdnode);
+            // Only operands can be pointed to another node. The copy and its sub items, which
+            // are the same as those of the node replacing it, don't need to be visited.
+            if let (Some(interned), Item::Operand(operand)) = (interned, &mut item) {
+                trace!(?interned, "replacing with an identical structure");
+                let interned_metadata = unsafe { LLVMValueAsMetadata(interned) };
+                operand.replace(interned);
+                let _: Option<_> = self.replace_operands.insert(value_id, interned_metadata);
+                return;
+            }
         }
 
-        if let Some(operands) = value.operands() {
-            for (index, operand) in operands.enumerate() {
-                self.visit_item(Item::Operand(Operand {
-                    parent: value_ref,
-                    value: operand,
-                    index: index as u32,
-                }))
-            }
+        // The sub items are pushed in the order they're visited, then reversed so that they're
+        // popped in that order.
+        let start = self.stack.len();
+
+        if let Some(count) = value.num_operands() {
+            self.stack.push(Visit::Operands {
+                parent: value_ref,
+                index: 0,
+                count,
+            });
         }
 
         if let Some(entries) = value.metadata_entries() {
             for (index, (metadata, kind)) in entries.iter().enumerate() {
                 let metadata_value = unsafe { LLVMMetadataAsValue(self.context, metadata) };
-                self.visit_item(Item::MetadataEntry(metadata_value, kind, index));
+                self.stack.push(Visit::Item(Item::MetadataEntry(
+                    metadata_value,
+                    kind,
+                    index,
+                )));
             }
         }
 
@@ -251,15 +470,17 @@ impl<'ctx> DISanitizer<'ctx> {
         // those too.
         if let Value::Function(fun) = value {
             for param in fun.params() {
-                self.visit_item(Item::FunctionParam(param));
+                self.stack.push(Visit::Item(Item::FunctionParam(param)));
             }
 
             for basic_block in fun.basic_blocks() {
                 for instruction in basic_block.instructions_iter() {
-                    self.visit_item(Item::Instruction(instruction));
+                    self.stack.push(Visit::Item(Item::Instruction(instruction)));
                 }
             }
         }
+
+        self.stack[start..].reverse();
     }
 
     pub(crate) fn run(mut self, exported_symbols: &HashSet<Cow<'_, [u8]>>) {
@@ -268,14 +489,14 @@ impl<'ctx> DISanitizer<'ctx> {
         self.replace_operands = self.fix_subprogram_linkage(exported_symbols);
 
         for value in module.globals_iter() {
-            self.visit_item(Item::GlobalVariable(value));
+            self.visit(Item::GlobalVariable(value));
         }
         for value in module.global_aliases_iter() {
-            self.visit_item(Item::GlobalAlias(value));
+            self.visit(Item::GlobalAlias(value));
         }
 
         for function in module.functions_iter() {
-            self.visit_item(Item::Function(function));
+            self.visit(Item::Function(function));
         }
 
         if !self.skipped_types_lossy.is_empty() {
@@ -304,8 +525,8 @@ impl<'ctx> DISanitizer<'ctx> {
     fn fix_subprogram_linkage(
         &mut self,
         export_symbols: &HashSet<Cow<'_, [u8]>>,
-    ) -> HashMap<u64, LLVMMetadataRef> {
-        let mut replace = HashMap::new();
+    ) -> HashMap<u64, LLVMMetadataRef, BuildValueIdHasher> {
+        let mut replace = HashMap::default();
 
         for mut function in self
             .module
@@ -388,6 +609,175 @@ impl<'ctx> DISanitizer<'ctx> {
     }
 }
 
+/// Removes the debug info of the global variables that are neither exported, map definitions nor
+/// declarations, so that the BTF only describes the programs, their subprograms and the maps.
+///
+/// The BPF backend emits the BTF of every global variable with debug info, along with the types
+/// reachable from it, including the private statics of the dependencies. The subprograms of the
+/// functions are all kept, as the kernel requires the func info of every function of a program.
+///
+/// The enum types, retained types and imported entities the compile units list are dropped too,
+/// so that only the types reachable from the remaining globals and subprograms are emitted.
+/// Structurally identical types aren't merged here, [`DISanitizer`] already does it.
+pub(crate) fn prune_debug_info(
+    context: &LLVMContext,
+    module: &mut LLVMModule<'_>,
+    export_symbols: &HashSet<Cow<'_, [u8]>>,
+) {
+    let context = context.as_mut_ptr();
+    let module = module.as_mut_ptr();
+    let dbg = c"dbg";
+    let dbg_kind = unsafe { LLVMGetMDKindIDInContext(context, dbg.as_ptr(), 3) };
+
+    let mut kept = HashSet::new();
+    let mut pruned = false;
+    for global in module.globals_iter() {
+        let Some(entries) = MetadataEntries::new(global) else {
+            continue;
+        };
+        let mut debug_info = entries
+            .iter()
+            .filter_map(|(metadata, kind)| (kind == dbg_kind).then_some(metadata))
+            .peekable();
+        if debug_info.peek().is_none() {
+            continue;
+        }
+        let name = symbol_name(global);
+        if unsafe { LLVMIsDeclaration(global) } != 0
+            || export_symbols.contains(name)
+            || is_map_definition(global)
+        {
+            kept.extend(debug_info);
+        } else {
+            trace!(
+                "pruning the debug info of {}",
+                String::from_utf8_lossy(name)
+            );
+            unsafe { LLVMGlobalEraseMetadata(global, dbg_kind) };
+            pruned = true;
+        }
+    }
+
+    // The compile units list their global variables too, and the DWARF of the variables is
+    // emitted even when they have no global anymore.
+    trim_units(context, module, pruned.then_some(&kept));
+}
+
+/// Trims the lists of the compile units of `module` to what the module still has: the global
+/// variables of its remaining globals, and none of the enum types, retained types and imported
+/// entities.
+///
+/// The compile units are shared by all the code of a crate, so once a program was split from the
+/// other programs, they still list the global variables and types of all of them.
+pub(crate) fn trim_compile_units(context: &LLVMContext, module: &mut LLVMModule<'_>) {
+    let context = context.as_mut_ptr();
+    let module = module.as_mut_ptr();
+    let dbg = c"dbg";
+    let dbg_kind = unsafe { LLVMGetMDKindIDInContext(context, dbg.as_ptr(), 3) };
+
+    let mut kept = HashSet::new();
+    for global in module.globals_iter() {
+        if let Some(entries) = MetadataEntries::new(global) {
+            kept.extend(
+                entries
+                    .iter()
+                    .filter_map(|(metadata, kind)| (kind == dbg_kind).then_some(metadata)),
+            );
+        }
+    }
+    trim_units(context, module, Some(&kept));
+}
+
+// Clears the retained nodes of the compile units of `module`, and removes the global variables
+// that aren't in `kept` from them, unless it's None.
+fn trim_units(
+    context: LLVMContextRef,
+    module: LLVMModuleRef,
+    kept: Option<&HashSet<LLVMMetadataRef>>,
+) {
+    let empty = unsafe { LLVMMDNodeInContext2(context, ptr::null_mut(), 0) };
+    let units = c"llvm.dbg.cu";
+    let count = unsafe { LLVMGetNamedMetadataNumOperands(module, units.as_ptr()) };
+    let mut operands = vec![ptr::null_mut(); count as usize];
+    unsafe { LLVMGetNamedMetadataOperands(module, units.as_ptr(), operands.as_mut_ptr()) };
+    for unit in operands {
+        let mut unit = unsafe { DICompileUnit::from_value_ref(unit) };
+        if unit.clear_retained_nodes(empty) {
+            trace!("pruning the retained nodes of a compile unit");
+        }
+        let Some(kept) = kept else {
+            continue;
+        };
+        let globals = unit.global_variables();
+        let mut remaining = globals
+            .iter()
+            .copied()
+            .filter(|global| kept.contains(global))
+            .collect::<Vec<_>>();
+        if remaining.len() != globals.len() {
+            let remaining =
+                unsafe { LLVMMDNodeInContext2(context, remaining.as_mut_ptr(), remaining.len()) };
+            unit.set_global_variables(remaining);
+        }
+    }
+}
+
+// Map definitions are in the `maps` section, or `maps/<name>` for older versions of aya, or in
+// `.maps` for BTF maps.
+fn is_map_definition(global: LLVMValueRef) -> bool {
+    let section = unsafe { LLVMGetSection(global) };
+    if section.is_null() {
+        return false;
+    }
+    let section = unsafe { CStr::from_ptr(section) }.to_bytes();
+    section == b"maps" || section == b".maps" || section.starts_with(b"maps/")
+}
+
+/// Hashes the ids of values, which are their addresses.
+///
+/// The addresses are unique already, so they only need to be mixed for the hash table to spread
+/// them, rather than paying for SipHash.
+#[derive(Default)]
+struct ValueIdHasher(u64);
+
+type BuildValueIdHasher = BuildHasherDefault<ValueIdHasher>;
+
+impl Hasher for ValueIdHasher {
+    fn finish(&self) -> u64 {
+        self.0
+    }
+
+    fn write(&mut self, bytes: &[u8]) {
+        for &byte in bytes {
+            self.write_u64(u64::from(byte));
+        }
+    }
+
+    fn write_u64(&mut self, id: u64) {
+        // Multiplying by 2^64 / φ moves the varying low bits of the address to the high bits,
+        // which are used by the hash table too.
+        self.0 = (self.0.rotate_left(5) ^ id).wrapping_mul(0x9e37_79b9_7f4a_7c15);
+    }
+}
+
+// Appends `bytes` to `out`, prefixed by their length so that they can't run into what follows.
+fn encode_bytes(out: &mut Vec<u8>, bytes: &[u8]) {
+    out.extend_from_slice(&(bytes.len() as u64).to_le_bytes());
+    out.extend_from_slice(bytes);
+}
+
+/// An entry of the stack of items left to visit.
+#[derive(Debug)]
+enum Visit {
+    Item(Item),
+    /// The operands of `parent` from `index` to `count`, which are read when they're visited.
+    Operands {
+        parent: LLVMValueRef,
+        index: u32,
+        count: u32,
+    },
+}
+
 #[derive(Clone, Debug, Eq, PartialEq)]
 enum Item {
     GlobalVariable(LLVMValueRef),
@@ -441,41 +831,41 @@ impl Item {
 mod test {
     use super::*;
 
+    fn sanitize(name: &str) -> Vec<u8> {
+        let mut sanitized = Vec::new();
+        sanitize_type_name(name.as_bytes(), &mut sanitized);
+        sanitized
+    }
+
     #[test]
     fn test_strip_generics() {
         let name = "MyStruct<u64>";
-        assert_eq!(
-            sanitize_type_name(name.as_bytes()),
-            b"MyStruct_3C_u64_3E_".as_slice()
-        );
+        assert_eq!(sanitize(name), b"MyStruct_3C_u64_3E_".as_slice());
 
         let name = "MyStruct<u64, u64>";
-        assert_eq!(
-            sanitize_type_name(name.as_bytes()),
-            b"MyStruct_3C_u64_2C__20_u64_3E_".as_slice()
-        );
+        assert_eq!(sanitize(name), b"MyStruct_3C_u64_2C__20_u64_3E_".as_slice());
 
         let name = "my_function<aya_bpf::BpfContext>";
         assert_eq!(
-            sanitize_type_name(name.as_bytes()),
+            sanitize(name),
             b"my_function_3C_aya_bpf_3A__3A_BpfContext_3E_".as_slice()
         );
 
         let name = "my_function<aya_bpf::BpfContext, aya_log_ebpf::WriteToBuf>";
         assert_eq!(
-            sanitize_type_name(name.as_bytes()),
+            sanitize(name),
             b"my_function_3C_aya_bpf_3A__3A_BpfContext_2C__20_aya_log_ebpf_3A__3A_WriteToBuf_3E_"
                 .as_slice()
         );
 
         let name = "PerfEventArray<[u8; 32]>";
         assert_eq!(
-            sanitize_type_name(name.as_bytes()),
+            sanitize(name),
             b"PerfEventArray_3C__5B_u8_3B__20_32_5D__3E_".as_slice()
         );
 
         let name = "my_function<aya_bpf::this::is::a::very::long::namespace::BpfContext, aya_log_ebpf::this::is::a::very::long::namespace::WriteToBuf>";
-        let san = sanitize_type_name(name.as_bytes());
+        let san = sanitize(name);
 
         assert_eq!(san.len(), 128);
         assert_eq!(
@@ -1,34 +1,37 @@
 mod di;
 mod iter;
+mod module_cache;
+mod stats;
+mod summary;
 mod types;
+mod unroll;
 
 use std::{
     borrow::Cow,
-    collections::HashSet,
+    collections::{hash_map::Entry, HashMap, HashSet},
     ffi::{CStr, CString},
+    io::Write as _,
     os::raw::c_char,
     ptr, slice, str,
+    sync::OnceLock,
 };
 
-pub(crate) use di::DISanitizer;
+pub(crate) use di::{prune_debug_info, trim_compile_units, DISanitizer};
 use iter::{IterModuleFunctions as _, IterModuleGlobalAliases as _, IterModuleGlobals as _};
 use llvm_sys::{
-    bit_reader::LLVMParseBitcodeInContext2,
+    bit_reader::LLVMGetBitcodeModuleInContext2,
     core::{
-        LLVMCreateMemoryBufferWithMemoryRange, LLVMDisposeMemoryBuffer, LLVMDisposeMessage,
-        LLVMGetEnumAttributeKindForName, LLVMGetMDString, LLVMGetModuleInlineAsm, LLVMGetTarget,
-        LLVMGetValueName2, LLVMRemoveEnumAttributeAtIndex, LLVMSetLinkage, LLVMSetModuleInlineAsm2,
-        LLVMSetVisibility,
+        LLVMCreateMemoryBufferWithMemoryRange, LLVMDisposeMessage, LLVMDisposeModule,
+        LLVMGetEnumAttributeKindForName, LLVMGetLinkage, LLVMGetMDString, LLVMGetModuleInlineAsm,
+        LLVMGetSection, LLVMGetTarget, LLVMGetValueName2, LLVMGetVersion, LLVMIsAGlobalAlias,
+        LLVMIsDeclaration, LLVMRemoveEnumAttributeAtIndex, LLVMSetLinkage, LLVMSetModuleInlineAsm2,
+        LLVMSetValueName2, LLVMSetVisibility,
     },
     error::{
         LLVMDisposeErrorMessage, LLVMGetErrorMessage, LLVMGetErrorTypeId, LLVMGetStringErrorTypeId,
     },
+    error_handling::{LLVMEnablePrettyStackTrace, LLVMInstallFatalErrorHandler},
     linker::LLVMLinkModules2,
-    object::{
-        LLVMCreateBinary, LLVMDisposeBinary, LLVMDisposeSectionIterator, LLVMGetSectionContents,
-        LLVMGetSectionName, LLVMGetSectionSize, LLVMMoveToNextSection,
-        LLVMObjectFileCopySectionIterator, LLVMObjectFileIsSectionIteratorAtEnd,
-    },
     prelude::{LLVMModuleRef, LLVMValueRef},
     support::LLVMParseCommandLineOptions,
     target::{
@@ -37,10 +40,14 @@ use llvm_sys::{
     },
     target_machine::{LLVMGetTargetFromTriple, LLVMTargetRef},
     transforms::pass_builder::{
-        LLVMCreatePassBuilderOptions, LLVMDisposePassBuilderOptions, LLVMRunPasses,
+        LLVMCreatePassBuilderOptions, LLVMDisposePassBuilderOptions,
+        LLVMPassBuilderOptionsSetLoopUnrolling, LLVMRunPasses,
     },
     LLVMAttributeFunctionIndex, LLVMLinkage, LLVMVisibility,
 };
+pub(crate) use module_cache::ModuleCache;
+pub(crate) use stats::{function_instructions, module_stats, FunctionInstructions};
+pub(crate) use summary::{ModuleSummary, SummaryCache};
 use tracing::{debug, error};
 pub(crate) use types::{
     context::{InstalledDiagnosticHandler, LLVMContext},
@@ -48,72 +55,135 @@ pub(crate) use types::{
     module::LLVMModule,
     target_machine::LLVMTargetMachine,
 };
+pub(crate) use unroll::mark_loops_for_unrolling;
 
-use crate::OptLevel;
+use crate::{OptLevel, Pipeline};
 
-pub(crate) fn init(args: &[Cow<'_, CStr>], overview: &CStr) {
-    unsafe {
-        LLVMInitializeBPFTarget();
-        LLVMInitializeBPFTargetMC();
-        LLVMInitializeBPFTargetInfo();
-        LLVMInitializeBPFAsmPrinter();
-        LLVMInitializeBPFAsmParser();
-        LLVMInitializeBPFDisassembler();
-    }
+/// Returns the version of the LLVM library in use, as `(major, minor, patch)`.
+pub(crate) fn version() -> (u32, u32, u32) {
+    let (mut major, mut minor, mut patch) = (0, 0, 0);
+    unsafe { LLVMGetVersion(&mut major, &mut minor, &mut patch) };
+    (major, minor, patch)
+}
+
+/// The command line LLVM was initialized with.
+static COMMAND_LINE: OnceLock<Vec<CString>> = OnceLock::new();
+
+/// Initializes LLVM with the command line `args`, unless it's already initialized.
+///
+/// LLVM's options are global to the process and can only be parsed once, so only the first call
+/// parses `args`. Returns the command line LLVM was initialized with, which differs from `args`
+/// when an earlier call passed other options.
+pub(crate) fn init(args: &[Cow<'_, CStr>], overview: &CStr) -> &'static [CString] {
+    COMMAND_LINE.get_or_init(|| {
+        unsafe {
+            LLVMInitializeBPFTarget();
+            LLVMInitializeBPFTargetMC();
+            LLVMInitializeBPFTargetInfo();
+            LLVMInitializeBPFAsmPrinter();
+            LLVMInitializeBPFAsmParser();
+            LLVMInitializeBPFDisassembler();
+        }
+
+        let c_ptrs = args.iter().map(|s| s.as_ptr()).collect::<Vec<_>>();
+        unsafe {
+            LLVMParseCommandLineOptions(c_ptrs.len() as i32, c_ptrs.as_ptr(), overview.as_ptr())
+        };
 
-    let c_ptrs = args.iter().map(|s| s.as_ptr()).collect::<Vec<_>>();
-    unsafe { LLVMParseCommandLineOptions(c_ptrs.len() as i32, c_ptrs.as_ptr(), overview.as_ptr()) };
+        unsafe {
+            LLVMInstallFatalErrorHandler(Some(fatal_error));
+            LLVMEnablePrettyStackTrace();
+        }
+
+        args.iter().map(|arg| CString::from(&**arg)).collect()
+    })
 }
 
-pub(crate) fn find_embedded_bitcode(
-    context: &LLVMContext,
-    data: &[u8],
-) -> Result<Option<Vec<u8>>, String> {
-    let buffer_name = c"mem_buffer";
-    let buffer = unsafe {
-        LLVMCreateMemoryBufferWithMemoryRange(
-            data.as_ptr().cast(),
-            data.len(),
-            buffer_name.as_ptr(),
-            0,
-        )
+/// Links `buffers` into `module`, materializing only the definitions reachable from `roots`.
+///
+/// Every buffer is loaded lazily, so function bodies are only deserialized when the IR linker
+/// needs them. Before linking, each symbol is resolved to one of its definitions like a
+/// traditional linker would, see [`Resolution`]. The definitions that are kept, except `roots`,
+/// are given `linkonce_odr` linkage, which makes `LLVMLinkModules2` pull them in only when they
+/// are referenced by what has been linked so far, while the others are turned into declarations
+/// for the linker. Local symbols are renamed with a per-buffer suffix so that they can be
+/// deduplicated across the rounds below.
+///
+/// Since a buffer can define symbols that are only referenced by buffers linked after it, the
+/// buffers defining still unresolved symbols are reloaded and linked again until no more
+/// definitions can be pulled in.
+///
+/// On failure, returns the index of the buffer that could not be linked.
+pub(crate) fn link_bitcode_buffers_lazily<'ctx>(
+    context: &'ctx LLVMContext,
+    module: &mut LLVMModule<'ctx>,
+    buffers: &[&[u8]],
+    roots: &HashSet<Cow<'_, [u8]>>,
+) -> Result<(), usize> {
+    // All the buffers are loaded before linking any of them, since a definition in a buffer can be
+    // overridden by one in a later buffer.
+    let mut modules = Vec::with_capacity(buffers.len());
+    for (index, buffer) in buffers.iter().enumerate() {
+        match lazy_bitcode_module(context, buffer) {
+            Some(src) => modules.push(src),
+            None => {
+                dispose_modules(modules);
+                return Err(index);
+            }
+        }
+    }
+    let resolution = match Resolution::new(module.as_mut_ptr(), &modules) {
+        Ok(resolution) => resolution,
+        Err(index) => {
+            dispose_modules(modules);
+            return Err(index);
+        }
     };
 
-    let (bin, message) =
-        Message::with(|message| unsafe { LLVMCreateBinary(buffer, context.as_mut_ptr(), message) });
-    if bin.is_null() {
-        return Err(message.as_string_lossy().to_string());
+    let mut defined = Vec::with_capacity(buffers.len());
+    let mut modules = modules.into_iter().enumerate();
+    while let Some((index, src)) = modules.next() {
+        defined.push(resolution.prepare(src, index, Some(roots)));
+        // The source module is destroyed even if linking fails.
+        if unsafe { LLVMLinkModules2(module.as_mut_ptr(), src) } != 0 {
+            dispose_modules(modules.map(|(_, src)| src));
+            return Err(index);
+        }
     }
 
-    let mut ret = None;
-    let iter = unsafe { LLVMObjectFileCopySectionIterator(bin) };
-    while unsafe { LLVMObjectFileIsSectionIteratorAtEnd(bin, iter) } == 0 {
-        let name = unsafe { LLVMGetSectionName(iter) };
-        if !name.is_null() {
-            let name = unsafe { CStr::from_ptr(name) };
-            if name == c".llvmbc" {
-                let buf = unsafe { LLVMGetSectionContents(iter) };
-                let size = unsafe { LLVMGetSectionSize(iter) } as usize;
-                ret = Some(unsafe { slice::from_raw_parts(buf.cast(), size).to_vec() });
-                break;
+    let mut attempted = HashSet::new();
+    loop {
+        let mut unresolved = undefined_symbols(module, roots);
+        unresolved.retain(|name| !attempted.contains(name));
+        let reload = defined
+            .iter()
+            .enumerate()
+            .filter(|(_, defined)| unresolved.iter().any(|name| defined.contains(name)))
+            .map(|(index, _)| index)
+            .collect::<Vec<_>>();
+        if reload.is_empty() {
+            break;
+        }
+        debug!(
+            "lazily linking {} unresolved symbols from {} modules",
+            unresolved.len(),
+            reload.len()
+        );
+        attempted.extend(unresolved);
+
+        for index in reload {
+            let src = lazy_bitcode_module(context, buffers[index]).ok_or(index)?;
+            let _: HashSet<Vec<u8>> = resolution.prepare(src, index, None);
+            if unsafe { LLVMLinkModules2(module.as_mut_ptr(), src) } != 0 {
+                return Err(index);
             }
         }
-        unsafe { LLVMMoveToNextSection(iter) };
     }
-    unsafe { LLVMDisposeSectionIterator(iter) };
-    unsafe { LLVMDisposeBinary(bin) };
-    unsafe { LLVMDisposeMemoryBuffer(buffer) };
 
-    Ok(ret)
+    Ok(())
 }
 
-#[must_use]
-pub(crate) fn link_bitcode_buffer<'ctx>(
-    context: &'ctx LLVMContext,
-    module: &mut LLVMModule<'ctx>,
-    buffer: &[u8],
-) -> bool {
-    let mut linked = false;
+fn lazy_bitcode_module(context: &LLVMContext, buffer: &[u8]) -> Option<LLVMModuleRef> {
     let buffer_name = c"mem_buffer";
     let buffer = unsafe {
         LLVMCreateMemoryBufferWithMemoryRange(
@@ -124,15 +194,268 @@ pub(crate) fn link_bitcode_buffer<'ctx>(
         )
     };
 
-    let mut temp_module = ptr::null_mut();
+    // The module takes ownership of the memory buffer, which it needs to materialize function
+    // bodies.
+    let mut module = ptr::null_mut();
+    (unsafe { LLVMGetBitcodeModuleInContext2(context.as_mut_ptr(), buffer, &mut module) } == 0)
+        .then_some(module)
+}
+
+fn dispose_modules<I>(modules: I)
+where
+    I: IntoIterator<Item = LLVMModuleRef>,
+{
+    for module in modules {
+        unsafe { LLVMDisposeModule(module) };
+    }
+}
+
+/// How a definition takes precedence over the other definitions of the same symbol.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, PartialOrd, Ord)]
+enum Strength {
+    /// `linkonce` definitions, which can be discarded if unused.
+    LinkOnce,
+    /// `weak` and `common` definitions.
+    Weak,
+    /// Strong definitions. There can only be one per symbol.
+    Strong,
+}
+
+impl Strength {
+    // Returns the strength of a definition with `linkage`, or None if it isn't visible to the
+    // other modules.
+    fn of(linkage: LLVMLinkage) -> Option<Self> {
+        match linkage {
+            LLVMLinkage::LLVMExternalLinkage => Some(Self::Strong),
+            LLVMLinkage::LLVMWeakAnyLinkage
+            | LLVMLinkage::LLVMWeakODRLinkage
+            | LLVMLinkage::LLVMCommonLinkage => Some(Self::Weak),
+            LLVMLinkage::LLVMLinkOnceAnyLinkage | LLVMLinkage::LLVMLinkOnceODRLinkage => {
+                Some(Self::LinkOnce)
+            }
+            _ => None,
+        }
+    }
+}
+
+/// The definition a symbol resolves to.
+struct Resolved {
+    /// The index of the module providing the definition, or None if the destination module
+    /// already has it.
+    provider: Option<usize>,
+    strength: Strength,
+    /// Whether the destination module defines the symbol already.
+    in_destination: bool,
+    /// Whether one of the definitions is an alias.
+    has_alias: bool,
+}
+
+/// Which definition of each symbol a lazy link keeps.
+///
+/// The rules are those of a traditional linker: a strong definition beats the weak ones, which
+/// beat the `linkonce` ones, and among definitions of the same strength the first one wins, the
+/// destination module coming first. Two strong definitions of a symbol are an error.
+struct Resolution {
+    symbols: HashMap<Vec<u8>, Resolved>,
+}
+
+impl Resolution {
+    // Resolves the symbols defined by `destination` and `modules`. Returns the index of the
+    // module redefining a strong symbol on failure.
+    fn new(destination: LLVMModuleRef, modules: &[LLVMModuleRef]) -> Result<Self, usize> {
+        let mut symbols = HashMap::new();
+        let modules = [(None, destination)]
+            .into_iter()
+            .chain(modules.iter().enumerate().map(|(i, m)| (Some(i), *m)));
+        for (provider, module) in modules {
+            for (value, name, strength) in exported_definitions(module) {
+                let is_alias = !unsafe { LLVMIsAGlobalAlias(value) }.is_null();
+                match symbols.entry(name.to_vec()) {
+                    Entry::Vacant(entry) => {
+                        let _: &mut Resolved = entry.insert(Resolved {
+                            provider,
+                            strength,
+                            in_destination: provider.is_none(),
+                            has_alias: is_alias,
+                        });
+                    }
+                    Entry::Occupied(mut entry) => {
+                        let resolved = entry.get_mut();
+                        resolved.has_alias |= is_alias;
+                        if strength == Strength::Strong && resolved.strength == Strength::Strong {
+                            error!(
+                                "symbol `{}` is already defined",
+                                String::from_utf8_lossy(name)
+                            );
+                            // The destination comes first, so it's one of the modules.
+                            return Err(provider.unwrap_or_default());
+                        }
+                        if strength > resolved.strength {
+                            resolved.provider = provider;
+                            resolved.strength = strength;
+                        }
+                    }
+                }
+            }
+        }
+        Ok(Self { symbols })
+    }
+
+    // Sets the linkage of the definitions of `module`, the module at `index`, for linking it
+    // lazily. Its definitions of `roots` are linked as they are. When `roots` is None, the module
+    // is linked again, so that only what's still missing is pulled in. Returns the names of the
+    // symbols the module provides.
+    fn prepare(
+        &self,
+        module: LLVMModuleRef,
+        index: usize,
+        roots: Option<&HashSet<Cow<'_, [u8]>>>,
+    ) -> HashSet<Vec<u8>> {
+        let mut provided = HashSet::new();
+        let values = module
+            .globals_iter()
+            .chain(module.global_aliases_iter())
+            .chain(module.functions_iter());
+        for value in values {
+            if unsafe { LLVMIsDeclaration(value) } != 0 {
+                continue;
+            }
+            let name = symbol_name(value);
+            if name.starts_with(b"llvm.") {
+                let _: bool = provided.insert(name.to_vec());
+                continue;
+            }
+            let linkage = unsafe { LLVMGetLinkage(value) };
+            if let LLVMLinkage::LLVMInternalLinkage | LLVMLinkage::LLVMPrivateLinkage = linkage {
+                // Unnamed locals can't be deduplicated by name. Leave them alone, they are copied
+                // along with the definitions that use them.
+                if !name.is_empty() {
+                    let mut name = name.to_vec();
+                    write!(&mut name, ".bpf_linker.{index}").unwrap();
+                    unsafe { LLVMSetValueName2(value, name.as_ptr().cast(), name.len()) };
+                    unsafe { LLVMSetLinkage(value, LLVMLinkage::LLVMLinkOnceODRLinkage) };
+                    let _: bool = provided.insert(name);
+                }
+                continue;
+            }
+            let Some(resolved) = self.symbols.get(name) else {
+                continue;
+            };
+            // Aliases can't be declarations for the linker, so the symbols some module defines
+            // with an alias are resolved by the IR linker, which follows the same rules.
+            if resolved.has_alias {
+                let _: bool = provided.insert(name.to_vec());
+                continue;
+            }
+            if resolved.provider != Some(index) {
+                // The definition that's kept replaces this one wherever it ends up being linked.
+                unsafe { LLVMSetLinkage(value, LLVMLinkage::LLVMAvailableExternallyLinkage) };
+                continue;
+            }
+            let _: bool = provided.insert(name.to_vec());
+            // Roots are always linked, and so is a definition overriding a weaker one of the
+            // destination module, which a `linkonce_odr` definition wouldn't replace.
+            let linked_as_is =
+                resolved.in_destination || roots.is_some_and(|roots| roots.contains(name));
+            if !linked_as_is {
+                unsafe { LLVMSetLinkage(value, LLVMLinkage::LLVMLinkOnceODRLinkage) };
+            }
+        }
+
+        provided
+    }
+}
+
+// Returns the definitions of `module` visible to the other modules, with their name and strength.
+fn exported_definitions<'a>(
+    module: LLVMModuleRef,
+) -> impl Iterator<Item = (LLVMValueRef, &'a [u8], Strength)> {
+    module
+        .globals_iter()
+        .chain(module.global_aliases_iter())
+        .chain(module.functions_iter())
+        .filter(|value| unsafe { LLVMIsDeclaration(*value) } == 0)
+        .filter_map(|value| {
+            let name = symbol_name(value);
+            let strength = Strength::of(unsafe { LLVMGetLinkage(value) })?;
+            (!name.starts_with(b"llvm.")).then_some((value, name, strength))
+        })
+}
 
-    if unsafe { LLVMParseBitcodeInContext2(context.as_mut_ptr(), buffer, &mut temp_module) } == 0 {
-        linked = unsafe { LLVMLinkModules2(module.as_mut_ptr(), temp_module) } == 0;
+/// Returns the symbols that `module` needs but doesn't define: the declared globals and functions,
+/// which includes the `available_externally` ones, and the `roots` that aren't defined. LLVM
+/// intrinsics are not included.
+pub(crate) fn undefined_symbols(
+    module: &LLVMModule<'_>,
+    roots: &HashSet<Cow<'_, [u8]>>,
+) -> HashSet<Vec<u8>> {
+    LinkedSymbols::new(module, roots).undefined
+}
+
+/// The symbols defined and needed by a module, kept up to date as other modules get linked into
+/// it so that finding the undefined symbols doesn't need to walk the whole module every time.
+pub(crate) struct LinkedSymbols {
+    defined: HashSet<Vec<u8>>,
+    undefined: HashSet<Vec<u8>>,
+}
+
+impl LinkedSymbols {
+    /// Collects the symbols of `module`, which needs the `roots` it doesn't define.
+    pub(crate) fn new(module: &LLVMModule<'_>, roots: &HashSet<Cow<'_, [u8]>>) -> Self {
+        let mut symbols = Self {
+            defined: HashSet::new(),
+            undefined: roots.iter().map(|name| name.to_vec()).collect(),
+        };
+        symbols.add(module.as_mut_ptr());
+        symbols
     }
 
-    unsafe { LLVMDisposeMemoryBuffer(buffer) };
+    /// Records the symbols of `module`, about to be linked.
+    ///
+    /// Linking a definition always leaves the destination with one, and a declaration never
+    /// replaces a definition, so what the source defines is defined after linking, and what it
+    /// declares is undefined unless something defined it already.
+    pub(crate) fn add(&mut self, module: LLVMModuleRef) {
+        let Self { defined, undefined } = self;
+        for value in module.globals_iter().chain(module.functions_iter()) {
+            let name = symbol_name(value);
+            let declaration = unsafe { LLVMIsDeclaration(value) } != 0
+                || unsafe { LLVMGetLinkage(value) } == LLVMLinkage::LLVMAvailableExternallyLinkage;
+            if !declaration {
+                if !defined.contains(name) {
+                    let _: bool = undefined.remove(name);
+                    let _: bool = defined.insert(name.to_vec());
+                }
+            } else if !name.starts_with(b"llvm.") && !defined.contains(name) {
+                let _: bool = undefined.insert(name.to_vec());
+            }
+        }
+    }
 
-    linked
+    /// The symbols that are needed but not defined.
+    pub(crate) fn undefined(&self) -> &HashSet<Vec<u8>> {
+        &self.undefined
+    }
+}
+
+/// Returns the names of the exported functions of `module` that are placed in an explicit
+/// section, which is how BPF programs are declared.
+pub(crate) fn exported_programs(
+    module: &LLVMModule<'_>,
+    export_symbols: &HashSet<Cow<'_, [u8]>>,
+) -> Vec<Vec<u8>> {
+    module
+        .as_mut_ptr()
+        .functions_iter()
+        .filter(|function| unsafe { LLVMIsDeclaration(*function) } == 0)
+        .filter(|function| {
+            let section = unsafe { LLVMGetSection(*function) };
+            !section.is_null() && unsafe { *section } != 0
+        })
+        .map(symbol_name)
+        .filter(|name| export_symbols.contains(*name))
+        .map(<[u8]>::to_vec)
+        .collect()
 }
 
 pub(crate) fn target_from_triple(triple: &CStr) -> Result<LLVMTargetRef, String> {
@@ -152,13 +475,13 @@ pub(crate) fn target_from_module(module: &LLVMModule<'_>) -> Result<LLVMTargetRe
     unsafe { target_from_triple(CStr::from_ptr(triple)) }
 }
 
-pub(crate) fn optimize(
-    tm: &LLVMTargetMachine,
+/// Gives internal linkage to the symbols of `module` that aren't in `export_symbols`, so that the
+/// optimizer can remove them when they're unused.
+pub(crate) fn internalize_module(
     module: &mut LLVMModule<'_>,
-    opt_level: OptLevel,
     ignore_inline_never: bool,
     export_symbols: &HashSet<Cow<'_, [u8]>>,
-) -> Result<(), String> {
+) {
     if module_asm_is_probestack(module.as_mut_ptr()) {
         unsafe { LLVMSetModuleInlineAsm2(module.as_mut_ptr(), ptr::null_mut(), 0) };
     }
@@ -179,13 +502,34 @@ pub(crate) fn optimize(
             internalize(function, name, export_symbols);
         }
     }
+}
+
+/// The passes of [`Pipeline::Fast`]. The symbols have already been internalized by
+/// [`internalize_module`].
+const FAST_PIPELINE: &str = "always-inline,function(sroa,instcombine,dce),globaldce";
+
+/// Runs `pipeline` on `module`. Unless `loop_unrolling` is set, the default pipelines don't
+/// unroll loops at all.
+pub(crate) fn optimize(
+    tm: &LLVMTargetMachine,
+    module: &mut LLVMModule<'_>,
+    opt_level: OptLevel,
+    loop_unrolling: bool,
+    pipeline: &Pipeline,
+) -> Result<(), String> {
+    match pipeline {
+        Pipeline::Default => {}
+        Pipeline::Fast => return run_passes(tm, module, FAST_PIPELINE, true),
+        Pipeline::Custom(passes) => return run_passes(tm, module, passes, true),
+    }
 
     let passes = [
         // NB: "default<_>" must be the first pass in the list, otherwise it will be ignored.
         match opt_level {
             // Pretty much nothing compiles with -O0 so make it an alias for -O1.
             OptLevel::No | OptLevel::Less => "default<O1>",
-            OptLevel::Default => "default<O2>",
+            // The linker picks one of the other levels before optimizing.
+            OptLevel::Default | OptLevel::Auto => "default<O2>",
             OptLevel::Aggressive => "default<O3>",
             OptLevel::Size => "default<Os>",
             OptLevel::SizeMin => "default<Oz>",
@@ -197,10 +541,31 @@ pub(crate) fn optimize(
         "dce",
     ];
 
-    let passes = passes.join(",");
+    run_passes(tm, module, &passes.join(","), loop_unrolling)
+}
+
+/// Removes the globals and functions that aren't referenced, typically the ones just internalized
+/// by [`internalize_module`].
+///
+/// This is much cheaper than [`optimize`], and lets the passes that walk the whole module before
+/// optimizing, like the debug info sanitizer, only see the code that ends up in the output.
+pub(crate) fn remove_dead_globals(
+    tm: &LLVMTargetMachine,
+    module: &mut LLVMModule<'_>,
+) -> Result<(), String> {
+    run_passes(tm, module, "globaldce", true)
+}
+
+fn run_passes(
+    tm: &LLVMTargetMachine,
+    module: &mut LLVMModule<'_>,
+    passes: &str,
+    loop_unrolling: bool,
+) -> Result<(), String> {
     debug!("running passes: {passes}");
     let passes = CString::new(passes).unwrap();
     let options = unsafe { LLVMCreatePassBuilderOptions() };
+    unsafe { LLVMPassBuilderOptionsSetLoopUnrolling(options, loop_unrolling.into()) };
     let error = unsafe {
         LLVMRunPasses(
             module.as_mut_ptr(),
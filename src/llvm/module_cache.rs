@@ -0,0 +1,146 @@
+use std::{
+    collections::{hash_map::Entry, HashMap},
+    ptr,
+};
+
+use llvm_sys::{
+    bit_reader::LLVMParseBitcodeInContext2,
+    core::{
+        LLVMCloneModule, LLVMCreateMemoryBufferWithMemoryRange, LLVMDisposeMemoryBuffer,
+        LLVMDisposeModule,
+    },
+    linker::LLVMLinkModules2,
+    prelude::LLVMModuleRef,
+};
+use tracing::debug;
+
+use crate::{
+    llvm::{LLVMContext, LLVMModule, LinkedSymbols},
+    timings::{Phase, Timings},
+};
+
+/// Modules parsed from bitcode, kept in memory so that linking the same bitcode again doesn't
+/// need to parse it.
+///
+/// Linking consumes the source module, so a copy of the cached module is linked every time. The
+/// modules belong to the context they were parsed in: the cache must always be used with the same
+/// context, and dropped before it.
+///
+/// The copies share the uniqued metadata of the cached module, so the cache must not be used for
+/// links that modify metadata in place, like sanitizing debug info does.
+pub(crate) struct ModuleCache {
+    modules: HashMap<[u8; 32], CachedModule>,
+    /// The number of links the cache has been used for.
+    generation: u64,
+}
+
+struct CachedModule {
+    module: LLVMModuleRef,
+    /// The generation the module was last linked in.
+    last_used: u64,
+}
+
+impl ModuleCache {
+    /// The number of links after which modules that weren't linked are evicted.
+    const MAX_UNUSED_LINKS: u64 = 8;
+
+    pub(crate) fn new() -> Self {
+        Self {
+            modules: HashMap::new(),
+            generation: 0,
+        }
+    }
+
+    /// Links the module in `buffer` into `module`, reusing the parsed module if the bitcode with
+    /// the same `key`, its SHA-256 digest, was linked before. The symbols of the linked module
+    /// are added to `symbols`.
+    #[must_use]
+    pub(crate) fn link_bitcode_buffer<'ctx>(
+        &mut self,
+        context: &'ctx LLVMContext,
+        timings: &Timings,
+        module: &mut LLVMModule<'ctx>,
+        symbols: &mut LinkedSymbols,
+        key: [u8; 32],
+        buffer: &[u8],
+    ) -> bool {
+        let Self {
+            modules,
+            generation,
+        } = self;
+
+        let cached = match modules.entry(key) {
+            Entry::Occupied(entry) => {
+                debug!(
+                    "reusing cached module for {} bytes of bitcode",
+                    buffer.len()
+                );
+                entry.into_mut()
+            }
+            Entry::Vacant(entry) => {
+                let parsed = timings.time(Phase::ParseBitcode, || {
+                    parse_bitcode_buffer(context, buffer)
+                });
+                let Some(parsed) = parsed else {
+                    return false;
+                };
+                entry.insert(CachedModule {
+                    module: parsed,
+                    last_used: *generation,
+                })
+            }
+        };
+        cached.last_used = *generation;
+        symbols.add(cached.module);
+
+        timings.time(Phase::LinkModules, || {
+            let copy = unsafe { LLVMCloneModule(cached.module) };
+            unsafe { LLVMLinkModules2(module.as_mut_ptr(), copy) == 0 }
+        })
+    }
+
+    /// Marks the end of a link, evicting the modules that haven't been linked recently.
+    pub(crate) fn finish_link(&mut self) {
+        let Self {
+            modules,
+            generation,
+        } = self;
+
+        modules.retain(|_, CachedModule { module, last_used }| {
+            let keep = *generation - *last_used < Self::MAX_UNUSED_LINKS;
+            if !keep {
+                unsafe { LLVMDisposeModule(*module) };
+            }
+            keep
+        });
+        *generation += 1;
+    }
+}
+
+impl Drop for ModuleCache {
+    fn drop(&mut self) {
+        for CachedModule { module, .. } in self.modules.values() {
+            unsafe { LLVMDisposeModule(*module) };
+        }
+    }
+}
+
+fn parse_bitcode_buffer(context: &LLVMContext, buffer: &[u8]) -> Option<LLVMModuleRef> {
+    let buffer_name = c"mem_buffer";
+    let buffer = unsafe {
+        LLVMCreateMemoryBufferWithMemoryRange(
+            buffer.as_ptr().cast(),
+            buffer.len(),
+            buffer_name.as_ptr(),
+            0,
+        )
+    };
+
+    let mut module = ptr::null_mut();
+    let parsed =
+        unsafe { LLVMParseBitcodeInContext2(context.as_mut_ptr(), buffer, &mut module) } == 0;
+
+    unsafe { LLVMDisposeMemoryBuffer(buffer) };
+
+    parsed.then_some(module)
+}
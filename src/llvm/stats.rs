@@ -0,0 +1,232 @@
+use std::{collections::HashSet, ffi::CString, ptr, slice};
+
+use llvm_sys::{
+    core::{
+        LLVMConstIntGetZExtValue, LLVMDisposeValueMetadataEntries, LLVMGetFirstNamedMetadata,
+        LLVMGetMDKindIDInContext, LLVMGetMDNodeNumOperands, LLVMGetMDNodeOperands, LLVMGetMDString,
+        LLVMGetMetadata, LLVMGetModuleContext, LLVMGetNamedMetadataName,
+        LLVMGetNamedMetadataNumOperands, LLVMGetNamedMetadataOperands, LLVMGetNextNamedMetadata,
+        LLVMGetNumOperands, LLVMGetOperand, LLVMGlobalCopyAllMetadata,
+        LLVMInstructionGetAllMetadataOtherThanDebugLoc, LLVMIsAConstantInt, LLVMIsAMDNode,
+        LLVMIsDeclaration, LLVMMetadataAsValue, LLVMValueAsMetadata,
+        LLVMValueMetadataEntriesGetKind, LLVMValueMetadataEntriesGetMetadata,
+    },
+    debuginfo::{LLVMGetMetadataKind, LLVMMetadataKind},
+    prelude::{LLVMContextRef, LLVMValueMetadataEntry, LLVMValueRef},
+};
+
+use crate::{
+    llvm::{
+        iter::{
+            IterBasicBlocks as _, IterInstructions as _, IterModuleFunctions as _,
+            IterModuleGlobals as _,
+        },
+        symbol_name, LLVMModule,
+    },
+    ModuleStats,
+};
+
+/// Counts the functions, globals, basic blocks, instructions and metadata nodes of `module`.
+pub(crate) fn module_stats(module: &LLVMModule<'_>) -> ModuleStats {
+    let module = module.as_mut_ptr();
+    let context = unsafe { LLVMGetModuleContext(module) };
+    let mut stats = ModuleStats::default();
+    let mut metadata = MetadataNodes::new(context);
+
+    let mut named = unsafe { LLVMGetFirstNamedMetadata(module) };
+    while !named.is_null() {
+        let mut len = 0;
+        let name = unsafe { LLVMGetNamedMetadataName(named, &mut len) };
+        let name = CString::new(unsafe { slice::from_raw_parts(name.cast(), len) }).unwrap();
+        let count = unsafe { LLVMGetNamedMetadataNumOperands(module, name.as_ptr()) };
+        let mut operands = vec![ptr::null_mut(); count as usize];
+        unsafe { LLVMGetNamedMetadataOperands(module, name.as_ptr(), operands.as_mut_ptr()) };
+        operands.into_iter().for_each(|node| metadata.add(node));
+        named = unsafe { LLVMGetNextNamedMetadata(named) };
+    }
+
+    for global in module.globals_iter() {
+        stats.globals += 1;
+        metadata.add_attachments(&unsafe { Attachments::new(global, LLVMGlobalCopyAllMetadata) });
+    }
+    for function in module.functions_iter() {
+        stats.functions += 1;
+        metadata.add_attachments(&unsafe { Attachments::new(function, LLVMGlobalCopyAllMetadata) });
+        for basic_block in function.basic_blocks_iter() {
+            stats.basic_blocks += 1;
+            for instruction in basic_block.instructions_iter() {
+                stats.instructions += 1;
+                metadata.add_instruction(instruction);
+            }
+        }
+    }
+
+    stats.metadata_nodes = metadata.count();
+    stats
+}
+
+/// The size of a function defined in a module.
+pub(crate) struct FunctionInstructions {
+    pub(crate) name: Vec<u8>,
+    /// The number of IR instructions.
+    pub(crate) instructions: u64,
+    /// The `function_entry_count` of the profile attached to the function, if any.
+    pub(crate) entry_count: Option<u64>,
+}
+
+/// Counts the instructions of each function defined in `module`.
+pub(crate) fn function_instructions(module: &LLVMModule<'_>) -> Vec<FunctionInstructions> {
+    let module = module.as_mut_ptr();
+    let context = unsafe { LLVMGetModuleContext(module) };
+    let prof = c"prof";
+    let prof_kind = unsafe { LLVMGetMDKindIDInContext(context, prof.as_ptr(), 4) };
+
+    let mut functions = Vec::new();
+    for function in module.functions_iter() {
+        if unsafe { LLVMIsDeclaration(function) } != 0 {
+            continue;
+        }
+        let instructions = function
+            .basic_blocks_iter()
+            .map(|basic_block| basic_block.instructions_iter().count() as u64)
+            .sum();
+        functions.push(FunctionInstructions {
+            name: symbol_name(function).to_vec(),
+            instructions,
+            entry_count: entry_count(context, function, prof_kind),
+        });
+    }
+    functions
+}
+
+// Reads the entry count from the `!prof !{!"function_entry_count", i64 N}` attachment of
+// `function`.
+fn entry_count(context: LLVMContextRef, function: LLVMValueRef, prof_kind: u32) -> Option<u64> {
+    let attachments = unsafe { Attachments::new(function, LLVMGlobalCopyAllMetadata) };
+    let Attachments { entries, count } = &attachments;
+    let index = (0..*count as u32)
+        .find(|index| unsafe { LLVMValueMetadataEntriesGetKind(*entries, *index) } == prof_kind)?;
+    let node = unsafe {
+        LLVMMetadataAsValue(
+            context,
+            LLVMValueMetadataEntriesGetMetadata(*entries, index),
+        )
+    };
+    let mut operands = [ptr::null_mut(); 2];
+    if unsafe { LLVMGetMDNodeNumOperands(node) } != 2 {
+        return None;
+    }
+    unsafe { LLVMGetMDNodeOperands(node, operands.as_mut_ptr()) };
+    let [kind, count] = operands;
+    let mut len = 0;
+    let kind = unsafe { LLVMGetMDString(kind, &mut len) };
+    if kind.is_null()
+        || unsafe { slice::from_raw_parts(kind.cast(), len as usize) } != b"function_entry_count"
+        || unsafe { LLVMIsAConstantInt(count) }.is_null()
+    {
+        return None;
+    }
+    Some(unsafe { LLVMConstIntGetZExtValue(count) })
+}
+
+/// The distinct metadata nodes reachable from the values added so far.
+struct MetadataNodes {
+    context: LLVMContextRef,
+    dbg_kind: u32,
+    visited: HashSet<LLVMValueRef>,
+    // Nodes can be nested deeply, so they're walked with an explicit stack.
+    stack: Vec<LLVMValueRef>,
+}
+
+impl MetadataNodes {
+    fn new(context: LLVMContextRef) -> Self {
+        let dbg = c"dbg";
+        Self {
+            context,
+            dbg_kind: unsafe { LLVMGetMDKindIDInContext(context, dbg.as_ptr(), 3) },
+            visited: HashSet::new(),
+            stack: Vec::new(),
+        }
+    }
+
+    fn count(&self) -> u64 {
+        self.visited.len() as u64
+    }
+
+    fn add_attachments(&mut self, attachments: &Attachments) {
+        let Attachments { entries, count } = attachments;
+        for index in 0..*count {
+            let metadata = unsafe { LLVMValueMetadataEntriesGetMetadata(*entries, index as u32) };
+            self.add(unsafe { LLVMMetadataAsValue(self.context, metadata) });
+        }
+    }
+
+    fn add_instruction(&mut self, instruction: LLVMValueRef) {
+        self.add_attachments(&unsafe {
+            Attachments::new(instruction, LLVMInstructionGetAllMetadataOtherThanDebugLoc)
+        });
+        self.add(unsafe { LLVMGetMetadata(instruction, self.dbg_kind) });
+        // Metadata operands, like the arguments of the debug intrinsics.
+        let operands = u32::try_from(unsafe { LLVMGetNumOperands(instruction) }).unwrap_or(0);
+        for index in 0..operands {
+            self.add(unsafe { LLVMGetOperand(instruction, index) });
+        }
+    }
+
+    // Adds `node` and the nodes reachable from it.
+    fn add(&mut self, node: LLVMValueRef) {
+        self.push(node);
+        while let Some(node) = self.stack.pop() {
+            let count = unsafe { LLVMGetMDNodeNumOperands(node) };
+            let mut operands = vec![ptr::null_mut(); count as usize];
+            unsafe { LLVMGetMDNodeOperands(node, operands.as_mut_ptr()) };
+            operands.into_iter().for_each(|operand| self.push(operand));
+        }
+    }
+
+    fn push(&mut self, value: LLVMValueRef) {
+        if value.is_null() || unsafe { LLVMIsAMDNode(value) }.is_null() {
+            return;
+        }
+        // LLVMIsAMDNode also accepts values wrapped as metadata, which aren't nodes.
+        let kind = unsafe { LLVMGetMetadataKind(LLVMValueAsMetadata(value)) };
+        if matches!(
+            kind,
+            LLVMMetadataKind::LLVMConstantAsMetadataMetadataKind
+                | LLVMMetadataKind::LLVMLocalAsMetadataMetadataKind
+        ) {
+            return;
+        }
+        if self.visited.insert(value) {
+            self.stack.push(value);
+        }
+    }
+}
+
+/// A copy of the metadata attached to a value.
+struct Attachments {
+    entries: *mut LLVMValueMetadataEntry,
+    count: usize,
+}
+
+impl Attachments {
+    /// Copies the metadata attached to `value` with `copy`, which must be
+    /// `LLVMGlobalCopyAllMetadata` for globals and
+    /// `LLVMInstructionGetAllMetadataOtherThanDebugLoc` for instructions.
+    unsafe fn new(
+        value: LLVMValueRef,
+        copy: unsafe extern "C" fn(LLVMValueRef, *mut usize) -> *mut LLVMValueMetadataEntry,
+    ) -> Self {
+        let mut count = 0;
+        let entries = unsafe { copy(value, &mut count) };
+        Self { entries, count }
+    }
+}
+
+impl Drop for Attachments {
+    fn drop(&mut self) {
+        if !self.entries.is_null() {
+            unsafe { LLVMDisposeValueMetadataEntries(self.entries) };
+        }
+    }
+}
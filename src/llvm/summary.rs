@@ -0,0 +1,138 @@
+use std::{
+    collections::{hash_map::Entry, HashMap, HashSet},
+    sync::Arc,
+};
+
+use llvm_sys::{
+    core::{LLVMDisposeModule, LLVMGetLinkage, LLVMGetSection, LLVMIsDeclaration},
+    LLVMLinkage,
+};
+
+use crate::llvm::{
+    iter::{IterModuleFunctions as _, IterModuleGlobalAliases as _, IterModuleGlobals as _},
+    lazy_bitcode_module, symbol_name, LLVMContext,
+};
+
+/// The symbols a bitcode module defines and needs, which is enough to tell which modules a
+/// program has to import definitions from.
+///
+/// Summaries are read from lazily loaded modules, so no function body is deserialized.
+pub(crate) struct ModuleSummary {
+    /// The symbols the module defines, except the local ones.
+    pub(crate) defined: HashSet<Vec<u8>>,
+    /// The symbols the module declares without defining them.
+    pub(crate) undefined: HashSet<Vec<u8>>,
+    /// The functions the module defines in an explicit section, which are programs when they're
+    /// exported.
+    pub(crate) programs: Vec<Vec<u8>>,
+}
+
+impl ModuleSummary {
+    pub(crate) fn new(context: &LLVMContext, buffer: &[u8]) -> Option<Self> {
+        let module = lazy_bitcode_module(context, buffer)?;
+
+        let mut summary = Self {
+            defined: HashSet::new(),
+            undefined: HashSet::new(),
+            programs: Vec::new(),
+        };
+        let values = module
+            .globals_iter()
+            .chain(module.global_aliases_iter())
+            .chain(module.functions_iter());
+        for value in values {
+            let name = symbol_name(value);
+            if name.starts_with(b"llvm.") {
+                continue;
+            }
+            if unsafe { LLVMIsDeclaration(value) } != 0 {
+                let _: bool = summary.undefined.insert(name.to_vec());
+                continue;
+            }
+            if matches!(
+                unsafe { LLVMGetLinkage(value) },
+                LLVMLinkage::LLVMInternalLinkage | LLVMLinkage::LLVMPrivateLinkage
+            ) {
+                continue;
+            }
+            let _: bool = summary.defined.insert(name.to_vec());
+        }
+        for function in module.functions_iter() {
+            if unsafe { LLVMIsDeclaration(function) } != 0 {
+                continue;
+            }
+            let section = unsafe { LLVMGetSection(function) };
+            if !section.is_null() && unsafe { *section } != 0 {
+                summary.programs.push(symbol_name(function).to_vec());
+            }
+        }
+
+        unsafe { LLVMDisposeModule(module) };
+        Some(summary)
+    }
+}
+
+/// Summaries of the bitcode modules linked before, so that each module is only summarized once.
+///
+/// The modules are loaded in a context of their own: loading them in the context of the linker
+/// would add their types and metadata to it, where they would stay after the modules are gone,
+/// and make the types of the modules linked later get renamed.
+pub(crate) struct SummaryCache {
+    context: LLVMContext,
+    summaries: HashMap<[u8; 32], CachedSummary>,
+    /// The number of links the cache has been used for.
+    generation: u64,
+}
+
+struct CachedSummary {
+    summary: Arc<ModuleSummary>,
+    /// The generation the summary was last used in.
+    last_used: u64,
+}
+
+impl SummaryCache {
+    /// The number of links after which summaries that weren't used are evicted.
+    const MAX_UNUSED_LINKS: u64 = 8;
+
+    pub(crate) fn new() -> Self {
+        Self {
+            context: LLVMContext::new(),
+            summaries: HashMap::new(),
+            generation: 0,
+        }
+    }
+
+    /// Returns the summary of the module in `buffer`, whose SHA-256 digest is `key`, or None if it
+    /// isn't valid bitcode.
+    pub(crate) fn summary(&mut self, key: [u8; 32], buffer: &[u8]) -> Option<Arc<ModuleSummary>> {
+        let Self {
+            context,
+            summaries,
+            generation,
+        } = self;
+
+        let cached = match summaries.entry(key) {
+            Entry::Occupied(entry) => entry.into_mut(),
+            Entry::Vacant(entry) => entry.insert(CachedSummary {
+                summary: Arc::new(ModuleSummary::new(context, buffer)?),
+                last_used: *generation,
+            }),
+        };
+        cached.last_used = *generation;
+        Some(Arc::clone(&cached.summary))
+    }
+
+    /// Marks the end of a link, evicting the summaries that haven't been used recently.
+    pub(crate) fn finish_link(&mut self) {
+        let Self {
+            context: _,
+            summaries,
+            generation,
+        } = self;
+
+        summaries.retain(|_, CachedSummary { last_used, .. }| {
+            *generation - *last_used < Self::MAX_UNUSED_LINKS
+        });
+        *generation += 1;
+    }
+}
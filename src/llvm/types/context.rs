@@ -8,9 +8,11 @@ use std::{
 };
 
 use llvm_sys::{
+    bit_reader::LLVMParseBitcodeInContext2,
     core::{
         LLVMContextCreate, LLVMContextDispose, LLVMContextSetDiagnosticHandler,
-        LLVMGetDiagInfoDescription, LLVMGetDiagInfoSeverity, LLVMModuleCreateWithNameInContext,
+        LLVMCreateMemoryBufferWithMemoryRange, LLVMDisposeMemoryBuffer, LLVMGetDiagInfoDescription,
+        LLVMGetDiagInfoSeverity, LLVMModuleCreateWithNameInContext,
     },
     prelude::{LLVMContextRef, LLVMDiagnosticInfoRef},
 };
@@ -60,6 +62,33 @@ impl LLVMContext {
         })
     }
 
+    /// Parses the bitcode in `buffer` into a new module.
+    pub(crate) fn parse_bitcode<'ctx>(&'ctx self, buffer: &[u8]) -> Option<LLVMModule<'ctx>> {
+        let buffer_name = c"mem_buffer";
+        let buffer = unsafe {
+            LLVMCreateMemoryBufferWithMemoryRange(
+                buffer.as_ptr().cast(),
+                buffer.len(),
+                buffer_name.as_ptr(),
+                0,
+            )
+        };
+
+        let mut module = ptr::null_mut();
+        let ret = unsafe { LLVMParseBitcodeInContext2(self.context, buffer, &mut module) };
+
+        unsafe { LLVMDisposeMemoryBuffer(buffer) };
+
+        if ret != 0 {
+            return None;
+        }
+
+        Some(LLVMModule {
+            module,
+            _marker: PhantomData,
+        })
+    }
+
     /// Install a context-local diagnostic handler.
     pub(crate) fn set_diagnostic_handler<T>(&mut self, handler: T) -> InstalledDiagnosticHandler<T>
     where
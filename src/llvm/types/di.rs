@@ -6,7 +6,7 @@ use llvm_sys::{
     debuginfo::{
         LLVMDIFileGetFilename, LLVMDIFlags, LLVMDIScopeGetFile, LLVMDISubprogramGetLine,
         LLVMDITypeGetFlags, LLVMDITypeGetLine, LLVMDITypeGetName, LLVMDITypeGetOffsetInBits,
-        LLVMGetDINodeTag,
+        LLVMDITypeGetSizeInBits, LLVMGetDINodeTag,
     },
     prelude::{LLVMContextRef, LLVMMetadataRef, LLVMValueRef},
 };
@@ -75,7 +75,7 @@ impl DIFile<'_> {
     }
 }
 
-/// Represents the operands for a [`DIType`]. The enum values correspond to the
+/// Represents the operands for a `DIType`. The enum values correspond to the
 /// operand indices within metadata nodes.
 #[repr(u32)]
 enum DITypeOperand {
@@ -108,49 +108,11 @@ unsafe fn di_type_name<'a>(metadata_ref: LLVMMetadataRef) -> Option<&'a [u8]> {
     (!ptr.is_null()).then(|| unsafe { slice::from_raw_parts(ptr.cast(), len) })
 }
 
-/// Represents the debug information for a primitive type in LLVM IR.
-pub(crate) struct DIType<'ctx> {
-    pub(super) metadata_ref: LLVMMetadataRef,
-    pub(super) value_ref: LLVMValueRef,
-    _marker: PhantomData<&'ctx ()>,
-}
-
-impl DIType<'_> {
-    /// Constructs a new [`DIType`] from the given `value`.
-    ///
-    /// # Safety
-    ///
-    /// This method assumes that the given `value` corresponds to a valid
-    /// instance of [LLVM `DIType`](https://llvm.org/doxygen/classllvm_1_1DIType.html).
-    /// It's the caller's responsibility to ensure this invariant, as this
-    /// method doesn't perform any validation checks.
-    pub(crate) unsafe fn from_value_ref(value_ref: LLVMValueRef) -> Self {
-        let metadata_ref = unsafe { LLVMValueAsMetadata(value_ref) };
-        Self {
-            metadata_ref,
-            value_ref,
-            _marker: PhantomData,
-        }
-    }
-
-    /// Returns the offset of the type in bits. This offset is used in case the
-    /// type is a member of a composite type.
-    pub(crate) fn offset_in_bits(&self) -> usize {
-        unsafe { LLVMDITypeGetOffsetInBits(self.metadata_ref) as usize }
-    }
-}
-
-impl<'ctx> From<DIDerivedType<'ctx>> for DIType<'ctx> {
-    fn from(di_derived_type: DIDerivedType<'_>) -> Self {
-        unsafe { Self::from_value_ref(di_derived_type.value_ref) }
-    }
-}
-
 /// Represents the operands for a [`DIDerivedType`]. The enum values correspond
 /// to the operand indices within metadata nodes.
 #[repr(u32)]
 enum DIDerivedTypeOperand {
-    /// [`DIType`] representing a base type of the given derived type.
+    /// `DIType` representing a base type of the given derived type.
     /// Reference in [LLVM 19-20][llvm-19] and [LLVM 21][llvm-21].
     ///
     /// [llvm-19]: https://github.com/llvm/llvm-project/blob/llvmorg-19.1.7/llvm/include/llvm/IR/DebugInfoMetadata.h#L1084
@@ -191,6 +153,11 @@ impl DIDerivedType<'_> {
         }
     }
 
+    /// Returns the metadata of this derived type.
+    pub(crate) fn metadata_ref(&self) -> LLVMMetadataRef {
+        self.metadata_ref
+    }
+
     /// Returns the base type of this derived type.
     pub(crate) fn base_type(&self) -> Metadata<'_> {
         unsafe {
@@ -199,6 +166,35 @@ impl DIDerivedType<'_> {
         }
     }
 
+    /// Returns the base type of this derived type, or None if it has none, like `void *`.
+    pub(crate) fn try_base_type(&self) -> Option<Metadata<'_>> {
+        unsafe {
+            let value = LLVMGetOperand(self.value_ref, DIDerivedTypeOperand::BaseType as u32);
+            (!value.is_null()).then(|| Metadata::from_value_ref(value))
+        }
+    }
+
+    /// Returns the name of the derived type, like the name of a member.
+    pub(crate) fn name(&self) -> Option<&[u8]> {
+        unsafe { di_type_name(self.metadata_ref) }
+    }
+
+    /// Returns the offset of the derived type in bits, which is the offset of a member in its
+    /// structure.
+    pub(crate) fn offset_in_bits(&self) -> u64 {
+        unsafe { LLVMDITypeGetOffsetInBits(self.metadata_ref) }
+    }
+
+    /// Returns the size of the derived type in bits.
+    pub(crate) fn size_in_bits(&self) -> u64 {
+        unsafe { LLVMDITypeGetSizeInBits(self.metadata_ref) }
+    }
+
+    /// Returns the flags of the derived type, like whether a member is a bitfield.
+    pub(crate) fn flags(&self) -> LLVMDIFlags {
+        unsafe { LLVMDITypeGetFlags(self.metadata_ref) }
+    }
+
     /// Replaces the name of the type with a new name.
     ///
     /// # Errors
@@ -219,6 +215,13 @@ impl DIDerivedType<'_> {
 /// correspond to the operand indices within metadata nodes.
 #[repr(u32)]
 enum DICompositeTypeOperand {
+    /// `DIType` representing the base type of the composite type, like the type of the elements
+    /// of an array or the underlying type of an enum. At the same index as the base type of a
+    /// [`DIDerivedType`].
+    #[cfg(any(feature = "llvm-19", feature = "llvm-20"))]
+    BaseType = 3,
+    #[cfg(feature = "llvm-21")]
+    BaseType = 5,
     /// Elements of the composite type. Reference in [LLVM 19-20][llvm-19] and
     /// [LLVM 21][llvm-21].
     ///
@@ -277,11 +280,29 @@ impl DICompositeType<'_> {
             .map(move |i| unsafe { Metadata::from_value_ref(LLVMGetOperand(elements, i as u32)) })
     }
 
+    /// Returns the metadata of this composite type.
+    pub(crate) fn metadata_ref(&self) -> LLVMMetadataRef {
+        self.metadata_ref
+    }
+
+    /// Returns the base type of this composite type, or None if it has none, like structures.
+    pub(crate) fn base_type(&self) -> Option<Metadata<'_>> {
+        unsafe {
+            let value = LLVMGetOperand(self.value_ref, DICompositeTypeOperand::BaseType as u32);
+            (!value.is_null()).then(|| Metadata::from_value_ref(value))
+        }
+    }
+
     /// Returns the name of the composite type.
     pub(crate) fn name(&self) -> Option<&[u8]> {
         unsafe { di_type_name(self.metadata_ref) }
     }
 
+    /// Returns the size of the composite type in bits.
+    pub(crate) fn size_in_bits(&self) -> u64 {
+        unsafe { LLVMDITypeGetSizeInBits(self.metadata_ref) }
+    }
+
     /// Returns the file that the composite type belongs to.
     pub(crate) fn file(&self) -> DIFile<'_> {
         unsafe {
@@ -450,3 +471,95 @@ impl DISubprogram<'_> {
         };
     }
 }
+
+/// Represents the operands for a [`DICompileUnit`]. The enum values correspond
+/// to the operand indices within metadata nodes.
+#[repr(u32)]
+enum DICompileUnitOperand {
+    /// The enum types of the unit.
+    /// [Reference in LLVM code](https://github.com/llvm/llvm-project/blob/llvmorg-19.1.7/llvm/include/llvm/IR/DebugInfoMetadata.h#L1661).
+    EnumTypes = 4,
+    /// The types retained by the unit, even if nothing references them.
+    /// [Reference in LLVM code](https://github.com/llvm/llvm-project/blob/llvmorg-19.1.7/llvm/include/llvm/IR/DebugInfoMetadata.h#L1662).
+    RetainedTypes = 5,
+    /// The global variables of the unit.
+    /// [Reference in LLVM code](https://github.com/llvm/llvm-project/blob/llvmorg-19.1.7/llvm/include/llvm/IR/DebugInfoMetadata.h#L1663).
+    GlobalVariables = 6,
+    /// The entities imported by the unit, like `use` declarations.
+    /// [Reference in LLVM code](https://github.com/llvm/llvm-project/blob/llvmorg-19.1.7/llvm/include/llvm/IR/DebugInfoMetadata.h#L1664).
+    ImportedEntities = 7,
+}
+
+/// Represents the debug information for a compile unit in LLVM IR.
+pub(crate) struct DICompileUnit<'ctx> {
+    pub value_ref: LLVMValueRef,
+    _marker: PhantomData<&'ctx ()>,
+}
+
+impl DICompileUnit<'_> {
+    /// Constructs a new [`DICompileUnit`] from the given `value`.
+    ///
+    /// # Safety
+    ///
+    /// This method assumes that the provided `value` corresponds to a valid
+    /// instance of [LLVM `DICompileUnit`](https://llvm.org/doxygen/classllvm_1_1DICompileUnit.html).
+    /// It's the caller's responsibility to ensure this invariant, as this
+    /// method doesn't perform any validation checks.
+    pub(crate) unsafe fn from_value_ref(value_ref: LLVMValueRef) -> Self {
+        DICompileUnit {
+            value_ref,
+            _marker: PhantomData,
+        }
+    }
+
+    /// Returns the `DIGlobalVariableExpression`s of the unit.
+    #[expect(
+        clippy::cast_sign_loss,
+        reason = "replace as u32 with cast_unsigned when we no longer support LLVM 19"
+    )]
+    pub(crate) fn global_variables(&self) -> Vec<LLVMMetadataRef> {
+        let globals =
+            unsafe { LLVMGetOperand(self.value_ref, DICompileUnitOperand::GlobalVariables as u32) };
+        if globals.is_null() {
+            return Vec::new();
+        }
+        let count = unsafe { LLVMGetNumOperands(globals) };
+        (0..count)
+            .map(|i| unsafe { LLVMValueAsMetadata(LLVMGetOperand(globals, i as u32)) })
+            .collect()
+    }
+
+    /// Replaces the global variables of the unit with the `globals` tuple.
+    pub(crate) fn set_global_variables(&mut self, globals: LLVMMetadataRef) {
+        unsafe {
+            LLVMReplaceMDNodeOperandWith(
+                self.value_ref,
+                DICompileUnitOperand::GlobalVariables as u32,
+                globals,
+            )
+        };
+    }
+
+    /// Replaces the lists of enum types, retained types and imported entities of the unit with
+    /// `empty`, an empty tuple, if they're not empty already. Returns whether any was replaced.
+    ///
+    /// The entries of these lists are emitted even when nothing else references them. The types
+    /// that are referenced by the rest of the debug info are kept through those references.
+    pub(crate) fn clear_retained_nodes(&mut self, empty: LLVMMetadataRef) -> bool {
+        let mut cleared = false;
+        for operand in [
+            DICompileUnitOperand::EnumTypes,
+            DICompileUnitOperand::RetainedTypes,
+            DICompileUnitOperand::ImportedEntities,
+        ] {
+            let operand = operand as u32;
+            let nodes = unsafe { LLVMGetOperand(self.value_ref, operand) };
+            if nodes.is_null() || unsafe { LLVMGetNumOperands(nodes) } == 0 {
+                continue;
+            }
+            unsafe { LLVMReplaceMDNodeOperandWith(self.value_ref, operand, empty) };
+            cleared = true;
+        }
+        cleared
+    }
+}
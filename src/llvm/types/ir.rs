@@ -2,12 +2,11 @@ use std::marker::PhantomData;
 
 use llvm_sys::{
     core::{
-        LLVMCountParams, LLVMDisposeValueMetadataEntries, LLVMGetNumOperands, LLVMGetOperand,
-        LLVMGetParam, LLVMGlobalCopyAllMetadata, LLVMIsAFunction, LLVMIsAGlobalObject,
-        LLVMIsAInstruction, LLVMIsAMDNode, LLVMIsAUser, LLVMMDNodeInContext2,
-        LLVMMDStringInContext2, LLVMMetadataAsValue, LLVMPrintValueToString,
-        LLVMReplaceMDNodeOperandWith, LLVMValueAsMetadata, LLVMValueMetadataEntriesGetKind,
-        LLVMValueMetadataEntriesGetMetadata,
+        LLVMCountParams, LLVMDisposeValueMetadataEntries, LLVMGetNumOperands, LLVMGetParam,
+        LLVMGlobalCopyAllMetadata, LLVMIsAFunction, LLVMIsAGlobalObject, LLVMIsAInstruction,
+        LLVMIsAMDNode, LLVMIsAUser, LLVMMDNodeInContext2, LLVMMDStringInContext2,
+        LLVMMetadataAsValue, LLVMPrintValueToString, LLVMReplaceMDNodeOperandWith,
+        LLVMValueAsMetadata, LLVMValueMetadataEntriesGetKind, LLVMValueMetadataEntriesGetMetadata,
     },
     debuginfo::{LLVMGetMetadataKind, LLVMGetSubprogram, LLVMMetadataKind, LLVMSetSubprogram},
     prelude::{
@@ -18,7 +17,7 @@ use llvm_sys::{
 use crate::llvm::{
     iter::IterBasicBlocks as _,
     symbol_name,
-    types::di::{DICompositeType, DIDerivedType, DISubprogram, DIType},
+    types::di::{DICompositeType, DIDerivedType, DISubprogram},
     Message,
 };
 
@@ -89,7 +88,10 @@ impl Value<'_> {
         clippy::cast_sign_loss,
         reason = "replace as u32 with cast_unsigned when we no longer support LLVM 19"
     )]
-    pub(crate) fn operands(&self) -> Option<impl Iterator<Item = LLVMValueRef>> {
+    /// Returns the number of operands of the value, or None if the value can't have operands.
+    ///
+    /// The operands can be read with `LLVMGetOperand`.
+    pub(crate) fn num_operands(&self) -> Option<u32> {
         let value = match self {
             Value::MDNode(node) => Some(node.value_ref),
             Value::Function(f) => Some(f.value_ref),
@@ -97,9 +99,7 @@ impl Value<'_> {
             _ => None,
         };
 
-        value.map(|value| unsafe {
-            (0..LLVMGetNumOperands(value)).map(move |i| LLVMGetOperand(value, i as u32))
-        })
+        value.map(|value| unsafe { LLVMGetNumOperands(value) } as u32)
     }
 }
 
@@ -107,7 +107,7 @@ pub(crate) enum Metadata<'ctx> {
     DICompositeType(DICompositeType<'ctx>),
     DIDerivedType(DIDerivedType<'ctx>),
     DISubprogram(DISubprogram<'ctx>),
-    Other(#[expect(dead_code)] LLVMValueRef),
+    Other(LLVMValueRef),
 }
 
 impl Metadata<'_> {
@@ -230,23 +230,14 @@ impl MDNode<'_> {
         unsafe { Self::from_metadata_ref(context, metadata) }
     }
 
-    /// Constructs a new metadata node from an array of [`DIType`] elements.
+    /// Constructs a new metadata node from the metadata of its elements.
     ///
     /// This function is used to create composite metadata structures, such as
     /// arrays or tuples of different types or values, which can then be used
     /// to represent complex data structures within the metadata system.
-    pub(crate) fn with_elements(context: LLVMContextRef, elements: &[DIType<'_>]) -> Self {
-        let metadata = unsafe {
-            let mut elements: Vec<LLVMMetadataRef> = elements
-                .iter()
-                .map(|di_type| LLVMValueAsMetadata(di_type.value_ref))
-                .collect();
-            LLVMMDNodeInContext2(
-                context,
-                elements.as_mut_slice().as_mut_ptr(),
-                elements.len(),
-            )
-        };
+    pub(crate) fn with_elements(context: LLVMContextRef, elements: &mut [LLVMMetadataRef]) -> Self {
+        let metadata =
+            unsafe { LLVMMDNodeInContext2(context, elements.as_mut_ptr(), elements.len()) };
         unsafe { Self::from_metadata_ref(context, metadata) }
     }
 }
@@ -9,6 +9,10 @@ pub(crate) struct MemoryBuffer {
     pub(super) memory_buffer: LLVMMemoryBufferRef,
 }
 
+// SAFETY: memory buffers are not tied to a context, and this type has exclusive ownership of the
+// buffer, so it can be moved to another thread.
+unsafe impl Send for MemoryBuffer {}
+
 impl MemoryBuffer {
     /// Gets a byte slice of this `MemoryBuffer`.
     pub(crate) fn as_slice(&self) -> &[u8] {
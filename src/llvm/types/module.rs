@@ -1,4 +1,4 @@
-use std::{ffi::CStr, marker::PhantomData};
+use std::{ffi::CStr, marker::PhantomData, mem::ManuallyDrop};
 
 use libc::c_char;
 use llvm_sys::{
@@ -8,6 +8,7 @@ use llvm_sys::{
         LLVMGetTarget, LLVMPrintModuleToFile, LLVMPrintModuleToString,
     },
     debuginfo::LLVMStripModuleDebugInfo,
+    linker::LLVMLinkModules2,
     prelude::LLVMModuleRef,
 };
 
@@ -27,6 +28,14 @@ impl LLVMModule<'_> {
         self.module
     }
 
+    /// Links `other` into this module. Returns whether linking succeeded.
+    #[must_use]
+    pub(crate) fn link(&mut self, other: Self) -> bool {
+        // The source module is destroyed by LLVMLinkModules2, even on failure.
+        let other = ManuallyDrop::new(other);
+        unsafe { LLVMLinkModules2(self.module, other.module) == 0 }
+    }
+
     pub(crate) fn get_target(&self) -> *const c_char {
         unsafe { LLVMGetTarget(self.module) }
     }
@@ -0,0 +1,137 @@
+use std::collections::{HashMap, HashSet};
+
+use llvm_sys::{
+    core::{
+        LLVMGetBasicBlockTerminator, LLVMGetCalledValue, LLVMGetMDKindIDInContext, LLVMGetMetadata,
+        LLVMGetModuleContext, LLVMGetNumSuccessors, LLVMGetSuccessor, LLVMIsACallInst,
+        LLVMIsAFunction, LLVMIsDeclaration, LLVMMDNodeInContext2, LLVMMDStringInContext2,
+        LLVMMetadataAsValue, LLVMMetadataReplaceAllUsesWith, LLVMSetMetadata, LLVMTemporaryMDNode,
+    },
+    prelude::{LLVMBasicBlockRef, LLVMContextRef, LLVMMetadataRef, LLVMValueRef},
+};
+use tracing::debug;
+
+use crate::llvm::{
+    iter::{IterBasicBlocks as _, IterInstructions as _, IterModuleFunctions as _},
+    symbol_name, LLVMModule,
+};
+
+/// Asks the loop unroller to unroll the loops of the functions in `roots` and of the functions
+/// they call, by attaching `llvm.loop.unroll.enable` loop metadata to them, like
+/// `#pragma unroll` would.
+///
+/// Such loops are unrolled up to the `-pragma-unroll-threshold` budget, fully when their trip
+/// count is known and at runtime otherwise, while the other loops keep the default thresholds.
+/// Loops that already have loop metadata are left alone, since their source chose how to unroll
+/// them. Returns the number of loops marked.
+pub(crate) fn mark_loops_for_unrolling<'a, I>(module: &mut LLVMModule<'_>, roots: I) -> usize
+where
+    I: IntoIterator<Item = &'a [u8]>,
+{
+    let module = module.as_mut_ptr();
+    let context = unsafe { LLVMGetModuleContext(module) };
+    let loop_kind = {
+        let name = c"llvm.loop";
+        unsafe { LLVMGetMDKindIDInContext(context, name.as_ptr(), 9) }
+    };
+    let enable = {
+        let name = "llvm.loop.unroll.enable";
+        let name = unsafe { LLVMMDStringInContext2(context, name.as_ptr().cast(), name.len()) };
+        unsafe { LLVMMDNodeInContext2(context, [name].as_mut_ptr(), 1) }
+    };
+
+    let functions = module
+        .functions_iter()
+        .filter(|function| unsafe { LLVMIsDeclaration(*function) } == 0)
+        .map(|function| (symbol_name(function), function))
+        .collect::<HashMap<_, _>>();
+    let mut stack = roots
+        .into_iter()
+        .filter_map(|root| functions.get(root).copied())
+        .collect::<Vec<_>>();
+    let mut visited = stack.iter().copied().collect::<HashSet<_>>();
+
+    let mut marked = 0;
+    while let Some(function) = stack.pop() {
+        for latch in loop_latches(function) {
+            let terminator = unsafe { LLVMGetBasicBlockTerminator(latch) };
+            if !unsafe { LLVMGetMetadata(terminator, loop_kind) }.is_null() {
+                continue;
+            }
+            let loop_id = unsafe { LLVMMetadataAsValue(context, loop_id(context, enable)) };
+            unsafe { LLVMSetMetadata(terminator, loop_kind, loop_id) };
+            marked += 1;
+        }
+        for basic_block in function.basic_blocks_iter() {
+            for instruction in basic_block.instructions_iter() {
+                if unsafe { LLVMIsACallInst(instruction) }.is_null() {
+                    continue;
+                }
+                let callee = unsafe { LLVMGetCalledValue(instruction) };
+                if !unsafe { LLVMIsAFunction(callee) }.is_null()
+                    && unsafe { LLVMIsDeclaration(callee) } == 0
+                    && visited.insert(callee)
+                {
+                    stack.push(callee);
+                }
+            }
+        }
+    }
+    debug!("marked {marked} loops for unrolling");
+    marked
+}
+
+// Creates a loop ID with `property`. Loop IDs must be distinct nodes whose first operand is
+// themselves, so that loops with the same properties don't share, and get merged through, one
+// uniqued node. The C API can't create distinct nodes, but LLVM drops the uniquing of a node that
+// becomes its own operand: the node is created with a temporary node in place of itself, which is
+// then replaced by the node, resolving it and making it distinct.
+fn loop_id(context: LLVMContextRef, property: LLVMMetadataRef) -> LLVMMetadataRef {
+    let temporary = unsafe { LLVMTemporaryMDNode(context, std::ptr::null_mut(), 0) };
+    let loop_id = unsafe { LLVMMDNodeInContext2(context, [temporary, property].as_mut_ptr(), 2) };
+    // Also deletes the temporary node.
+    unsafe { LLVMMetadataReplaceAllUsesWith(temporary, loop_id) };
+    loop_id
+}
+
+// Returns the blocks of `function` branching back to a block on the current path of a depth
+// first walk of its control flow graph, which are the latches of its loops.
+fn loop_latches(function: LLVMValueRef) -> Vec<LLVMBasicBlockRef> {
+    let Some(entry) = function.basic_blocks_iter().next() else {
+        return Vec::new();
+    };
+
+    let mut latches = Vec::new();
+    // The blocks on the current path, and the blocks whose successors have all been walked.
+    let mut on_path = HashSet::new();
+    let mut done = HashSet::new();
+    // Each block with the index of the next successor to walk.
+    let mut stack = vec![(entry, 0)];
+    let _: bool = on_path.insert(entry);
+    while let Some((basic_block, next)) = stack.last_mut() {
+        let block = *basic_block;
+        let terminator = unsafe { LLVMGetBasicBlockTerminator(block) };
+        let successors = if terminator.is_null() {
+            0
+        } else {
+            unsafe { LLVMGetNumSuccessors(terminator) }
+        };
+        if *next == successors {
+            let _: bool = on_path.remove(&block);
+            let _: bool = done.insert(block);
+            let _: Option<_> = stack.pop();
+            continue;
+        }
+        let successor = unsafe { LLVMGetSuccessor(terminator, *next) };
+        *next += 1;
+        if on_path.contains(&successor) {
+            if !latches.contains(&block) {
+                latches.push(block);
+            }
+        } else if !done.contains(&successor) {
+            let _: bool = on_path.insert(successor);
+            stack.push((successor, 0));
+        }
+    }
+    latches
+}
@@ -0,0 +1,69 @@
+use std::{ffi::c_void, fs::File, io, ops::Deref, os::fd::AsRawFd as _, ptr, slice};
+
+/// A read-only, private memory mapping of a whole file.
+///
+/// Inputs are mapped rather than read so that large archives and object files
+/// are paged in on demand by the kernel instead of being copied into the heap.
+/// The mapping is private, so modifications made to the file by other
+/// processes while the linker runs are not guaranteed to be visible; truncating
+/// a mapped input results in `SIGBUS`, like with any other mmap-based tool.
+pub(crate) struct Mmap {
+    ptr: *mut c_void,
+    len: usize,
+}
+
+// SAFETY: the mapping is read-only and owned by this type, so it can be shared
+// and sent across threads just like a `Box<[u8]>`.
+unsafe impl Send for Mmap {}
+unsafe impl Sync for Mmap {}
+
+impl Mmap {
+    /// Maps the whole `file` into memory.
+    ///
+    /// Fails for files that can't be mapped, such as empty files, pipes and
+    /// character devices. Callers are expected to fall back to reading.
+    pub(crate) fn map(file: &File) -> io::Result<Self> {
+        let len = file.metadata()?.len();
+        let len = usize::try_from(len)
+            .map_err(|_| io::Error::new(io::ErrorKind::InvalidInput, "file too large to map"))?;
+        if len == 0 {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                "cannot map an empty file",
+            ));
+        }
+        let ptr = unsafe {
+            libc::mmap(
+                ptr::null_mut(),
+                len,
+                libc::PROT_READ,
+                libc::MAP_PRIVATE,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+        Ok(Self { ptr, len })
+    }
+
+    pub(crate) fn as_slice(&self) -> &[u8] {
+        unsafe { slice::from_raw_parts(self.ptr.cast(), self.len) }
+    }
+}
+
+impl Deref for Mmap {
+    type Target = [u8];
+
+    fn deref(&self) -> &Self::Target {
+        self.as_slice()
+    }
+}
+
+impl Drop for Mmap {
+    fn drop(&mut self) {
+        let Self { ptr, len } = self;
+        let _: libc::c_int = unsafe { libc::munmap(*ptr, *len) };
+    }
+}
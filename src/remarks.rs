@@ -0,0 +1,370 @@
+use std::{
+    collections::HashMap,
+    fmt::{self, Write as _},
+    mem,
+    sync::Mutex,
+};
+
+use crate::{
+    llvm::{self, FunctionInstructions, LLVMModule},
+    report::JsonString,
+};
+
+/// Collects the optimization remarks LLVM emits during the links done by a linker, and the size
+/// of each function before and after optimization.
+///
+/// Remarks can be recorded from any thread, so that the programs optimized in parallel by
+/// [`crate::Linker::link_programs_to_buffers`] record theirs under their own name.
+pub(crate) struct Remarks {
+    state: Option<Mutex<RemarksReport>>,
+}
+
+impl Remarks {
+    pub(crate) fn new(enabled: bool) -> Self {
+        Self {
+            state: enabled.then(|| Mutex::new(RemarksReport::default())),
+        }
+    }
+
+    pub(crate) fn enabled(&self) -> bool {
+        self.state.is_some()
+    }
+
+    /// Records the remarks emitted while optimizing and generating the code of `program`, or of
+    /// all the exported programs when None.
+    pub(crate) fn record_remarks(&self, program: Option<&[u8]>, messages: Vec<String>) {
+        let Some(state) = &self.state else {
+            return;
+        };
+        if messages.is_empty() {
+            return;
+        }
+        let program = program.map(|program| String::from_utf8_lossy(program).into_owned());
+        let remarks = messages
+            .iter()
+            .map(|message| Remark::parse(program.clone(), message));
+        state.lock().unwrap().remarks.extend(remarks);
+    }
+
+    /// Counts the instructions of the functions of `module` before it's optimized. Returns None
+    /// when remarks are disabled, since it walks the whole module.
+    pub(crate) fn function_sizes(
+        &self,
+        module: &LLVMModule<'_>,
+    ) -> Option<Vec<FunctionInstructions>> {
+        self.enabled().then(|| llvm::function_instructions(module))
+    }
+
+    /// Records how the size of the functions of `program` changed from `before` to the optimized
+    /// `module`.
+    pub(crate) fn record_sizes(
+        &self,
+        program: Option<&[u8]>,
+        before: Vec<FunctionInstructions>,
+        module: &LLVMModule<'_>,
+    ) {
+        let Some(state) = &self.state else {
+            return;
+        };
+        let program = program.map(|program| String::from_utf8_lossy(program).into_owned());
+        let mut after = llvm::function_instructions(module)
+            .into_iter()
+            .map(|function| (function.name.clone(), function))
+            .collect::<HashMap<_, _>>();
+
+        // Functions that were inlined everywhere are gone after optimization, and the passes can
+        // create functions too, like outlined or specialized ones.
+        let mut functions = Vec::new();
+        for FunctionInstructions {
+            name,
+            instructions,
+            entry_count,
+        } in before
+        {
+            let optimized = after.remove(&name);
+            functions.push(FunctionSize {
+                program: program.clone(),
+                function: String::from_utf8_lossy(&name).into_owned(),
+                instructions_before: instructions,
+                instructions_after: optimized.as_ref().map_or(0, |f| f.instructions),
+                entry_count: optimized.and_then(|f| f.entry_count).or(entry_count),
+            });
+        }
+        for (name, function) in after {
+            functions.push(FunctionSize {
+                program: program.clone(),
+                function: String::from_utf8_lossy(&name).into_owned(),
+                instructions_before: 0,
+                instructions_after: function.instructions,
+                entry_count: function.entry_count,
+            });
+        }
+        // The functions that grew the most first.
+        functions.sort_by(|a, b| {
+            b.delta()
+                .cmp(&a.delta())
+                .then_with(|| a.function.cmp(&b.function))
+        });
+        state.lock().unwrap().functions.extend(functions);
+    }
+
+    /// Returns the remarks recorded so far, and resets them.
+    pub(crate) fn take(&self) -> RemarksReport {
+        let Some(state) = &self.state else {
+            return RemarksReport::default();
+        };
+        mem::take(&mut *state.lock().unwrap())
+    }
+}
+
+/// An optimization remark emitted by LLVM, like a function being inlined, a loop being unrolled,
+/// or an optimization that was missed and why.
+///
+/// The remarks are parsed from the text LLVM formats them as, which is all its C API gives to
+/// the diagnostic handler. The name of the pass that emitted a remark and whether it's about an
+/// optimization that was done, missed, or an analysis aren't part of it, so they aren't recorded;
+/// the message usually tells them apart, like `... inlined into ...` or `... will not be
+/// inlined into ...`.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Remark {
+    /// The program being optimized when the remark was emitted, or None if the exported programs
+    /// were optimized together.
+    pub program: Option<String>,
+    /// The source location the remark is about, as `file:line:column`, when the inputs have debug
+    /// information.
+    pub location: Option<String>,
+    /// The remark, like `'parse' inlined into 'prog' with (cost=40, threshold=250) at callsite
+    /// prog:12:5`.
+    pub message: String,
+    /// The hotness of the code the remark is about, when LLVM attaches it. This needs profile
+    /// data, so it's usually None.
+    pub hotness: Option<u64>,
+}
+
+impl Remark {
+    // Parses a remark formatted by LLVM as `<location>: <message>[ (hotness: <n>)]`.
+    fn parse(program: Option<String>, text: &str) -> Self {
+        let text = text.trim_end();
+        let (location, message) = text
+            .match_indices(": ")
+            .map(|(index, _)| (&text[..index], &text[index + 2..]))
+            .find(|(location, _)| is_location(location))
+            .map_or((None, text), |(location, message)| {
+                // LLVM reports a missing location as `<unknown>:0:0`.
+                let location = (!location.starts_with("<unknown>")).then(|| location.to_owned());
+                (location, message)
+            });
+        let (message, hotness) = message
+            .strip_suffix(')')
+            .and_then(|message| message.rsplit_once(" (hotness: "))
+            .and_then(|(message, hotness)| Some((message, hotness.parse().ok()?)))
+            .map_or((message, None), |(message, hotness)| {
+                (message, Some(hotness))
+            });
+        Self {
+            program,
+            location,
+            message: message.to_owned(),
+            hotness,
+        }
+    }
+}
+
+// Returns whether `location` looks like `file:line:column`.
+fn is_location(location: &str) -> bool {
+    let mut parts = location.rsplitn(3, ':');
+    let (Some(column), Some(line), Some(file)) = (parts.next(), parts.next(), parts.next()) else {
+        return false;
+    };
+    let is_number = |s: &str| !s.is_empty() && s.bytes().all(|b| b.is_ascii_digit());
+    !file.is_empty() && is_number(line) && is_number(column)
+}
+
+/// The size of a function before and after optimization.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct FunctionSize {
+    /// The program the function was optimized for, or None if the exported programs were
+    /// optimized together.
+    pub program: Option<String>,
+    /// The name of the function.
+    pub function: String,
+    /// The number of IR instructions before optimization, or 0 if the optimizations created the
+    /// function.
+    pub instructions_before: u64,
+    /// The number of IR instructions after optimization, or 0 if the function was inlined
+    /// everywhere or removed.
+    pub instructions_after: u64,
+    /// The number of times the function is entered according to the profile data of the inputs,
+    /// if any.
+    pub entry_count: Option<u64>,
+}
+
+impl FunctionSize {
+    /// Returns the number of instructions the optimizations added to the function, negative if
+    /// they removed some.
+    pub fn delta(&self) -> i64 {
+        let Self {
+            instructions_before,
+            instructions_after,
+            ..
+        } = self;
+        i64::try_from(*instructions_after).unwrap_or(i64::MAX)
+            - i64::try_from(*instructions_before).unwrap_or(i64::MAX)
+    }
+}
+
+/// The optimization remarks emitted during the links done since the report was last taken, and
+/// the size of the functions before and after optimization. See
+/// [`crate::LinkerOptions::remarks`].
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct RemarksReport {
+    remarks: Vec<Remark>,
+    functions: Vec<FunctionSize>,
+}
+
+impl RemarksReport {
+    /// Returns the remarks, in the order LLVM emitted them.
+    pub fn remarks(&self) -> &[Remark] {
+        &self.remarks
+    }
+
+    /// Returns the size of the functions of each link, the functions that grew the most first.
+    pub fn functions(&self) -> &[FunctionSize] {
+        &self.functions
+    }
+
+    /// Only keeps the remarks and the functions of the programs for which `f` returns true. `f`
+    /// is passed None for the remarks of the links that optimized the programs together.
+    pub fn retain_programs<F>(&mut self, mut f: F)
+    where
+        F: FnMut(Option<&str>) -> bool,
+    {
+        let Self { remarks, functions } = self;
+        remarks.retain(|remark| f(remark.program.as_deref()));
+        functions.retain(|function| f(function.program.as_deref()));
+    }
+
+    /// Formats the report as a JSON object, like:
+    ///
+    /// ```json
+    /// {
+    ///   "remarks":[{"program":"my_prog","location":"src/main.rs:12:5",
+    ///               "message":"'parse' inlined into 'my_prog' ...","hotness":null},...],
+    ///   "functions":[{"program":"my_prog","function":"my_prog","instructions_before":120,
+    ///                 "instructions_after":480,"delta":360,"entry_count":null},...]
+    /// }
+    /// ```
+    ///
+    /// The output is on a single line.
+    pub fn to_json(&self) -> String {
+        let mut json = String::from(r#"{"remarks":["#);
+        for (i, remark) in self.remarks.iter().enumerate() {
+            let Remark {
+                program,
+                location,
+                message,
+                hotness,
+            } = remark;
+            if i > 0 {
+                json.push(',');
+            }
+            write!(
+                json,
+                r#"{{"program":{},"location":{},"message":{},"hotness":{}}}"#,
+                JsonOption(program.as_deref().map(JsonString)),
+                JsonOption(location.as_deref().map(JsonString)),
+                JsonString(message),
+                JsonOption(*hotness),
+            )
+            .unwrap();
+        }
+        json.push_str(r#"],"functions":["#);
+        for (i, function) in self.functions.iter().enumerate() {
+            let FunctionSize {
+                program,
+                function: name,
+                instructions_before,
+                instructions_after,
+                entry_count,
+            } = function;
+            if i > 0 {
+                json.push(',');
+            }
+            write!(
+                json,
+                r#"{{"program":{},"function":{},"instructions_before":{instructions_before},"instructions_after":{instructions_after},"delta":{},"entry_count":{}}}"#,
+                JsonOption(program.as_deref().map(JsonString)),
+                JsonString(name),
+                function.delta(),
+                JsonOption(*entry_count),
+            )
+            .unwrap();
+        }
+        json.push_str("]}");
+        json
+    }
+}
+
+/// Formats a value as JSON, or `null` if there's none.
+struct JsonOption<T>(Option<T>);
+
+impl<T: fmt::Display> fmt::Display for JsonOption<T> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match &self.0 {
+            Some(value) => value.fmt(f),
+            None => f.write_str("null"),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_parse_remark() {
+        let remark = Remark::parse(
+            Some("prog".to_owned()),
+            "src/lib.rs:12:5: 'parse' inlined into 'prog' with (cost=40, threshold=250) at \
+             callsite prog:3:9;\n",
+        );
+        assert_eq!(remark.location.as_deref(), Some("src/lib.rs:12:5"));
+        assert_eq!(
+            remark.message,
+            "'parse' inlined into 'prog' with (cost=40, threshold=250) at callsite prog:3:9;"
+        );
+        assert_eq!(remark.hotness, None);
+
+        let remark = Remark::parse(None, "<unknown>:0:0: loop not unrolled (hotness: 42)");
+        assert_eq!(remark.location, None);
+        assert_eq!(remark.message, "loop not unrolled");
+        assert_eq!(remark.hotness, Some(42));
+
+        let remark = Remark::parse(None, "no location: at all");
+        assert_eq!(remark.location, None);
+        assert_eq!(remark.message, "no location: at all");
+    }
+
+    #[test]
+    fn test_json() {
+        let report = RemarksReport {
+            remarks: vec![Remark {
+                program: None,
+                location: Some("a.rs:1:2".to_owned()),
+                message: "'f' not inlined into \"g\"".to_owned(),
+                hotness: None,
+            }],
+            functions: vec![FunctionSize {
+                program: Some("prog".to_owned()),
+                function: "prog".to_owned(),
+                instructions_before: 10,
+                instructions_after: 4,
+                entry_count: Some(7),
+            }],
+        };
+        assert_eq!(
+            report.to_json(),
+            r#"{"remarks":[{"program":null,"location":"a.rs:1:2","message":"'f' not inlined into \"g\"","hotness":null}],"functions":[{"program":"prog","function":"prog","instructions_before":10,"instructions_after":4,"delta":-6,"entry_count":7}]}"#
+        );
+    }
+}
@@ -0,0 +1,668 @@
+use std::{
+    collections::{hash_map::Entry, HashMap, HashSet},
+    fmt::{self, Write as _},
+};
+
+use gimli::{
+    AttributeValue, DW_AT_abstract_origin, DW_AT_linkage_name, DW_AT_name, DW_AT_specification,
+    DW_TAG_inlined_subroutine, DebuggingInformationEntry, Dwarf, EndianSlice, RunTimeEndian,
+    SectionId, Unit,
+};
+use object::{
+    read::File, Object as _, ObjectSection as _, ObjectSymbol as _, RelocationTarget, SectionIndex,
+    SectionKind, SymbolKind,
+};
+
+use crate::LinkerError;
+
+/// The size of a BPF instruction, in bytes. Loads of 64-bit immediates take two.
+const INSN_SIZE: u64 = 8;
+
+/// The verifier rounds the stack of each frame up to a multiple of this.
+const FRAME_ALIGN: u64 = 32;
+
+/// The number of the largest inlined functions kept in a report.
+const MAX_INLINED: usize = 16;
+
+const BPF_LDX: u8 = 0x01;
+const BPF_ST: u8 = 0x02;
+const BPF_STX: u8 = 0x03;
+const BPF_ATOMIC: u8 = 0xc0;
+const BPF_LD_IMM64: u8 = 0x18;
+const BPF_MOV64_REG: u8 = 0xbf;
+const BPF_ADD64_IMM: u8 = 0x07;
+const BPF_SUB64_IMM: u8 = 0x17;
+const BPF_CALL: u8 = 0x85;
+const BPF_PSEUDO_CALL: u8 = 1;
+const BPF_REG_FP: usize = 10;
+
+/// The size of the programs of BPF object files, and how close they are to the limits of the
+/// verifier.
+///
+/// The instruction counts and the stack usage are read from the code of the objects. The inlined
+/// functions are read from the DWARF, so they're only reported for objects with debug info, like
+/// the ones linked with [`crate::LinkerOptions::btf`].
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct ProgramReport {
+    programs: Vec<ProgramStats>,
+    inlined: Vec<InlinedFunction>,
+}
+
+/// The size of a program.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct ProgramStats {
+    /// The symbol of the program.
+    pub name: String,
+    /// The section of the program, like `kprobe/my_program`.
+    pub section: String,
+    /// The number of instructions of the program, without the functions it calls.
+    pub instructions: u64,
+    /// The number of instructions of the program and of all the functions it can call, which is
+    /// what the verifier loads.
+    pub total_instructions: u64,
+    /// The stack used by the program, without the functions it calls, in bytes.
+    pub stack_size: u64,
+    /// The stack used by the deepest call chain of the program, in bytes, with each frame rounded
+    /// up like the verifier does. The verifier rejects programs using more than 512 bytes.
+    pub max_stack_depth: u64,
+    /// The number of frames of the deepest call chain of the program, including its own. The
+    /// verifier rejects programs with more than 8.
+    pub max_call_depth: u32,
+}
+
+/// A function inlined in the programs.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct InlinedFunction {
+    /// The name of the function.
+    pub name: String,
+    /// The number of instructions of all its inlined copies.
+    pub instructions: u64,
+    /// The number of places it's inlined at.
+    pub count: u64,
+}
+
+impl ProgramReport {
+    /// Builds the report of the BPF object file `object`.
+    pub fn from_object(object: &[u8]) -> Result<Self, LinkerError> {
+        Self::from_objects([object])
+    }
+
+    /// Builds the report of several BPF object files, like the outputs of
+    /// [`crate::Linker::link_programs_to_buffers`].
+    pub fn from_objects<'a, I>(objects: I) -> Result<Self, LinkerError>
+    where
+        I: IntoIterator<Item = &'a [u8]>,
+    {
+        let mut programs = Vec::new();
+        let mut inlined = HashMap::new();
+        for object in objects {
+            let file =
+                File::parse(object).map_err(|err| LinkerError::InvalidObject(err.to_string()))?;
+            programs.extend(program_stats(&file)?);
+            inlined_functions(&file, &mut inlined)
+                .map_err(|err| LinkerError::InvalidObject(err.to_string()))?;
+        }
+
+        let mut inlined = inlined.into_values().collect::<Vec<_>>();
+        inlined.sort_unstable_by(|a, b| {
+            b.instructions
+                .cmp(&a.instructions)
+                .then_with(|| a.name.cmp(&b.name))
+        });
+        inlined.truncate(MAX_INLINED);
+        Ok(Self { programs, inlined })
+    }
+
+    /// Returns the programs, in the order of their symbols.
+    pub fn programs(&self) -> &[ProgramStats] {
+        &self.programs
+    }
+
+    /// Returns the inlined functions that take the most instructions, the largest first.
+    pub fn inlined(&self) -> &[InlinedFunction] {
+        &self.inlined
+    }
+
+    /// Formats the report as a JSON object, like:
+    ///
+    /// ```json
+    /// {
+    ///   "programs":[{"name":"my_prog","section":"kprobe/my_prog","instructions":120,
+    ///                "total_instructions":340,"stack_size":48,"max_stack_depth":160,
+    ///                "max_call_depth":3},...],
+    ///   "inlined":[{"name":"parse_header","instructions":96,"count":4},...]
+    /// }
+    /// ```
+    ///
+    /// The output is on a single line.
+    pub fn to_json(&self) -> String {
+        let mut json = String::from(r#"{"programs":["#);
+        for (i, program) in self.programs.iter().enumerate() {
+            let ProgramStats {
+                name,
+                section,
+                instructions,
+                total_instructions,
+                stack_size,
+                max_stack_depth,
+                max_call_depth,
+            } = program;
+            if i > 0 {
+                json.push(',');
+            }
+            write!(
+                json,
+                r#"{{"name":{},"section":{},"instructions":{instructions},"total_instructions":{total_instructions},"stack_size":{stack_size},"max_stack_depth":{max_stack_depth},"max_call_depth":{max_call_depth}}}"#,
+                JsonString(name),
+                JsonString(section),
+            )
+            .unwrap();
+        }
+        json.push_str(r#"],"inlined":["#);
+        for (i, function) in self.inlined.iter().enumerate() {
+            let InlinedFunction {
+                name,
+                instructions,
+                count,
+            } = function;
+            if i > 0 {
+                json.push(',');
+            }
+            write!(
+                json,
+                r#"{{"name":{},"instructions":{instructions},"count":{count}}}"#,
+                JsonString(name),
+            )
+            .unwrap();
+        }
+        json.push_str("]}");
+        json
+    }
+}
+
+/// Formats the report as tables, one row per program and per inlined function.
+impl fmt::Display for ProgramReport {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let Self { programs, inlined } = self;
+        let name_width = programs
+            .iter()
+            .map(|program| program.name.len())
+            .max()
+            .unwrap_or(0)
+            .max("program".len());
+        let section_width = programs
+            .iter()
+            .map(|program| program.section.len())
+            .max()
+            .unwrap_or(0)
+            .max("section".len());
+        writeln!(
+            f,
+            "{:name_width$}  {:section_width$}  {:>8}  {:>8}  {:>6}  {:>6}  {:>5}",
+            "program", "section", "insns", "total", "stack", "depth", "calls"
+        )?;
+        for program in programs {
+            let ProgramStats {
+                name,
+                section,
+                instructions,
+                total_instructions,
+                stack_size,
+                max_stack_depth,
+                max_call_depth,
+            } = program;
+            writeln!(
+                f,
+                "{name:name_width$}  {section:section_width$}  {instructions:>8}  {total_instructions:>8}  {stack_size:>6}  {max_stack_depth:>6}  {max_call_depth:>5}"
+            )?;
+        }
+        if !inlined.is_empty() {
+            writeln!(f)?;
+            writeln!(
+                f,
+                "{:>8}  {:>5}  largest inlined functions",
+                "insns", "count"
+            )?;
+            for InlinedFunction {
+                name,
+                instructions,
+                count,
+            } in inlined
+            {
+                writeln!(f, "{instructions:>8}  {count:>5}  {name}")?;
+            }
+        }
+        Ok(())
+    }
+}
+
+pub(crate) struct JsonString<'a>(pub(crate) &'a str);
+
+impl fmt::Display for JsonString<'_> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.write_char('"')?;
+        for c in self.0.chars() {
+            match c {
+                '"' => f.write_str(r#"\""#)?,
+                '\\' => f.write_str(r"\\")?,
+                c if c.is_control() => write!(f, "\\u{:04x}", u32::from(c))?,
+                c => f.write_char(c)?,
+            }
+        }
+        f.write_char('"')
+    }
+}
+
+/// A function of an object file.
+struct Function {
+    name: String,
+    section: SectionIndex,
+    /// The index of the first instruction of the function in its section.
+    start: u64,
+    code: FunctionCode,
+    /// The functions called, as indices in the functions of the file.
+    callees: Vec<usize>,
+}
+
+/// What's read from the instructions of a function.
+#[derive(Debug, Default, PartialEq, Eq)]
+struct FunctionCode {
+    instructions: u64,
+    stack_size: u64,
+    /// The calls to other functions of the program, as the index of the call instruction in the
+    /// function and its immediate.
+    calls: Vec<(u64, i32)>,
+}
+
+fn program_stats(file: &File<'_>) -> Result<Vec<ProgramStats>, LinkerError> {
+    let invalid = |err: object::Error| LinkerError::InvalidObject(err.to_string());
+    let little_endian = file.is_little_endian();
+
+    let mut functions = Vec::new();
+    let mut programs = Vec::new();
+    for symbol in file.symbols() {
+        if symbol.kind() != SymbolKind::Text || symbol.size() == 0 {
+            continue;
+        }
+        let Some(section) = symbol.section_index() else {
+            continue;
+        };
+        let section = file.section_by_index(section).map_err(invalid)?;
+        if section.kind() != SectionKind::Text {
+            continue;
+        }
+        let data = section.data().map_err(invalid)?;
+        let code = usize::try_from(symbol.address())
+            .ok()
+            .zip(usize::try_from(symbol.size()).ok())
+            .and_then(|(start, size)| data.get(start..start.checked_add(size)?))
+            .ok_or_else(|| {
+                LinkerError::InvalidObject(format!(
+                    "symbol {} is out of its section",
+                    symbol.name().unwrap_or_default()
+                ))
+            })?;
+        // Global functions outside of `.text` are programs, the others are the functions they
+        // call.
+        let section_name = section.name().map_err(invalid)?;
+        if symbol.is_global() && section_name != ".text" {
+            programs.push((functions.len(), section_name.to_owned()));
+        }
+        functions.push(Function {
+            name: symbol.name().map_err(invalid)?.to_owned(),
+            section: section.index(),
+            start: symbol.address() / INSN_SIZE,
+            code: function_code(code, little_endian),
+            callees: Vec::new(),
+        });
+    }
+
+    // Resolve the calls. Calls to functions of other sections, and to global functions, are
+    // relocated against their symbol, and the others are relative to the call.
+    let by_start = functions
+        .iter()
+        .enumerate()
+        .map(|(index, function)| ((function.section, function.start), index))
+        .collect::<HashMap<_, _>>();
+    let mut relocations = HashMap::new();
+    for function in &mut functions {
+        let Function {
+            section,
+            start,
+            code,
+            callees,
+            ..
+        } = function;
+        let relocations = match relocations.entry(*section) {
+            Entry::Occupied(entry) => entry.into_mut(),
+            Entry::Vacant(entry) => {
+                let section = file.section_by_index(*section).map_err(invalid)?;
+                entry.insert(
+                    section
+                        .relocations()
+                        .filter_map(|(offset, relocation)| match relocation.target() {
+                            RelocationTarget::Symbol(symbol) => Some((offset, symbol)),
+                            _ => None,
+                        })
+                        .collect::<HashMap<_, _>>(),
+                )
+            }
+        };
+        for &(index, imm) in &code.calls {
+            let pc = *start + index;
+            let target = match relocations.get(&(pc * INSN_SIZE)) {
+                Some(&symbol) => {
+                    let symbol = file.symbol_by_index(symbol).map_err(invalid)?;
+                    symbol
+                        .section_index()
+                        .map(|section| (section, symbol.address() / INSN_SIZE))
+                }
+                None => Some((*section, pc)),
+            };
+            let callee = target.and_then(|(section, base)| {
+                let target = base.checked_add_signed(i64::from(imm) + 1)?;
+                by_start.get(&(section, target))
+            });
+            callees.extend(callee);
+        }
+    }
+
+    Ok(programs
+        .into_iter()
+        .map(|(index, section)| {
+            let Function { name, code, .. } = &functions[index];
+            let mut reachable = HashSet::new();
+            let (max_stack_depth, max_call_depth) =
+                call_chain(&functions, index, &mut reachable, &mut Vec::new());
+            ProgramStats {
+                name: name.clone(),
+                section,
+                instructions: code.instructions,
+                total_instructions: reachable
+                    .iter()
+                    .map(|&index| functions[index].code.instructions)
+                    .sum(),
+                stack_size: code.stack_size,
+                max_stack_depth,
+                max_call_depth,
+            }
+        })
+        .collect())
+}
+
+// Returns the stack depth and the number of frames of the deepest call chain starting at
+// `index`, adding the functions it reaches to `reachable`. Recursive calls, which the verifier
+// rejects anyway, aren't followed.
+fn call_chain(
+    functions: &[Function],
+    index: usize,
+    reachable: &mut HashSet<usize>,
+    chain: &mut Vec<usize>,
+) -> (u64, u32) {
+    let _: bool = reachable.insert(index);
+    chain.push(index);
+    let Function { code, callees, .. } = &functions[index];
+    let (mut stack, mut frames) = (0, 0);
+    for &callee in callees {
+        if chain.contains(&callee) {
+            continue;
+        }
+        let (callee_stack, callee_frames) = call_chain(functions, callee, reachable, chain);
+        stack = stack.max(callee_stack);
+        frames = frames.max(callee_frames);
+    }
+    let _: Option<usize> = chain.pop();
+    let frame = code.stack_size.max(1).next_multiple_of(FRAME_ALIGN);
+    (frame + stack, frames + 1)
+}
+
+// Reads the instructions of a function: counts them, finds its calls, and estimates its stack
+// usage from the accesses relative to the frame pointer, following the registers it's copied to.
+fn function_code(code: &[u8], little_endian: bool) -> FunctionCode {
+    let mut function = FunctionCode::default();
+    // The offset of each register from the frame pointer, when it's known to point to the stack.
+    let mut frame_offsets = [None; 11];
+    let mut access = |frame_offsets: &[Option<i64>; 11], base: usize, offset: i16| {
+        if let Some(base) = frame_offsets.get(base).copied().flatten() {
+            let depth = -(base + i64::from(offset));
+            function.stack_size = function.stack_size.max(u64::try_from(depth).unwrap_or(0));
+        }
+    };
+
+    let mut instructions = code.chunks_exact(INSN_SIZE as usize).enumerate();
+    let mut calls = Vec::new();
+    let mut count = 0;
+    while let Some((index, insn)) = instructions.next() {
+        count += 1;
+        frame_offsets[BPF_REG_FP] = Some(0);
+        let opcode = insn[0];
+        let (dst, src) = if little_endian {
+            (insn[1] & 0xf, insn[1] >> 4)
+        } else {
+            (insn[1] >> 4, insn[1] & 0xf)
+        };
+        let (dst, src) = (usize::from(dst), usize::from(src));
+        let (offset, imm) = if little_endian {
+            (
+                i16::from_le_bytes([insn[2], insn[3]]),
+                i32::from_le_bytes([insn[4], insn[5], insn[6], insn[7]]),
+            )
+        } else {
+            (
+                i16::from_be_bytes([insn[2], insn[3]]),
+                i32::from_be_bytes([insn[4], insn[5], insn[6], insn[7]]),
+            )
+        };
+
+        match opcode {
+            BPF_LD_IMM64 => {
+                // The second half of the instruction.
+                let _: Option<_> = instructions.next();
+                count += 1;
+                set_offset(&mut frame_offsets, dst, None);
+            }
+            BPF_MOV64_REG => {
+                let offset = frame_offsets.get(src).copied().flatten();
+                set_offset(&mut frame_offsets, dst, offset);
+            }
+            BPF_ADD64_IMM | BPF_SUB64_IMM => {
+                let imm = i64::from(imm);
+                let offset = frame_offsets.get(dst).copied().flatten().map(|offset| {
+                    if opcode == BPF_ADD64_IMM {
+                        offset + imm
+                    } else {
+                        offset - imm
+                    }
+                });
+                set_offset(&mut frame_offsets, dst, offset);
+            }
+            BPF_CALL => {
+                if src == usize::from(BPF_PSEUDO_CALL) {
+                    calls.push((index as u64, imm));
+                }
+                // The arguments and the return value are clobbered.
+                frame_offsets[..=5].fill(None);
+            }
+            _ => match opcode & 0x07 {
+                BPF_LDX => {
+                    access(&frame_offsets, src, offset);
+                    set_offset(&mut frame_offsets, dst, None);
+                }
+                BPF_ST => access(&frame_offsets, dst, offset),
+                BPF_STX => {
+                    access(&frame_offsets, dst, offset);
+                    if opcode & 0xe0 == BPF_ATOMIC {
+                        // Atomic operations can fetch the old value into the source.
+                        set_offset(&mut frame_offsets, src, None);
+                        set_offset(&mut frame_offsets, 0, None);
+                    }
+                }
+                // Jumps don't write registers.
+                0x05 | 0x06 => {}
+                _ => set_offset(&mut frame_offsets, dst, None),
+            },
+        }
+    }
+    function.instructions = count;
+    function.calls = calls;
+    function
+}
+
+fn set_offset(frame_offsets: &mut [Option<i64>; 11], register: usize, offset: Option<i64>) {
+    if let Some(register) = frame_offsets.get_mut(register) {
+        *register = offset;
+    }
+}
+
+// Adds the instructions of the inlined functions described in the DWARF of `file` to `inlined`,
+// keyed by their linkage name, or name when they have none.
+fn inlined_functions(
+    file: &File<'_>,
+    inlined: &mut HashMap<String, InlinedFunction>,
+) -> Result<(), gimli::Error> {
+    let endian = if file.is_little_endian() {
+        RunTimeEndian::Little
+    } else {
+        RunTimeEndian::Big
+    };
+    let dwarf = Dwarf::load(|id: SectionId| -> Result<_, gimli::Error> {
+        let data = file
+            .section_by_name(id.name())
+            .and_then(|section| section.data().ok())
+            .unwrap_or_default();
+        Ok(EndianSlice::new(data, endian))
+    })?;
+
+    let mut units = dwarf.units();
+    while let Some(header) = units.next()? {
+        let unit = dwarf.unit(header)?;
+        let mut entries = unit.entries();
+        while let Some((_, entry)) = entries.next_dfs()? {
+            if entry.tag() != DW_TAG_inlined_subroutine {
+                continue;
+            }
+            let mut size = 0;
+            let mut ranges = dwarf.die_ranges(&unit, entry)?;
+            while let Some(range) = ranges.next()? {
+                size += range.end.saturating_sub(range.begin);
+            }
+            let Some((key, name)) = origin_name(&dwarf, &unit, entry)? else {
+                continue;
+            };
+            let function = inlined.entry(key).or_insert_with(|| InlinedFunction {
+                name,
+                instructions: 0,
+                count: 0,
+            });
+            function.instructions += size / INSN_SIZE;
+            function.count += 1;
+        }
+    }
+    Ok(())
+}
+
+type Reader<'data> = EndianSlice<'data, RunTimeEndian>;
+
+// Returns the linkage name, or name, and the name of the function an inlined subroutine is a copy
+// of.
+fn origin_name(
+    dwarf: &Dwarf<Reader<'_>>,
+    unit: &Unit<Reader<'_>>,
+    entry: &DebuggingInformationEntry<'_, '_, Reader<'_>>,
+) -> Result<Option<(String, String)>, gimli::Error> {
+    let mut origin = entry.attr_value(DW_AT_abstract_origin)?;
+    let mut linkage_name = None;
+    // The definitions of methods can refer to their declaration for their name.
+    for _ in 0..2 {
+        let Some(AttributeValue::UnitRef(offset)) = origin else {
+            break;
+        };
+        let entry = unit.entry(offset)?;
+        if linkage_name.is_none() {
+            if let Some(name) = entry.attr_value(DW_AT_linkage_name)? {
+                linkage_name = Some(
+                    dwarf
+                        .attr_string(unit, name)?
+                        .to_string_lossy()
+                        .into_owned(),
+                );
+            }
+        }
+        if let Some(name) = entry.attr_value(DW_AT_name)? {
+            let name = dwarf
+                .attr_string(unit, name)?
+                .to_string_lossy()
+                .into_owned();
+            return Ok(Some((linkage_name.unwrap_or_else(|| name.clone()), name)));
+        }
+        origin = entry.attr_value(DW_AT_specification)?;
+    }
+    Ok(None)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn insn(opcode: u8, dst: u8, src: u8, offset: i16, imm: i32) -> [u8; 8] {
+        let [o0, o1] = offset.to_le_bytes();
+        let [i0, i1, i2, i3] = imm.to_le_bytes();
+        [opcode, dst | (src << 4), o0, o1, i0, i1, i2, i3]
+    }
+
+    #[test]
+    fn test_function_code() {
+        let code = [
+            // *(u64 *)(r10 - 8) = r1
+            insn(0x7b, 10, 1, -8, 0),
+            // r1 = r10; r1 += -40; r2 = 0
+            insn(BPF_MOV64_REG, 1, 10, 0, 0),
+            insn(BPF_ADD64_IMM, 1, 0, 0, -40),
+            insn(0xb7, 2, 0, 0, 0),
+            // *(u32 *)(r1 + 4) = r2, 36 bytes below the frame pointer
+            insn(0x63, 1, 2, 4, 0),
+            // r1 = 1 ll
+            insn(BPF_LD_IMM64, 1, 0, 0, 1),
+            insn(0, 0, 0, 0, 0),
+            // call helper 1; call the function 2 instructions ahead
+            insn(BPF_CALL, 0, 0, 0, 1),
+            insn(BPF_CALL, 0, BPF_PSEUDO_CALL, 0, 2),
+            // r1 is clobbered by the call
+            insn(0x7b, 1, 2, -64, 0),
+            // exit
+            insn(0x95, 0, 0, 0, 0),
+        ];
+        assert_eq!(
+            function_code(code.as_flattened(), true),
+            FunctionCode {
+                instructions: 11,
+                stack_size: 36,
+                calls: vec![(8, 2)],
+            }
+        );
+    }
+
+    #[test]
+    fn test_json() {
+        let report = ProgramReport {
+            programs: vec![ProgramStats {
+                name: "prog".to_owned(),
+                section: "kprobe/prog".to_owned(),
+                instructions: 10,
+                total_instructions: 30,
+                stack_size: 8,
+                max_stack_depth: 64,
+                max_call_depth: 2,
+            }],
+            inlined: vec![InlinedFunction {
+                name: "<T as \"quoted\">::f".to_owned(),
+                instructions: 4,
+                count: 2,
+            }],
+        };
+        assert_eq!(
+            report.to_json(),
+            r#"{"programs":[{"name":"prog","section":"kprobe/prog","instructions":10,"total_instructions":30,"stack_size":8,"max_stack_depth":64,"max_call_depth":2}],"inlined":[{"name":"<T as \"quoted\">::f","instructions":4,"count":2}]}"#
+        );
+    }
+}
@@ -0,0 +1,379 @@
+use std::{
+    fmt::Write as _,
+    mem,
+    sync::Mutex,
+    time::{Duration, Instant},
+};
+
+use crate::llvm::{self, LLVMModule};
+
+/// A phase of a link whose duration is measured.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub(crate) enum Phase {
+    /// The whole link, including all the phases below.
+    Total,
+    /// Opening and mapping the input files.
+    OpenInputs,
+    /// Detecting the type of the inputs and of the archive members.
+    DetectInputType,
+    /// Reading archives and their symbol index.
+    ReadArchives,
+    /// Extracting the bitcode embedded in object files.
+    ExtractBitcode,
+    /// Summarizing the symbols the inputs define and need, to link the programs separately.
+    SummarizeInputs,
+    /// Parsing bitcode into modules.
+    ParseBitcode,
+    /// Linking modules together. In lazy load mode, this includes parsing the bitcode.
+    LinkModules,
+    /// Sanitizing the debug information for BTF.
+    SanitizeDebugInfo,
+    /// Stripping the debug information.
+    StripDebugInfo,
+    /// Removing the debug information of the globals that aren't programs or maps.
+    PruneDebugInfo,
+    /// Internalizing the symbols that aren't exported, and removing the unreferenced ones.
+    Internalize,
+    /// Optimizing and generating the code of the variants of [`crate::OptLevel::Auto`].
+    ExploreOptLevels,
+    /// Running the optimization passes.
+    RunPasses,
+    /// Generating the output.
+    Codegen,
+}
+
+impl Phase {
+    const ALL: [Self; 15] = [
+        Self::Total,
+        Self::OpenInputs,
+        Self::DetectInputType,
+        Self::ReadArchives,
+        Self::ExtractBitcode,
+        Self::SummarizeInputs,
+        Self::ParseBitcode,
+        Self::LinkModules,
+        Self::SanitizeDebugInfo,
+        Self::StripDebugInfo,
+        Self::PruneDebugInfo,
+        Self::Internalize,
+        Self::ExploreOptLevels,
+        Self::RunPasses,
+        Self::Codegen,
+    ];
+
+    const fn name(self) -> &'static str {
+        match self {
+            Self::Total => "total",
+            Self::OpenInputs => "open_inputs",
+            Self::DetectInputType => "detect_input_type",
+            Self::ReadArchives => "read_archives",
+            Self::ExtractBitcode => "extract_bitcode",
+            Self::SummarizeInputs => "summarize_inputs",
+            Self::ParseBitcode => "parse_bitcode",
+            Self::LinkModules => "link_modules",
+            Self::SanitizeDebugInfo => "sanitize_debug_info",
+            Self::StripDebugInfo => "strip_debug_info",
+            Self::PruneDebugInfo => "prune_debug_info",
+            Self::Internalize => "internalize",
+            Self::ExploreOptLevels => "explore_opt_levels",
+            Self::RunPasses => "run_passes",
+            Self::Codegen => "codegen",
+        }
+    }
+}
+
+/// A point of the pipeline where the size of the module is measured.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub(crate) enum Stage {
+    /// All the inputs have been linked.
+    Linked,
+    /// The unreferenced symbols have been removed and the debug information sanitized or
+    /// stripped.
+    DebugInfo,
+    /// The module has been optimized.
+    Optimized,
+}
+
+impl Stage {
+    const fn name(self) -> &'static str {
+        match self {
+            Self::Linked => "linked",
+            Self::DebugInfo => "debug_info",
+            Self::Optimized => "optimized",
+        }
+    }
+}
+
+/// Accumulates the time spent in each [`Phase`] of the links done by a linker, and the size of
+/// the module at each [`Stage`].
+///
+/// Timings can be recorded from any thread. Phases running on several threads at once, like the
+/// extraction of archive members, accumulate the time spent on every thread, so they can add up
+/// to more than the total.
+pub(crate) struct Timings {
+    state: Option<Mutex<State>>,
+}
+
+struct State {
+    phases: [PhaseTime; Phase::ALL.len()],
+    stages: Vec<StageStats>,
+}
+
+impl Timings {
+    pub(crate) fn new(enabled: bool) -> Self {
+        Self {
+            state: enabled.then(|| {
+                Mutex::new(State {
+                    phases: Phase::ALL.map(|phase| PhaseTime {
+                        name: phase.name(),
+                        count: 0,
+                        duration: Duration::ZERO,
+                    }),
+                    stages: Vec::new(),
+                })
+            }),
+        }
+    }
+
+    /// Starts timing `phase`. The time is recorded when the returned timer is dropped.
+    pub(crate) fn start(&self, phase: Phase) -> Timer<'_> {
+        Timer {
+            timings: self,
+            phase,
+            start: self.state.as_ref().map(|_| Instant::now()),
+        }
+    }
+
+    /// Runs `f`, recording the time it takes as spent in `phase`.
+    pub(crate) fn time<T, F>(&self, phase: Phase, f: F) -> T
+    where
+        F: FnOnce() -> T,
+    {
+        let _timer = self.start(phase);
+        f()
+    }
+
+    /// Records the size of `module` at `stage`, along with the peak memory usage so far.
+    ///
+    /// Walks the whole module, so it's only done when the timings are enabled.
+    pub(crate) fn record_stage(&self, stage: Stage, module: &LLVMModule<'_>) {
+        let Some(state) = &self.state else {
+            return;
+        };
+        let module = llvm::module_stats(module);
+        let stats = StageStats {
+            stage: stage.name(),
+            module,
+            peak_rss: peak_rss(),
+        };
+        state.lock().unwrap().stages.push(stats);
+    }
+
+    /// Returns the timings recorded so far, and resets them.
+    pub(crate) fn take(&self) -> TimeReport {
+        let Some(state) = &self.state else {
+            return TimeReport::default();
+        };
+        let mut state = state.lock().unwrap();
+        let State { phases, stages } = &mut *state;
+        let report = TimeReport {
+            phases: phases.to_vec(),
+            stages: mem::take(stages),
+        };
+        for phase in phases {
+            phase.count = 0;
+            phase.duration = Duration::ZERO;
+        }
+        report
+    }
+}
+
+// Returns the peak resident set size of the process, in bytes.
+fn peak_rss() -> u64 {
+    let mut usage: libc::rusage = unsafe { mem::zeroed() };
+    if unsafe { libc::getrusage(libc::RUSAGE_SELF, &mut usage) } != 0 {
+        return 0;
+    }
+    let max_rss = u64::try_from(usage.ru_maxrss).unwrap_or(0);
+    // macOS reports bytes, the other unices kilobytes.
+    if cfg!(target_os = "macos") {
+        max_rss
+    } else {
+        max_rss * 1024
+    }
+}
+
+/// Records the time spent in a phase when dropped. See [`Timings::start`].
+pub(crate) struct Timer<'t> {
+    timings: &'t Timings,
+    phase: Phase,
+    start: Option<Instant>,
+}
+
+impl Drop for Timer<'_> {
+    fn drop(&mut self) {
+        let Self {
+            timings,
+            phase,
+            start,
+        } = self;
+        if let (Some(state), Some(start)) = (&timings.state, start) {
+            let elapsed = start.elapsed();
+            let PhaseTime {
+                count, duration, ..
+            } = &mut state.lock().unwrap().phases[*phase as usize];
+            *count += 1;
+            *duration += elapsed;
+        }
+    }
+}
+
+/// The time spent in a phase of the link.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct PhaseTime {
+    /// The name of the phase, like `parse_bitcode` or `run_passes`.
+    pub name: &'static str,
+    /// The number of times the phase was entered.
+    pub count: u64,
+    /// The time spent in the phase.
+    pub duration: Duration,
+}
+
+/// The number of entities in a module.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct ModuleStats {
+    /// The number of functions, including declarations.
+    pub functions: u64,
+    /// The number of global variables, including declarations.
+    pub globals: u64,
+    /// The number of basic blocks.
+    pub basic_blocks: u64,
+    /// The number of instructions.
+    pub instructions: u64,
+    /// The number of distinct metadata nodes reachable from the named metadata, the globals, the
+    /// functions and their instructions.
+    pub metadata_nodes: u64,
+}
+
+/// The size of the module at a stage of the link.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct StageStats {
+    /// The name of the stage: `linked`, `debug_info` or `optimized`.
+    pub stage: &'static str,
+    /// The size of the module at the end of the stage.
+    pub module: ModuleStats,
+    /// The peak resident set size of the process at the end of the stage, in bytes.
+    pub peak_rss: u64,
+}
+
+/// The time spent in each phase of the links done since the report was last taken, and the size
+/// of the modules at each stage. See [`crate::Linker::set_time_report`].
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct TimeReport {
+    phases: Vec<PhaseTime>,
+    stages: Vec<StageStats>,
+}
+
+impl TimeReport {
+    /// Returns the time spent in each phase. The first phase is `total`, the time spent in the
+    /// link methods of the linker.
+    pub fn phases(&self) -> &[PhaseTime] {
+        &self.phases
+    }
+
+    /// Returns the size of the modules at each stage, in the order the stages were reached. A
+    /// link reaches each stage once, except when it produces several outputs.
+    pub fn stages(&self) -> &[StageStats] {
+        &self.stages
+    }
+
+    /// Formats the report as a JSON object, like:
+    ///
+    /// ```json
+    /// {
+    ///   "phases":[{"name":"total","count":1,"seconds":0.123456},...],
+    ///   "stages":[{"stage":"linked","functions":12,"globals":3,"basic_blocks":40,
+    ///              "instructions":210,"metadata_nodes":96,"peak_rss":31457280},...]
+    /// }
+    /// ```
+    ///
+    /// The output is on a single line.
+    pub fn to_json(&self) -> String {
+        let mut json = String::from(r#"{"phases":["#);
+        for (i, phase) in self.phases.iter().enumerate() {
+            let PhaseTime {
+                name,
+                count,
+                duration,
+            } = phase;
+            if i > 0 {
+                json.push(',');
+            }
+            // Phase names are plain identifiers, they never need escaping.
+            write!(
+                json,
+                r#"{{"name":"{name}","count":{count},"seconds":{:.6}}}"#,
+                duration.as_secs_f64()
+            )
+            .unwrap();
+        }
+        json.push_str(r#"],"stages":["#);
+        for (i, stats) in self.stages.iter().enumerate() {
+            let StageStats {
+                stage,
+                module:
+                    ModuleStats {
+                        functions,
+                        globals,
+                        basic_blocks,
+                        instructions,
+                        metadata_nodes,
+                    },
+                peak_rss,
+            } = stats;
+            if i > 0 {
+                json.push(',');
+            }
+            write!(
+                json,
+                r#"{{"stage":"{stage}","functions":{functions},"globals":{globals},"basic_blocks":{basic_blocks},"instructions":{instructions},"metadata_nodes":{metadata_nodes},"peak_rss":{peak_rss}}}"#,
+            )
+            .unwrap();
+        }
+        json.push_str("]}");
+        json
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_time_report() {
+        let timings = Timings::new(true);
+        timings.time(Phase::ParseBitcode, || ());
+        {
+            let _timer = timings.start(Phase::ParseBitcode);
+        }
+
+        let report = timings.take();
+        assert_eq!(report.phases().len(), Phase::ALL.len());
+        let parse = report
+            .phases()
+            .iter()
+            .find(|phase| phase.name == "parse_bitcode")
+            .unwrap();
+        assert_eq!(parse.count, 2);
+
+        let json = report.to_json();
+        assert!(json.starts_with(r#"{"phases":[{"name":"total","count":0,"seconds":0.000000},"#));
+        assert!(json.contains(r#"{"name":"parse_bitcode","count":2,"seconds":"#));
+        assert!(json.ends_with(r#"],"stages":[]}"#));
+
+        // Taking the report resets the timings.
+        assert!(timings.take().phases().iter().all(|phase| phase.count == 0));
+
+        assert_eq!(Timings::new(false).take(), TimeReport::default());
+    }
+}
@@ -0,0 +1,23 @@
+// assembly-output: bpf-linker
+// compile-flags: --crate-type cdylib -C link-arg=target/bitcode/libarchive.a
+
+// Like with a traditional static linker, only the archive members defining a needed symbol
+// are linked.
+#![no_std]
+
+// aux-build: loop-panic-handler.rs
+extern crate loop_panic_handler;
+
+extern "C" {
+    fn archive_used() -> u32;
+}
+
+#[no_mangle]
+#[link_section = "uprobe/connect"]
+pub fn connect() -> u32 {
+    unsafe { archive_used() }
+}
+
+// CHECK-NOT: archive_unused_member
+// CHECK: r0 = 1337
+// CHECK-NOT: archive_unused_member
@@ -0,0 +1,21 @@
+// assembly-output: bpf-linker
+// compile-flags: --crate-type cdylib -C link-arg=target/bitcode/libbundle.bundle -C link-arg=target/bitcode/libarchive.a
+
+// The definitions pulled from a bundle can need archive members, which can need more of the
+// bundle. Verify that the bundle and the archive are searched until neither provides anything.
+#![no_std]
+
+// aux-build: loop-panic-handler.rs
+extern crate loop_panic_handler;
+
+extern "C" {
+    fn bundle_entry() -> u32;
+}
+
+#[no_mangle]
+#[link_section = "uprobe/connect"]
+pub fn connect() -> u32 {
+    unsafe { bundle_entry() }
+}
+
+// CHECK: r0 = 1338
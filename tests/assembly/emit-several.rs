@@ -0,0 +1,21 @@
+// assembly-output: bpf-linker
+// compile-flags: --crate-type cdylib -C link-arg=--emit=obj
+
+// With several --emit, the link is optimized once and the code of each output type is generated
+// from it. Verify that asking for an object along with the assembly still writes the assembly,
+// to the output path, the object going next to it.
+#![no_std]
+
+// aux-build: loop-panic-handler.rs
+extern crate loop_panic_handler;
+
+#[no_mangle]
+#[link_section = "uprobe/connect"]
+pub fn connect() -> u32 {
+    42
+}
+
+// CHECK: .section "uprobe/connect","ax"
+// CHECK: connect:
+// CHECK: r0 = 42
+// CHECK: exit
@@ -0,0 +1,25 @@
+// assembly-output: bpf-linker
+// compile-flags: --crate-type cdylib -C link-arg=--lazy-load -C link-arg=target/bitcode/weak.bc
+
+// With --lazy-load, symbols still resolve like with a traditional linker. Verify that the strong
+// definition of `weak_helper` is kept over the weak one of tests/c/weak.c, whatever the order in
+// which the inputs are linked.
+#![no_std]
+
+// aux-build: loop-panic-handler.rs
+extern crate loop_panic_handler;
+
+#[no_mangle]
+pub extern "C" fn weak_helper() -> u32 {
+    42
+}
+
+#[no_mangle]
+#[link_section = "uprobe/connect"]
+pub fn connect() -> u32 {
+    weak_helper()
+}
+
+// CHECK-NOT: r0 = 7
+// CHECK: r0 = 42
+// CHECK-NOT: r0 = 7
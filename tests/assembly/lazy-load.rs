@@ -0,0 +1,30 @@
+// assembly-output: bpf-linker
+// compile-flags: --crate-type cdylib -C link-arg=--lazy-load
+
+// With --lazy-load, only the code reachable from the exported symbols is materialized. Verify that
+// exported programs and maps of all the crates are still linked, and that calls into dependencies
+// get resolved.
+#![no_std]
+
+// aux-build: loop-panic-handler.rs
+extern crate loop_panic_handler;
+
+// aux-build: dep-section.rs
+extern crate dep_section;
+
+// aux-build: dep-exports.rs
+extern crate dep_exports as dep;
+
+#[no_mangle]
+#[link_section = "uprobe/connect"]
+pub fn connect() -> u8 {
+    dep::dep_public_symbol()
+}
+
+#[no_mangle]
+#[link_section = "maps/counter"]
+static mut COUNTER: u32 = 0;
+
+// CHECK: .section "uprobe/connect","ax"
+// CHECK: .section "uprobe/dep","ax"
+// CHECK: .section "maps/counter","aw"
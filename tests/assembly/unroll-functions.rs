@@ -0,0 +1,30 @@
+// assembly-output: bpf-linker
+// compile-flags: --crate-type cdylib -C link-arg=--unroll-loops -C link-arg=--unroll-function=unrolled -C link-arg=-O3
+#![no_std]
+// With --unroll-function, only the loops of the given functions are unrolled, the others keep
+// the default thresholds.
+
+// aux-build: loop-panic-handler.rs
+extern crate loop_panic_handler;
+
+#[no_mangle]
+fn unrolled(arg: &mut u64) {
+    for i in 0..=200 {
+        *arg += *arg + i;
+    }
+}
+
+#[no_mangle]
+fn rolled(arg: &mut u64) {
+    for i in 0..=200 {
+        *arg += *arg + i;
+    }
+}
+
+// CHECK-LABEL: unrolled:
+// CHECK: r{{[1-9]}} += 200
+// CHECK-NOT: goto LBB
+// CHECK: exit
+
+// CHECK-LABEL: rolled:
+// CHECK: goto LBB
@@ -0,0 +1,67 @@
+// assembly-output: bpf-linker
+// compile-flags: --crate-type cdylib -C link-arg=--emit=obj -C link-arg=--btf -C debuginfo=2
+
+// Structures with the same name and layout are emitted once each when the types of their
+// members differ, like arrays of different elements or enums of different variants.
+
+#![no_std]
+
+mod a {
+    pub struct Pair {
+        pub value: [u32; 2],
+    }
+
+    pub enum Kind {
+        Read,
+        Write,
+    }
+
+    pub struct Event {
+        pub kind: Kind,
+    }
+}
+
+mod b {
+    pub struct Pair {
+        pub value: [u16; 4],
+    }
+
+    pub enum Kind {
+        Open,
+        Close,
+    }
+
+    pub struct Event {
+        pub kind: Kind,
+    }
+}
+
+#[no_mangle]
+#[link_section = "maps"]
+static mut PAIR_A: a::Pair = a::Pair { value: [0; 2] };
+
+#[no_mangle]
+#[link_section = "maps"]
+static mut PAIR_B: b::Pair = b::Pair { value: [0; 4] };
+
+#[no_mangle]
+#[link_section = "maps"]
+static mut EVENT_A: a::Event = a::Event {
+    kind: a::Kind::Read,
+};
+
+#[no_mangle]
+#[link_section = "maps"]
+static mut EVENT_B: b::Event = b::Event {
+    kind: b::Kind::Open,
+};
+
+#[panic_handler]
+fn panic(_info: &core::panic::PanicInfo) -> ! {
+    loop {}
+}
+
+// CHECK-DAG: <STRUCT> 'Pair' sz:8 n:1
+// CHECK-DAG: <STRUCT> 'Pair' sz:8 n:1
+// CHECK-DAG: <STRUCT> 'Event' sz:1 n:1
+// CHECK-DAG: <STRUCT> 'Event' sz:1 n:1
@@ -0,0 +1,42 @@
+// assembly-output: bpf-linker
+// no-prefer-dynamic
+// compile-flags: --crate-type bin -C link-arg=--emit=obj -C link-arg=--btf -C link-arg=--prune-btf -C debuginfo=2
+
+// With --prune-btf, only the BTF of the programs and the maps is emitted: the private statics
+// and their types are dropped.
+
+#![no_std]
+#![no_main]
+
+pub struct Kept {
+    pub value: u32,
+}
+
+pub struct Pruned {
+    pub value: u64,
+}
+
+#[no_mangle]
+#[link_section = "maps"]
+static mut KEPT_MAP: Kept = Kept { value: 0 };
+
+static PRUNED_STATIC: Pruned = Pruned { value: 1 };
+
+#[no_mangle]
+#[link_section = "uprobe/connect"]
+pub fn connect() -> u64 {
+    unsafe { core::ptr::read_volatile(&PRUNED_STATIC.value) }
+}
+
+#[panic_handler]
+fn panic(_info: &core::panic::PanicInfo) -> ! {
+    loop {}
+}
+
+// CHECK-NOT: Pruned
+// CHECK-NOT: PRUNED_STATIC
+// CHECK-DAG: <STRUCT> 'Kept' sz:4 n:1
+// CHECK-DAG: <VAR> 'KEPT_MAP'
+// CHECK-DAG: <FUNC> 'connect' --> global
+// CHECK-NOT: Pruned
+// CHECK-NOT: PRUNED_STATIC
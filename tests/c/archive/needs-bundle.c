@@ -0,0 +1,6 @@
+/**
+ * An archive member needed by a bundled function, and needing another one.
+ */
+unsigned int bundle_leaf(void);
+
+unsigned int archive_needs_bundle(void) { return bundle_leaf(); }
@@ -0,0 +1,7 @@
+/**
+ * An archive member defining nothing the tests linking the archive need. Its module assembly
+ * ends up in the output if it gets linked anyway.
+ */
+asm("# archive_unused_member");
+
+unsigned int archive_unused(void) { return 7; }
@@ -0,0 +1,4 @@
+/**
+ * An archive member defining a symbol the tests linking the archive need.
+ */
+unsigned int archive_used(void) { return 1337; }
@@ -0,0 +1,7 @@
+/**
+ * A bundled function needing a member of tests/c/archive, which itself needs another bundled
+ * function.
+ */
+unsigned int archive_needs_bundle(void);
+
+unsigned int bundle_entry(void) { return archive_needs_bundle() + 1; }
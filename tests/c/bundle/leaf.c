@@ -0,0 +1,4 @@
+/**
+ * A bundled function only needed by a member of tests/c/archive.
+ */
+unsigned int bundle_leaf(void) { return 1337; }
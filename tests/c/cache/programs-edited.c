@@ -0,0 +1,13 @@
+/**
+ * Two programs linked with --split-programs and a link cache. programs-edited.c moves the first
+ * program down a few lines and changes the type of the global of the second program.
+ */
+static volatile long second_value = 2;
+
+/*
+ * The lines above the first program changed, which only its debug info refers to.
+ */
+
+__attribute__((section("uprobe/first"))) int first(void) { return 1; }
+
+__attribute__((section("uprobe/second"))) int second(void) { return second_value; }
@@ -0,0 +1,8 @@
+/**
+ * Two programs sharing a helper, split by --split-programs.
+ */
+static __attribute__((noinline)) int helper(int x) { return x * 3; }
+
+__attribute__((section("uprobe/first"))) int first(void) { return helper(1); }
+
+__attribute__((section("uprobe/second"))) int second(void) { return 2; }
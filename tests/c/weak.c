@@ -0,0 +1,4 @@
+/**
+ * A weak definition, overridden by the strong definition of the tests linking it.
+ */
+__attribute__((weak)) unsigned int weak_helper(void) { return 7; }
@@ -0,0 +1,21 @@
+// assembly-output: bpf-linker
+// compile-flags: --crate-type cdylib
+
+// Linked by the linker server after or before program.rs, reusing the modules parsed for it.
+#![no_std]
+
+// aux-build: loop-panic-handler.rs
+extern crate loop_panic_handler;
+
+#[no_mangle]
+#[link_section = "maps/counter"]
+static mut COUNTER: u32 = 0;
+
+#[no_mangle]
+#[link_section = "uprobe/count"]
+pub fn count() -> u32 {
+    unsafe { *core::ptr::addr_of!(COUNTER) }
+}
+
+// CHECK: .section "uprobe/count","ax"
+// CHECK: .section "maps/counter","aw"
@@ -0,0 +1,17 @@
+// assembly-output: bpf-linker
+// compile-flags: --crate-type cdylib
+
+// Linked by the linker server, like all the tests in this directory.
+#![no_std]
+
+// aux-build: loop-panic-handler.rs
+extern crate loop_panic_handler;
+
+#[no_mangle]
+#[link_section = "uprobe/connect"]
+pub fn connect() -> u32 {
+    42
+}
+
+// CHECK: .section "uprobe/connect","ax"
+// CHECK: r0 = 42
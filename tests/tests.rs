@@ -3,11 +3,16 @@
 use std::{
     env,
     ffi::{OsStr, OsString},
-    fs,
+    fs, io,
     path::{Path, PathBuf},
-    process::Command,
+    process::{Child, Command},
+    sync::Arc,
+    thread,
+    time::Duration,
 };
 
+use bpf_linker::{Cpu, Linker, LinkerInput, LinkerOptions, OptLevel, OutputType, Pipeline};
+
 fn rustc_cmd() -> Command {
     Command::new(env::var_os("RUSTC").unwrap_or_else(|| OsString::from("rustc")))
 }
@@ -70,7 +75,6 @@ where
     }
 }
 
-/// Compiles C code into an LLVM bitcode file.
 fn clang_build<P>(src: P, dst: P)
 where
     P: AsRef<Path>,
@@ -98,6 +102,232 @@ where
     }
 }
 
+/// Compiles the C files in `src_dir` into LLVM bitcode files next to `dst`, the archive or
+/// bundle made of them, and returns their paths in order.
+fn bitcode_members(src_dir: &Path, dst: &Path) -> Vec<PathBuf> {
+    let members_dir = dst.with_extension("d");
+    build_bitcode(src_dir, members_dir.as_path());
+    let mut members = fs::read_dir(&members_dir)
+        .expect("failed to read the directory")
+        .map(|entry| entry.expect("failed to read the entry").path())
+        .collect::<Vec<_>>();
+    members.sort();
+    members
+}
+
+/// Builds an archive of the LLVM bitcode files compiled from the C files in `src_dir`.
+fn build_archive<P>(src_dir: P, dst: P)
+where
+    P: AsRef<Path>,
+{
+    let dst = dst.as_ref();
+    let members = bitcode_members(src_dir.as_ref(), dst);
+
+    let llvm_ar = find_binary(r"^llvm-ar(-\d+)?$");
+    let output = Command::new(llvm_ar)
+        .arg("rcs")
+        .arg(dst)
+        .args(&members)
+        .output()
+        .expect("failed to execute llvm-ar");
+
+    if !output.status.success() {
+        panic!(
+            "llvm-ar failed with code {:?}\nstdout: {}\nstderr: {}",
+            output.status.code(),
+            String::from_utf8_lossy(&output.stdout),
+            String::from_utf8_lossy(&output.stderr)
+        );
+    }
+}
+
+/// Builds a bundle of the LLVM bitcode files compiled from the C files in `src_dir`.
+fn build_bundle<P>(src_dir: P, dst: P)
+where
+    P: AsRef<Path>,
+{
+    let dst = dst.as_ref();
+    let members = bitcode_members(src_dir.as_ref(), dst);
+
+    let mut linker = Command::new(env!("CARGO_BIN_EXE_bpf-linker"));
+    let status = linker
+        .arg("--bundle")
+        .arg("-o")
+        .arg(dst)
+        .args(&members)
+        .status()
+        .unwrap_or_else(|err| panic!("could not run {linker:?}: {err}"));
+    assert_eq!(status.code(), Some(0), "{linker:?} failed");
+}
+
+/// A linker server started by [`LinkerServer::start`], killed when dropped.
+struct LinkerServer(Child);
+
+impl LinkerServer {
+    /// Starts a linker server listening on `socket`, writing its debug logs to `log`.
+    fn start(socket: &Path, log: &Path) -> Self {
+        match fs::remove_file(socket) {
+            Ok(()) => {}
+            Err(err) if err.kind() == io::ErrorKind::NotFound => {}
+            Err(err) => panic!("could not remove '{}': {err}", socket.display()),
+        }
+        let log = fs::File::create(log)
+            .unwrap_or_else(|err| panic!("could not open log file '{}': {err}", log.display()));
+        let mut server = Command::new(env!("CARGO_BIN_EXE_bpf-linker"));
+        let child = server
+            .arg("--log-level")
+            .arg("debug")
+            .arg("--serve")
+            .arg(socket)
+            .stderr(log)
+            .spawn()
+            .unwrap_or_else(|err| panic!("could not run {server:?}: {err}"));
+        let server = Self(child);
+        for _ in 0..100 {
+            if socket.exists() {
+                return server;
+            }
+            thread::sleep(Duration::from_millis(100));
+        }
+        panic!("the linker server didn't listen on '{}'", socket.display());
+    }
+}
+
+impl Drop for LinkerServer {
+    fn drop(&mut self) {
+        let Self(child) = self;
+        let _: io::Result<()> = child.kill();
+        let _: io::Result<_> = child.wait();
+    }
+}
+
+/// Links the programs of `target/bitcode/programs.bc` with `--split-programs` and `args`, and
+/// checks that each of them is written to its own file, with only its own code.
+fn split_programs(root_dir: &Path, name: &str, args: &[&str]) {
+    let output = root_dir.join("target/split-programs").join(name);
+    let _: io::Result<()> = fs::remove_dir_all(&output);
+    let mut linker = Command::new(env!("CARGO_BIN_EXE_bpf-linker"));
+    let status = linker
+        .arg("--export")
+        .arg("first,second")
+        .arg("--emit")
+        .arg("asm")
+        .arg("--split-programs")
+        .args(args)
+        .arg("-o")
+        .arg(&output)
+        .arg(root_dir.join("target/bitcode/programs.bc"))
+        .status()
+        .unwrap_or_else(|err| panic!("could not run {linker:?}: {err}"));
+    assert_eq!(status.code(), Some(0), "{linker:?} failed");
+
+    for (program, other) in [("first", "second"), ("second", "first")] {
+        let path = output.join(program).with_extension("s");
+        let asm = fs::read_to_string(&path)
+            .unwrap_or_else(|err| panic!("could not read '{}': {err}", path.display()));
+        assert!(
+            asm.contains(&format!("{program}:")),
+            "{program} missing:\n{asm}"
+        );
+        assert!(
+            !asm.contains(&format!("{other}:")),
+            "{other} not split:\n{asm}"
+        );
+    }
+}
+
+/// Links the programs of `tests/c/cache/programs.c` with `--split-programs` and a link cache,
+/// then the programs of `programs-edited.c`, and checks that only the edited program missed the
+/// cache.
+fn program_cache(root_dir: &Path) {
+    let dir = root_dir.join("target/program-cache");
+    let _: io::Result<()> = fs::remove_dir_all(&dir);
+    fs::create_dir_all(&dir).expect("failed to create a build directory for the program cache");
+
+    // Both versions are compiled from the same path, which their debug info refers to.
+    let source = dir.join("programs.c");
+    let mut logs = Vec::new();
+    for name in ["programs", "programs-edited"] {
+        let original = root_dir
+            .join("tests/c/cache")
+            .join(name)
+            .with_extension("c");
+        let _: u64 = fs::copy(&original, &source)
+            .unwrap_or_else(|err| panic!("could not copy '{}': {err}", original.display()));
+        let bitcode = dir.join(name).with_extension("bc");
+        clang_build(source.clone(), bitcode.clone());
+        let mut linker = Command::new(env!("CARGO_BIN_EXE_bpf-linker"));
+        let output = linker
+            .arg("--log-level")
+            .arg("info")
+            .arg("--export")
+            .arg("first,second")
+            .arg("--emit")
+            .arg("obj")
+            .arg("--split-programs")
+            .arg("--cache-dir")
+            .arg(dir.join("cache"))
+            .arg("-o")
+            .arg(dir.join(name))
+            .arg(&bitcode)
+            .output()
+            .unwrap_or_else(|err| panic!("could not run {linker:?}: {err}"));
+        let log = String::from_utf8_lossy(&output.stderr).into_owned();
+        assert!(output.status.success(), "{linker:?} failed:\n{log}");
+        logs.push(log);
+    }
+
+    let edited = &logs[1];
+    assert_eq!(
+        edited.matches("link cache hit").count(),
+        1,
+        "the unchanged program missed the cache:\n{edited}"
+    );
+    assert_eq!(
+        edited.matches("link cache miss").count(),
+        1,
+        "the edited program hit the cache:\n{edited}"
+    );
+}
+
+/// Links `target/bitcode/programs.bc` from a shared buffer, with an input that doesn't borrow
+/// anything.
+fn link_shared_buffer(root_dir: &Path) {
+    let path = root_dir.join("target/bitcode/programs.bc");
+    let bytes: Arc<[u8]> = fs::read(&path)
+        .unwrap_or_else(|err| panic!("could not read '{}': {err}", path.display()))
+        .into();
+    let input: LinkerInput<'static> = LinkerInput::new_from_shared_buffer("programs", bytes);
+
+    let linker = Linker::try_new(LinkerOptions {
+        target: None,
+        cpu: Cpu::Generic,
+        cpu_features: Default::default(),
+        optimize: OptLevel::Default,
+        pipeline: Pipeline::Default,
+        unroll_loops: false,
+        unroll_functions: Vec::new(),
+        unroll_budget: None,
+        ignore_inline_never: false,
+        llvm_args: Vec::new(),
+        disable_expand_memcpy_in_order: false,
+        disable_memory_builtins: false,
+        btf: false,
+        prune_btf: false,
+        allow_bpf_trap: false,
+        lazy_load: false,
+        thin_link: false,
+        remarks: None,
+    })
+    .expect("failed to create the linker");
+    let output = linker
+        .link_to_buffer([input], OutputType::Assembly, ["first", "second"])
+        .expect("failed to link from a shared buffer");
+    let asm = String::from_utf8_lossy(output.as_slice());
+    assert!(asm.contains("first:"), "first missing:\n{asm}");
+    assert!(asm.contains("second:"), "second missing:\n{asm}");
+}
+
 fn is_nightly() -> bool {
     let output = rustc_cmd()
         .arg("--version")
@@ -158,6 +388,18 @@ fn compile_test() {
     let bpf_sysroot = bpf_sysroot(target, root_dir);
 
     build_bitcode(root_dir.join("tests/c"), root_dir.join("target/bitcode"));
+    build_archive(
+        root_dir.join("tests/c/archive"),
+        root_dir.join("target/bitcode/libarchive.a"),
+    );
+    build_bundle(
+        root_dir.join("tests/c/bundle"),
+        root_dir.join("target/bitcode/libbundle.bundle"),
+    );
+    split_programs(root_dir, "full", &[]);
+    split_programs(root_dir, "thin", &["--thin-link"]);
+    link_shared_buffer(root_dir);
+    program_cache(root_dir);
 
     run_mode(
         target,
@@ -174,6 +416,28 @@ fn compile_test() {
             cfg.llvm_filecheck_preprocess = Some(btf_dump);
         }),
     );
+    // The `tests/server` directory contains tests which are linked by a linker server. They all
+    // link `core`, which the server parses once and reuses for the other links.
+    let socket = root_dir.join("target/linker-server.sock");
+    let log = root_dir.join("target/linker-server.log");
+    let server = LinkerServer::start(&socket, &log);
+    env::set_var("BPF_LINKER_SERVER", &socket);
+    run_mode(
+        target,
+        "assembly",
+        bpf_sysroot.as_ref(),
+        Some(|cfg: &mut compiletest_rs::Config| {
+            cfg.src_base = PathBuf::from("tests/server");
+        }),
+    );
+    env::remove_var("BPF_LINKER_SERVER");
+    drop(server);
+    let log = fs::read_to_string(&log)
+        .unwrap_or_else(|err| panic!("could not read log file '{}': {err}", log.display()));
+    assert!(
+        log.contains("reusing cached module"),
+        "the linker server didn't reuse any module:\n{log}"
+    );
     // The `tests/nightly` directory contains tests which require unstable compiler
     // features through the `-Z` argument in `compile-flags`.
     if is_nightly() {
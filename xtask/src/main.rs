@@ -1,4 +1,12 @@
-use std::{env, ffi::OsString, os::unix::ffi::OsStringExt as _, path::PathBuf, process::Command};
+use std::{
+    env,
+    ffi::OsString,
+    fs,
+    ops::RangeInclusive,
+    os::unix::ffi::OsStringExt as _,
+    path::{Path, PathBuf},
+    process::Command,
+};
 
 use anyhow::{Context as _, Result, bail};
 use rustc_build_sysroot::{BuildMode, SysrootConfig, SysrootStatus};
@@ -24,11 +32,37 @@ struct BuildStd {
     target: Target,
 }
 
+#[derive(clap::Parser)]
+struct Bench {
+    /// Save the results as a baseline with the given name.
+    #[arg(long, conflicts_with = "baseline")]
+    save_baseline: Option<String>,
+    /// Compare the results against the baseline with the given name, and fail
+    /// if a benchmark regressed by more than the threshold.
+    #[arg(long)]
+    baseline: Option<String>,
+    /// The regression of the mean time, in percent, above which the comparison
+    /// fails.
+    #[arg(long, default_value_t = 5.0)]
+    threshold: f64,
+    /// Only run the benchmarks whose name matches this regex.
+    filter: Option<String>,
+    /// Additional arguments passed to `cargo bench`, like `--features`.
+    #[arg(last = true)]
+    cargo_args: Vec<OsString>,
+}
+
 #[derive(clap::Subcommand)]
 enum XtaskSubcommand {
     /// Builds the Rust standard library for the given target in the current
     /// toolchain's sysroot.
     BuildStd(BuildStd),
+    /// Runs the link benchmarks, optionally saving them as a baseline or
+    /// comparing them against one.
+    Bench(Bench),
+    /// Regenerates the inputs of the link benchmarks in `benches/corpus` from
+    /// the sources there, with the current toolchain.
+    BenchCorpus,
 }
 
 /// Additional build commands for bpf-linker.
@@ -85,9 +119,265 @@ fn build_std(options: BuildStd) -> Result<()> {
     Ok(())
 }
 
+/// The target the benchmark corpus is built for.
+const BENCH_TARGET: &str = "bpfel-unknown-none";
+
+/// The corpus sources in `benches/corpus`, each compiled to a bitcode file
+/// named after it.
+const BENCH_CORPUS: &[&str] = &["programs", "di_generics"];
+
+/// The major versions of LLVM the linker can be built against, and so whose
+/// bitcode the benchmark corpus can be made of.
+const SUPPORTED_LLVM: RangeInclusive<u32> = 19..=21;
+
+fn bench_corpus_dir() -> Result<PathBuf> {
+    Ok(Path::new(env!("CARGO_MANIFEST_DIR"))
+        .parent()
+        .context("the xtask crate has no parent directory")?
+        .join("benches")
+        .join("corpus"))
+}
+
+/// Returns the major version of the LLVM of `rustc`, which produces the
+/// bitcode of the corpus.
+fn rustc_llvm_version(rustc: &Path) -> Result<u32> {
+    let output = Command::new(rustc)
+        .args(["--version", "--verbose"])
+        .output()
+        .with_context(|| format!("failed to run {}", rustc.display()))?;
+    let version = String::from_utf8(output.stdout)?;
+    let llvm = version
+        .lines()
+        .find_map(|line| line.strip_prefix("LLVM version: "))
+        .with_context(|| format!("{} has no LLVM version:\n{version}", rustc.display()))?;
+    let major = llvm.split('.').next().unwrap_or(llvm);
+    major
+        .parse()
+        .with_context(|| format!("invalid LLVM version {llvm}"))
+}
+
+fn bench_corpus() -> Result<()> {
+    let corpus_dir = bench_corpus_dir()?;
+    let rustc = env::var_os("RUSTC").map_or_else(|| PathBuf::from("rustc"), PathBuf::from);
+    let llvm = rustc_llvm_version(&rustc)?;
+    if !SUPPORTED_LLVM.contains(&llvm) {
+        bail!(
+            "{} uses LLVM {llvm}, the linker supports LLVM {} to {}",
+            rustc.display(),
+            SUPPORTED_LLVM.start(),
+            SUPPORTED_LLVM.end()
+        );
+    }
+    let target_dir =
+        env::var_os("CARGO_TARGET_DIR").map_or_else(|| PathBuf::from("target"), PathBuf::from);
+    let sysroot = target_dir.join("bench-sysroot");
+    let source_dir = sysroot_dir()?
+        .join("lib")
+        .join("rustlib")
+        .join("src")
+        .join("rust")
+        .join("library");
+    let _: SysrootStatus = rustc_build_sysroot::SysrootBuilder::new(&sysroot, BENCH_TARGET)
+        .build_mode(BuildMode::Build)
+        .sysroot_config(SysrootConfig::NoStd)
+        // The debug info of core is part of what's being benchmarked.
+        .rustflag("-Cdebuginfo=2")
+        .build_from_source(&source_dir)?;
+
+    let out_dir = target_dir.join("bench-corpus");
+    fs::create_dir_all(&out_dir)
+        .with_context(|| format!("failed to create {}", out_dir.display()))?;
+    for name in BENCH_CORPUS {
+        let source = corpus_dir.join(name).with_extension("rs");
+        let mut rustc = Command::new(&rustc);
+        let status = rustc
+            .arg(&source)
+            .args(["--target", BENCH_TARGET, "--edition", "2021"])
+            .args(["--crate-type", "rlib", "--emit", "llvm-bc"])
+            .args([
+                "-C",
+                "opt-level=1",
+                "-C",
+                "debuginfo=2",
+                "-C",
+                "panic=abort",
+            ])
+            .arg("--sysroot")
+            .arg(&sysroot)
+            .arg("--out-dir")
+            .arg(&out_dir)
+            .status()
+            .with_context(|| format!("failed to run {rustc:?}"))?;
+        if !status.success() {
+            bail!("{rustc:?} failed: {status}");
+        }
+        let bitcode = out_dir.join(name).with_extension("bc");
+        let dst = corpus_dir.join(name).with_extension("bc");
+        let _: u64 = fs::copy(&bitcode, &dst).with_context(|| {
+            format!("failed to copy {} to {}", bitcode.display(), dst.display())
+        })?;
+        println!("Wrote {}", dst.display());
+    }
+
+    // The archive corpus links the programs against core.
+    let lib_dir = sysroot
+        .join("lib")
+        .join("rustlib")
+        .join(BENCH_TARGET)
+        .join("lib");
+    let mut core_rlib = None;
+    for entry in
+        fs::read_dir(&lib_dir).with_context(|| format!("failed to read {}", lib_dir.display()))?
+    {
+        let path = entry?.path();
+        if path
+            .file_name()
+            .and_then(|name| name.to_str())
+            .is_some_and(|name| name.starts_with("libcore-") && name.ends_with(".rlib"))
+        {
+            core_rlib = Some(path);
+        }
+    }
+    let core_rlib =
+        core_rlib.with_context(|| format!("could not find libcore in {}", lib_dir.display()))?;
+    let dst = corpus_dir.join("libcore.rlib");
+    let _: u64 = fs::copy(&core_rlib, &dst).with_context(|| {
+        format!(
+            "failed to copy {} to {}",
+            core_rlib.display(),
+            dst.display()
+        )
+    })?;
+    println!("Wrote {}", dst.display());
+    Ok(())
+}
+
+fn bench(options: Bench) -> Result<()> {
+    let Bench {
+        save_baseline,
+        baseline,
+        threshold,
+        filter,
+        cargo_args,
+    } = options;
+
+    let corpus_dir = bench_corpus_dir()?;
+    let generated = BENCH_CORPUS
+        .iter()
+        .map(|name| corpus_dir.join(name).with_extension("bc"))
+        .chain([corpus_dir.join("libcore.rlib")])
+        .all(|path| path.is_file());
+    if !generated {
+        bench_corpus()?;
+    }
+
+    let criterion_dir = env::var_os("CARGO_TARGET_DIR")
+        .map_or_else(|| PathBuf::from("target"), PathBuf::from)
+        .join("criterion");
+    if baseline.is_some() {
+        // Criterion only updates the changes of the benchmarks it runs, don't
+        // let the ones of a previous run fail the comparison.
+        remove_changes(&criterion_dir)?;
+    }
+
+    let mut cargo = Command::new(env::var_os("CARGO").unwrap_or_else(|| OsString::from("cargo")));
+    let _: &mut Command = cargo
+        .args(["bench", "--bench", "link"])
+        .args(cargo_args)
+        .arg("--")
+        .args(filter);
+    if let Some(name) = &save_baseline {
+        let _: &mut Command = cargo.args(["--save-baseline", name]);
+    }
+    if let Some(name) = &baseline {
+        let _: &mut Command = cargo.args(["--baseline", name]);
+    }
+    let status = cargo
+        .status()
+        .with_context(|| format!("failed to run {cargo:?}"))?;
+    if !status.success() {
+        bail!("{cargo:?} failed: {status}");
+    }
+
+    let Some(baseline) = baseline else {
+        return Ok(());
+    };
+    let mut changes = Vec::new();
+    collect_changes(&criterion_dir, &criterion_dir, &mut changes)?;
+    changes.sort_by(|(a, _), (b, _)| a.cmp(b));
+    let mut regressions = 0;
+    for (name, change) in &changes {
+        let change = change * 100.0;
+        let regressed = change > threshold;
+        if regressed {
+            regressions += 1;
+        }
+        println!(
+            "{name}: {change:+.2}%{}",
+            if regressed { " (regressed)" } else { "" }
+        );
+    }
+    if regressions > 0 {
+        bail!("{regressions} benchmarks regressed by more than {threshold}% against {baseline}");
+    }
+    Ok(())
+}
+
+/// Removes the `change` directories criterion writes when comparing against a
+/// baseline.
+fn remove_changes(dir: &Path) -> Result<()> {
+    if !dir.is_dir() {
+        return Ok(());
+    }
+    for entry in fs::read_dir(dir).with_context(|| format!("failed to read {}", dir.display()))? {
+        let path = entry?.path();
+        if !path.is_dir() {
+            continue;
+        }
+        if path.file_name().is_some_and(|name| name == "change") {
+            fs::remove_dir_all(&path)
+                .with_context(|| format!("failed to remove {}", path.display()))?;
+        } else {
+            remove_changes(&path)?;
+        }
+    }
+    Ok(())
+}
+
+/// Collects the relative change of the mean time of every benchmark under
+/// `dir`, from the `change/estimates.json` files criterion writes. Benchmarks
+/// are named after their directory relative to `criterion_dir`.
+fn collect_changes(
+    criterion_dir: &Path,
+    dir: &Path,
+    changes: &mut Vec<(String, f64)>,
+) -> Result<()> {
+    let estimates = dir.join("change").join("estimates.json");
+    if estimates.is_file() {
+        let json = fs::read(&estimates)
+            .with_context(|| format!("failed to read {}", estimates.display()))?;
+        let json: serde_json::Value = serde_json::from_slice(&json)
+            .with_context(|| format!("failed to parse {}", estimates.display()))?;
+        let change = json["mean"]["point_estimate"]
+            .as_f64()
+            .with_context(|| format!("no mean estimate in {}", estimates.display()))?;
+        let name = dir.strip_prefix(criterion_dir)?;
+        changes.push((name.display().to_string(), change));
+    }
+    for entry in fs::read_dir(dir).with_context(|| format!("failed to read {}", dir.display()))? {
+        let path = entry?.path();
+        if path.is_dir() && path.file_name().is_some_and(|name| name != "change") {
+            collect_changes(criterion_dir, &path, changes)?;
+        }
+    }
+    Ok(())
+}
+
 fn main() -> Result<()> {
     let CommandLine { subcommand } = clap::Parser::parse();
     match subcommand {
         XtaskSubcommand::BuildStd(options) => build_std(options),
+        XtaskSubcommand::Bench(options) => bench(options),
+        XtaskSubcommand::BenchCorpus => bench_corpus(),
     }
 }